@@ -37,7 +37,7 @@
 
 from __future__ import print_function
 
-import os, os.path, pwd, grp, sys, stat
+import os, os.path, pwd, grp, sys, stat, subprocess
 import glob, time
 from optparse import OptionParser
 
@@ -64,6 +64,30 @@ read_python_conf()
 import yaml
 
 
+def dbglob(dbdir, pattern):
+    """DB entries matching pattern, in the shards of dbdir (see ws_index --shards) and flat"""
+    dirs = []
+    if os.path.exists(os.path.join(dbdir, '.ws_shards')):
+        dirs = sorted(glob.glob(os.path.join(dbdir, '[0-9a-f][0-9a-f]')))
+    found = {}
+    for d in dirs + [dbdir]:
+        for f in glob.glob(os.path.join(d, pattern)):
+            found.setdefault(os.path.basename(f), f)
+    return list(found.values())
+
+def aclfilesystems():
+    """filesystems the ACLs let the user list, from the ACL engine of ws_list (ws_list --acl)"""
+    ws_list = os.path.join(os.path.dirname(os.path.realpath(sys.argv[0])), 'ws_list')
+    if not os.access(ws_list, os.X_OK):
+        ws_list = 'ws_list'
+    try:
+        out = subprocess.check_output([ws_list, '--acl'], universal_newlines=True)
+    except (OSError, subprocess.CalledProcessError):
+        print("Error: could not get the allowed filesystems from ws_list --acl", file=sys.stderr)
+        sys.exit(-1)
+    return set(out.split())
+
+
 # print a entry
 def printentry(entry, admin, terse, verbose):
     if verbose: terse = False
@@ -152,26 +176,9 @@ if(options.filesystem):
 else:
     filesystems = config['workspaces'].keys()
 
-# reduce list to allowed filesystems
-legal=[]
-for f in filesystems:
-    userok=True
-    if (('user_acl' in config['workspaces'][f] and len(config['workspaces'][f]['user_acl'])>0 ) or
-        ('group_acl' in config['workspaces'][f] and len(config['workspaces'][f]['group_acl'])>0)):
-        userok=False
-    if 'group_acl' in config['workspaces'][f]:
-        for g in groups:
-            if g in config['workspaces'][f]['group_acl']:
-                userok=True
-                break
-        if group in config['workspaces'][f]['group_acl']:
-            userok=True
-    if 'user_acl' in config['workspaces'][f]:
-        if user in config['workspaces'][f]['user_acl']:
-            userok=True
-     # admin can see workspaces from anywhere, but can also restrict
-    if userok or admin:
-        legal.append(f)
+# reduce list to allowed filesystems, admin can see workspaces from anywhere
+allowed = aclfilesystems()
+legal = [f for f in filesystems if admin or f in allowed]
 
 # list workspaces (only allowed ones), exit after done
 if options.filesystemlist:
@@ -215,22 +222,23 @@ for fs in legal:
     if admin:
         if not options.expired:
             if options.user:
-                pattern = os.path.join(config['workspaces'][fs]['database'],options.user+'-'+filepattern)
+                dbdir, pattern = config['workspaces'][fs]['database'], options.user+'-'+filepattern
             else:
-                pattern = os.path.join(config['workspaces'][fs]['database'],'*-'+filepattern)
+                dbdir, pattern = config['workspaces'][fs]['database'], '*-'+filepattern
         else:
             if options.user:
-                pattern = os.path.join(config['workspaces'][fs]['database'],config['workspaces'][fs]['deleted'],
-                                                                                                options.user+'-'+filepattern)
+                dbdir = os.path.join(config['workspaces'][fs]['database'],config['workspaces'][fs]['deleted'])
+                pattern = options.user+'-'+filepattern
             else:
-                pattern = os.path.join(config['workspaces'][fs]['database'],config['workspaces'][fs]['deleted'],'*-'+filepattern)
+                dbdir = os.path.join(config['workspaces'][fs]['database'],config['workspaces'][fs]['deleted'])
+                pattern = '*-'+filepattern
     else:
         if options.groupws:
-            pattern = os.path.join(config['workspaces'][fs]['database'],'*-'+filepattern)
+            dbdir, pattern = config['workspaces'][fs]['database'], '*-'+filepattern
         else:
-            pattern = os.path.join(config['workspaces'][fs]['database'],user+'-'+filepattern)
+            dbdir, pattern = config['workspaces'][fs]['database'], user+'-'+filepattern
 
-    for ws in glob.glob(pattern):
+    for ws in dbglob(dbdir, pattern):
         if options.groupws:
             if not os.path.basename(ws).startswith(user+"-"):
                 mode = os.stat(ws).st_mode
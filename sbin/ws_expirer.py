@@ -35,6 +35,7 @@
 import os, sys
 import glob
 import time
+import subprocess
 import smtplib
 import os.path
 import shutil
@@ -151,6 +152,33 @@ def slowdeldir(dir):
                 time.sleep(0.1)
                 count=0
 
+# DB entries matching pattern, in the shards of dbdir (see ws_index --shards) and flat
+def dbglob(dbdir, pattern):
+    dirs = []
+    if os.path.exists(os.path.join(dbdir, '.ws_shards')):
+        dirs = sorted(glob.glob(os.path.join(dbdir, '[0-9a-f][0-9a-f]')))
+    found = {}
+    for d in dirs + [dbdir]:
+        for f in glob.glob(os.path.join(d, pattern)):
+            found.setdefault(os.path.basename(f), f)
+    return list(found.values())
+
+# file a new entry (flat name) is written to, in the shard of its user if the
+# directory is sharded, same hash as WsShards in the C++ tools
+def dbcanonical(filename):
+    dbdir, name = os.path.split(filename)
+    try:
+        with open(os.path.join(dbdir, '.ws_shards')) as f:
+            fanout = int(f.read().split()[0])
+    except (IOError, OSError, ValueError, IndexError):
+        return filename
+    if fanout < 1 or fanout > 256:
+        return filename
+    h = 14695981039346656037
+    for c in os.fsencode(name.split('-')[0]):
+        h = ((h ^ c) * 1099511628211) & 0xffffffffffffffff
+    return os.path.join(dbdir, "%02x" % (h % fanout), name)
+
 # getting old workspace database informations (path and expiration date)
 def get_old_db_entry_informations(dbfile):
     D = {}
@@ -181,6 +209,28 @@ def get_dbentriesws(dbfullpathlist):
              pass
     return W
 
+# rebuild the binary index of a DB directory if it has one, as the expirer
+# moves DB entries around without maintaining it
+def update_index(fs, deleted):
+    dbdir = config["workspaces"][fs]["database"]
+    if deleted:
+        dbdir = os.path.join(dbdir, config["workspaces"][fs]["deleted"])
+    if not os.path.exists(os.path.join(dbdir, ".ws_index")):
+        return
+    ws_index = os.path.join(os.path.dirname(os.path.abspath(sys.argv[0])), "ws_index")
+    if not os.path.exists(ws_index):
+        ws_index = "ws_index"
+    args = [ws_index, "--rebuild", "-F", fs]
+    if deleted:
+        args.append("--deleted")
+    if not dryrun:
+        if subprocess.call(args) != 0:
+            print("  FAILED to rebuild index for", dbdir)
+        else:
+            print("  REBUILD INDEX", dbdir)
+    else:
+        print("  REBUILD INDEX", dbdir)
+
 # Options Parsing ...
 def vararg_callback(option, opt_str, value, parser):
     assert value is None
@@ -273,7 +323,7 @@ for fs in fslist:
             print("  FAILED to access", fs, "in config file")
             continue
         spaces = config["workspaces"][fs]["spaces"]	
-        dbentries = glob.glob(os.path.join(dbdir,"*-*"))
+        dbentries = dbglob(dbdir,"*-*")
         dbentrynames = list(map(os.path.basename, dbentries))
         dbentriesws=get_dbentriesws(dbentries)
         dbentryworkspaces=list(map(os.path.basename, dbentriesws))
@@ -299,7 +349,7 @@ for fs in fslist:
                                 print("  valid workspace", ws)
 
         # second for removed workspaces
-        dbdelentries = glob.glob(os.path.join(dbdir,config["workspaces"][fs]["deleted"],"*-*"))
+        dbdelentries = dbglob(os.path.join(dbdir,config["workspaces"][fs]["deleted"]),"*-*")
         dbdelentrynames = list(map(os.path.basename, dbdelentries))
         for space in spaces:
                 for ws in glob.glob(os.path.join(space,config["workspaces"][fs]["deleted"],"*-*")):	
@@ -325,7 +375,7 @@ for fs in fslist:
     workspacedelprefix = config["workspaces"][fs]["deleted"]
     dbdir = config["workspaces"][fs]["database"]
     print("PHASE: checking for workspaces to be expired for", fs, dbdir, spaces)
-    for dbentryfilename in glob.glob(os.path.join(dbdir,"*-*")):
+    for dbentryfilename in dbglob(dbdir,"*-*"):
         reminder = 0
         mailaddress = ""
         workspace = ""
@@ -355,11 +405,12 @@ for fs in fslist:
         if time.time() > expiration:
             print("  expiring", dbentryfilename,"  (expired",time.ctime(expiration),")")
             timestamp=str(int(time.time()))
+            dbdelentryfilename = dbcanonical(os.path.join(dbdeldir, os.path.basename(dbentryfilename))+"-"+timestamp)
             if not dryrun:
-                os.rename(dbentryfilename, os.path.join(dbdeldir, os.path.basename(dbentryfilename))+"-"+timestamp)
-                print("  OS.RENAME", dbentryfilename, os.path.join(dbdeldir, os.path.basename(dbentryfilename))+"-"+timestamp)
+                os.rename(dbentryfilename, dbdelentryfilename)
+                print("  OS.RENAME", dbentryfilename, dbdelentryfilename)
             else:
-                print("  MV", dbentryfilename, os.path.join(dbdeldir, os.path.basename(dbentryfilename))+"-"+timestamp)
+                print("  MV", dbentryfilename, dbdelentryfilename)
 
             # FIXME this could fail on scatefs, should fallback to 'mv'
             if not dryrun:
@@ -400,7 +451,7 @@ for fs in fslist:
     keeptime = config["workspaces"][fs]["keeptime"]
     print("  keeptime:",keeptime)
     workspacedelprefix = config["workspaces"][fs]["deleted"]
-    for dbentryfilename in glob.glob(os.path.join(dbdeldir,"*-*-*")):
+    for dbentryfilename in dbglob(dbdeldir,"*-*-*"):
         workspace = ""
         expiration = 0
         try:
@@ -460,6 +511,12 @@ for fs in fslist:
             print("  (keeping further restorable",dbentryfilename,"until",time.ctime(expiration + keeptime*24*3600),")")
 
 
+# bring the indexes up to date with the moves done above
+for fs in fslist:
+    if fs in config["workspaces"]:
+        update_index(fs, False)
+        update_index(fs, True)
+
 
 end = time.time()
 print("end of expirer run after ",end-start,"seconds at",time.ctime())
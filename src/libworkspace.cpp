@@ -0,0 +1,212 @@
+/*
+ *  workspace++
+ *
+ *  libworkspace
+ *
+ *  C API around Workspace, see libworkspace.h
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <cstring>
+#include <functional>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#ifndef SETUID
+#include <sys/capability.h>
+#endif
+
+#include "ws.h"
+#include "wsconfig.h"
+#include "wsdirs.h"
+#include "wserror.h"
+#include "libworkspace.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+
+/*
+ * credentials and umask of the caller, taken on construction and restored on destruction
+ */
+class CallerState {
+    uid_t euid;
+    gid_t egid;
+    mode_t mask;
+#ifndef SETUID
+    cap_t caps;
+#endif
+
+public:
+    CallerState() : euid(geteuid()), egid(getegid()) {
+        mask = umask(0);
+        umask(mask);
+#ifndef SETUID
+        caps = cap_get_proc();
+#endif
+        Workspace::embedded = true;
+    }
+
+    ~CallerState() {
+#ifdef SETUID
+        // root first, from whatever Workspace left as effective uid
+        if (seteuid(0)) {}
+        if (setegid(egid) || seteuid(euid)) {}
+#else
+        cap_set_proc(caps);
+        cap_free(caps);
+#endif
+        umask(mask);
+    }
+};
+
+
+static void copystring(char *target, const size_t size, const string &source) {
+    strncpy(target, source.c_str(), size - 1);
+    target[size - 1] = '\0';
+}
+
+/*
+ * run one call, errors go to result instead of ending the process
+ */
+static int call(ws_result_t *result, const function<void()> &work) {
+    memset(result, 0, sizeof(*result));
+    CallerState state;
+    try {
+        work();
+    } catch (const WsError &e) {
+        result->status = e.code ? e.code : 1;
+        copystring(result->message, sizeof(result->message), e.what());
+    } catch (const exception &e) {
+        result->status = 1;
+        copystring(result->message, sizeof(result->message), e.what());
+    }
+    // directories may be replaced before the next call, by an admin or a restore
+    WsDirs::clear();
+    return result->status;
+}
+
+/*
+ * options as the commandline of the tools would give them
+ */
+static void setoption(po::variables_map &opt, const string &key, const boost::any &value) {
+    opt.insert(make_pair(key, po::variable_value(value, false)));
+}
+
+static string self() {
+    return Workspace::getusername();
+}
+
+static void checkuser(const string &user, const bool extension) {
+    // like ws_allocate -u, other users only for root, or to extend a workspace
+    if (!user.empty() && user != self() && getuid() != 0 && !extension) {
+        throw WsError(1, "only root can do that for other users.");
+    }
+}
+
+static void allocate(const char *filesystem, const char *user, const char *name, int duration,
+                     const bool extension, ws_result_t *result) {
+    const WsConfig &config = WsConfig::get();
+    string fsname = filesystem ? filesystem : "";
+    string owner = user ? user : "";
+    if (name == NULL || *name == '\0') {
+        throw WsError(1, "no workspace name given.");
+    }
+    checkuser(owner, extension);
+    if (duration <= 0 && !extension) {
+        duration = config.durationdefault;
+    }
+
+    po::variables_map opt;
+    setoption(opt, "name", string(name));
+    setoption(opt, "duration", duration);
+    setoption(opt, "groupname", string(""));
+    if (fsname != "") {
+        setoption(opt, "filesystem", fsname);
+    }
+    if (owner != "") {
+        setoption(opt, "username", owner);
+    }
+    if (extension) {
+        setoption(opt, "extension", string(""));
+    }
+
+    // reminders go to the local account, like ws_allocate without mail address
+    int reminder = config.reminderdefault;
+    string mailaddress = reminder != 0 && !extension ? (owner != "" ? owner : self()) : "";
+
+    Workspace ws(WS_Allocate, opt, duration, fsname);
+    WsAllocation allocation = ws.allocate(name, extension, reminder, mailaddress, owner, "", "");
+    copystring(result->path, sizeof(result->path), allocation.wsdir);
+    result->expiration = allocation.expiration;
+    result->extensions = allocation.extensions;
+    result->created = allocation.created;
+}
+
+
+extern "C" {
+
+int ws_api_version(void) {
+    return WS_API_VERSION;
+}
+
+int ws_allocate_workspace(const char *filesystem, const char *user, const char *name, int duration,
+                          ws_result_t *result) {
+    return call(result, [&]() { allocate(filesystem, user, name, duration, false, result); });
+}
+
+int ws_extend_workspace(const char *filesystem, const char *user, const char *name, int duration,
+                        ws_result_t *result) {
+    return call(result, [&]() { allocate(filesystem, user, name, duration, true, result); });
+}
+
+int ws_release_workspace(const char *filesystem, const char *user, const char *name, ws_result_t *result) {
+    return call(result, [&]() {
+        string fsname = filesystem ? filesystem : "";
+        string owner = user ? user : "";
+        if (name == NULL || *name == '\0') {
+            throw WsError(1, "no workspace name given.");
+        }
+        checkuser(owner, false);
+
+        po::variables_map opt;
+        setoption(opt, "name", string(name));
+        if (fsname != "") {
+            setoption(opt, "filesystem", fsname);
+        }
+        // root releases workspaces of others by full DB name, like ws_release --userworkspace
+        string dbname = name;
+        if (owner != "" && owner != self()) {
+            setoption(opt, "userworkspace", string(""));
+            dbname = owner + "-" + name;
+        }
+
+        Workspace ws(WS_Release, opt, 0, fsname);
+        ws.release(dbname);
+    });
+}
+
+}
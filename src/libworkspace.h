@@ -0,0 +1,83 @@
+#ifndef LIBWORKSPACE_H
+#define LIBWORKSPACE_H
+
+/*
+ *  workspace++
+ *
+ *  libworkspace, C API to allocate, extend and release workspaces in process,
+ *  e.g. from a privileged job prologue plugin, without running the setuid tools.
+ *
+ *  The calls do the same checks and DB updates as ws_allocate and ws_release, and
+ *  need the same privileges: the calling process has to run as root (SETUID build)
+ *  or with CAP_DAC_OVERRIDE and CAP_CHOWN (capability build). Effective uid and gid,
+ *  effective capabilities and umask of the caller are restored before a call returns.
+ *  ws.conf is read on the first call and kept for the lifetime of the process.
+ *  The calls change process credentials, so they must not run concurrently.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* changes with incompatible changes of the functions or of ws_result_t */
+#define WS_API_VERSION 1
+
+/*
+ * result of a call
+ */
+typedef struct ws_result {
+    int status;             /* 0, or the code ws_allocate/ws_release would exit with */
+    char message[1024];     /* error message if status is not 0 */
+    char path[4096];        /* workspace directory (allocate and extend) */
+    long expiration;        /* expiration as unix time (allocate and extend) */
+    int extensions;         /* remaining extensions (allocate and extend) */
+    int created;            /* 1 if allocate created the workspace, 0 if it existed */
+} ws_result_t;
+
+/* WS_API_VERSION the library was built with */
+int ws_api_version(void);
+
+/*
+ * all calls return result->status
+ *
+ * filesystem   workspace filesystem, NULL or "" for the default of the user
+ * user         owner of the workspace, NULL or "" for the calling user, other
+ *              users need a caller with uid 0 (like ws_allocate -u)
+ * name         workspace name
+ * duration     days, 0 for the default duration on allocation
+ */
+
+/* like ws_allocate [-F filesystem] [-u user] name duration, existing workspaces are reused */
+int ws_allocate_workspace(const char *filesystem, const char *user, const char *name, int duration,
+                          ws_result_t *result);
+
+/* like ws_allocate -x [-F filesystem] [-u user] name duration */
+int ws_extend_workspace(const char *filesystem, const char *user, const char *name, int duration,
+                        ws_result_t *result);
+
+/* like ws_release [-F filesystem] name, for the workspace of user */
+int ws_release_workspace(const char *filesystem, const char *user, const char *name, ws_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -39,9 +39,12 @@
 #include <grp.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <time.h>
 #include <pwd.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
 #include <syslog.h>
 
 
@@ -74,6 +77,15 @@ const int CAP_CHOWN = 1;
 
 #include "ws.h"
 #include "wsdb.h"
+#include "wsdirs.h"
+#include "wsindex.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsacl.h"
+#include "wsgroups.h"
+#include "wsmove.h"
+#include "wsplacement.h"
+#include "wserror.h"
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -87,59 +99,198 @@ using namespace std;
  */
 Workspace::Workspace(const whichclient clientcode, const po::variables_map _opt, const int _duration,
                      string _filesystem)
-    : opt(_opt), duration(_duration), filesystem(_filesystem)
+    : config(WsConfig::get()), opt(_opt), duration(_duration), filesystem(_filesystem)
 {
 
     // set a umask so users can access db files
     umask(0002);
 
-    // read config
-    try {
-        config = YAML::LoadFile("/etc/ws.conf");
-    } catch (const YAML::BadFile& e) {
-        cerr << "Error: Could not read config file!" << endl;
-        cerr << e.what() << endl;
-        exit(-1);
-    }
-    db_uid = config["dbuid"].as<int>();
-    db_gid = config["dbgid"].as<int>();
+    // config is read once per process, see WsConfig
+    db_uid = config.dbuid;
+    db_gid = config.dbgid;
 
     // lower capabilities to minimum
     drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, db_uid);
     // read private config
-    raise_cap(CAP_DAC_OVERRIDE);
-    try {
-        userconfig = YAML::LoadFile("/etc/ws_private.conf");
-    } catch (const YAML::BadFile&) {
-        // we do not care
+    {
+        WsPrivileges priv({CAP_DAC_OVERRIDE});
+        try {
+            userconfig = YAML::LoadFile("/etc/ws_private.conf");
+        } catch (const YAML::BadFile&) {
+            // we do not care
+        }
     }
-    // lower again, nothing needed
-    lower_cap(CAP_DAC_OVERRIDE, db_uid);
 
     username = getusername(); // FIXME is this correct? what if username given on commandline?
 
     // valide the input  (opt contains name, duration and filesystem as well)
-    validate(clientcode, config, userconfig, opt, filesystem, duration, maxextensions, acctcode);
+    validate(clientcode, userconfig, opt, filesystem, duration, maxextensions, acctcode);
+}
+
+/*
+ * validate another request, ACLs and limits are checked in memory
+ */
+void Workspace::setrequest(const whichclient clientcode, const po::variables_map _opt, const int _duration,
+                           string _filesystem)
+{
+    opt = _opt;
+    duration = _duration;
+    filesystem = _filesystem;
+    validate(clientcode, userconfig, opt, filesystem, duration, maxextensions, acctcode);
+}
+
+enum ProbeResult { PROBE_PENDING, PROBE_ABSENT, PROBE_EXISTS, PROBE_TIMEOUT };
+
+static long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*
+ * check existence of DB entries on several filesystems at once, so a slow filesystem
+ * costs its own latency and not the sum, and one which does not answer within its
+ * timeout (ms, 0 waits forever) is given up. Each check runs in a child process, as
+ * a thread hanging in stat would also hang the seteuid calls of this process.
+ * Embedded in another process (libworkspace), which may have threads holding locks
+ * a forked child would need, the checks run one after the other without timeout.
+ * files are in order of preference, once an entry exists, later ones are not waited
+ * for and stay PROBE_PENDING.
+ */
+static vector<ProbeResult> probe_entries(const vector<string> &files, const vector<int> &timeouts) {
+    size_t n = files.size();
+    vector<ProbeResult> result(n, PROBE_PENDING);
+    vector<int> fds(n, -1);
+    vector<pid_t> pids(n, -1);
+
+    if (n == 1 || Workspace::embedded) {
+        for (size_t i=0; i<n; i++) {
+            result[i] = WsShards::exists(files[i]) ? PROBE_EXISTS : PROBE_ABSENT;
+            if (result[i] == PROBE_EXISTS) break;
+        }
+        return result;
+    }
+
+    long start = now_ms();
+    for (size_t i=0; i<n; i++) {
+        int p[2];
+        pid_t pid = -1;
+        if (pipe(p) == 0 && (pid = fork()) == 0) {
+            close(p[0]);
+            char c = WsShards::exists(files[i]) ? 'y' : 'n';
+            if (write(p[1], &c, 1)) {}
+            _exit(0);
+        }
+        if (pid < 0) {
+            // no process, check here
+            result[i] = WsShards::exists(files[i]) ? PROBE_EXISTS : PROBE_ABSENT;
+            continue;
+        }
+        close(p[1]);
+        fds[i] = p[0];
+        pids[i] = pid;
+    }
+
+    while (true) {
+        // decided once the first entry not known to be absent exists
+        size_t first = 0;
+        while (first < n && (result[first] == PROBE_ABSENT || result[first] == PROBE_TIMEOUT)) first++;
+        if (first == n || result[first] == PROBE_EXISTS) break;
+
+        vector<struct pollfd> pfds;
+        vector<size_t> idx;
+        long wait = -1;
+        long elapsed = now_ms() - start;
+        for (size_t i=0; i<n; i++) {
+            if (result[i] != PROBE_PENDING) continue;
+            struct pollfd pfd = { fds[i], POLLIN, 0 };
+            pfds.push_back(pfd);
+            idx.push_back(i);
+            if (timeouts[i] > 0) {
+                long left = max(0L, timeouts[i] - elapsed);
+                if (wait < 0 || left < wait) wait = left;
+            }
+        }
+        if (poll(pfds.data(), pfds.size(), wait) < 0 && errno != EINTR) break;
+
+        elapsed = now_ms() - start;
+        for (size_t j=0; j<pfds.size(); j++) {
+            size_t i = idx[j];
+            if (pfds[j].revents) {
+                char c = 'n';
+                if (read(fds[i], &c, 1) != 1) c = 'n';
+                result[i] = c == 'y' ? PROBE_EXISTS : PROBE_ABSENT;
+                close(fds[i]);
+                fds[i] = -1;
+                waitpid(pids[i], NULL, 0);
+            } else if (timeouts[i] > 0 && elapsed >= timeouts[i]) {
+                result[i] = PROBE_TIMEOUT;
+            }
+        }
+    }
+
+    // give up on checks still running. A child in an uninterruptible stat of a
+    // hung mount does not die, so it is not waited for, it is reparented when we exit
+    for (size_t i=0; i<n; i++) {
+        if (fds[i] < 0) continue;
+        close(fds[i]);
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, WNOHANG);
+    }
+    return result;
+}
+
+#ifdef LUACALLOUTS
+// interpreters of prefix callouts, loaded once per process and kept
+// by ws_brokerd, whose request processes get a copy of the loaded state
+static map<string, lua_State*> luastates;
+
+static lua_State* loadcallout(const string &script) {
+    auto it = luastates.find(script);
+    if (it != luastates.end()) {
+        return it->second;
+    }
+    lua_State* L = lua_open();
+    luaL_openlibs(L);
+    if(luaL_dofile(L, script.c_str())) {
+        cerr << "Error: prefix callout script <"<< script << "> does not exist or other lua error!"  << endl;
+        cerr << lua_tostring(L, -1) << endl;
+        lua_close(L);
+        L = NULL;
+    }
+    luastates[script] = L;
+    return L;
+}
+#endif
+
+/*
+ * load the prefix callouts of all filesystems, for long running processes
+ */
+void Workspace::preload_callouts() {
+#ifdef LUACALLOUTS
+    for (const FilesystemConfig &fs: WsConfig::get().filesystems) {
+        if (fs.prefix_callout != "") {
+            loadcallout(fs.prefix_callout);
+        }
+    }
+#endif
 }
 
 /*
  *  create a workspace and its DB entry
  */
-void Workspace::allocate(const string name, const bool extensionflag, const int reminder, const string mailaddress, string user_option, const string groupname, const string comment) {
+WsAllocation Workspace::allocate(const string name, const bool extensionflag, const int reminder, const string mailaddress, string user_option, const string groupname, const string comment) {
     string wsdir, wsdir_nopostfix;
     int extension;
     long expiration;
 #ifdef LUACALLOUTS
     // see if we have a prefix callout
     string prefixcallout;
-    lua_State* L;
-    if(config["workspaces"][filesystem]["prefix_callout"]) {
-        prefixcallout = config["workspaces"][filesystem]["prefix_callout"].as<string>();
-        L = lua_open();
-        luaL_openlibs(L);
-        if(luaL_dofile(L, prefixcallout.c_str())) {
-            cerr << "Error: prefix callout script <"<< prefixcallout << "> does not exist or other lua error!"  << endl;
-            cerr << lua_tostring(L, -1) << endl;
+    lua_State* L = NULL;
+    if(config.fs(filesystem).prefix_callout != "") {
+        prefixcallout = config.fs(filesystem).prefix_callout;
+        L = loadcallout(prefixcallout);
+        if (L == NULL) {
             prefixcallout = "";
         }
     }
@@ -171,54 +322,63 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 		}
     }
 
-	// loop over valid workspaces
+    // construct db-entry names, special case if called by root with -x and -u, allows overwrite of maxextensions
+    vector<string> dbfilenames;
+    vector<int> timeouts;
     for(string cfilesystem: searchlist) {
-      // construct db-entry name, special case if called by root with -x and -u, allows overwrite of maxextensions
+        if(user_option.length()>0 && (extensionflag || getuid()==0)) {
+            dbfilenames.push_back(config.fs(cfilesystem).database + "/"+user_option+"-"+name);
+        } else {
+            dbfilenames.push_back(config.fs(cfilesystem).database + "/"+username+"-"+name);
+        }
+        timeouts.push_back(config.fs(cfilesystem).probetimeout);
+        if (opt.count("debug")) {
+            cerr << "debug: check existance of db entry <" << dbfilenames.back() << ">" << endl;
+        }
+    }
+
+    // does db entry exist? checked on all filesystems at once
+    vector<ProbeResult> probes = probe_entries(dbfilenames, timeouts);
+
+	// loop over valid workspaces, in order of preference
+    for(size_t i=0; i<searchlist.size(); i++) {
+      string cfilesystem = searchlist[i];
+      dbfilename = dbfilenames[i];
       if (opt.count("debug")) {
 		  cerr << "debug: searching valid filesystems " << cfilesystem << endl;
 	  }
 
-      if(extensionflag && user_option.length()>0) {
-          dbfilename=config["workspaces"][cfilesystem]["database"].as<string>() + "/"+user_option+"-"+name;
-          if(!fs::exists(dbfilename)) {
-              cerr << "Error: workspace does not exist, can not be extended!" << endl;
-              exit(-1);
-			  // FIXME looks wrong? exit in loops?
-          }
-      } else { 
-          if(user_option.length()>0 && (getuid()==0)) {
-              dbfilename=config["workspaces"][cfilesystem]["database"].as<string>() + "/"+user_option+"-"+name;
-          } else { 
-              dbfilename=config["workspaces"][cfilesystem]["database"].as<string>() + "/"+username+"-"+name;
-          }
+      if(extensionflag && user_option.length()>0 && probes[i] == PROBE_ABSENT) {
+          throw WsError(-1, "workspace does not exist, can not be extended!");
+		  // FIXME looks wrong? exit in loops?
       }
 
-      // does db entry exist?
-      if (opt.count("debug")) {
-		  cerr << "debug: check existance of db entry <" << dbfilename << ">" << endl;
-	  }
+      // a new entry would be created on this filesystem, so it has to be known if
+      // there is one, for the other filesystems a slow answer is given up
+      if (probes[i] == PROBE_TIMEOUT && cfilesystem == filesystem) {
+          cerr << "Info: filesystem " << cfilesystem << " is slow, waiting for it." << endl;
+          probes[i] = WsShards::exists(dbfilename) ? PROBE_EXISTS : PROBE_ABSENT;
+      }
+      if (probes[i] == PROBE_TIMEOUT) {
+          cerr << "Warning: filesystem " << cfilesystem << " did not answer in time, not searched for the workspace." << endl;
+          continue;
+      }
 
-	  // extra error checking, this could acess a path that does not exist and could give unexpected errors/throw
-	  boost::system::error_code ec;
-      if(fs::exists(dbfilename, ec)) {
-          WsDB dbentry(dbfilename,  config["dbuid"].as<int>(),  config["dbgid"].as<int>());
+      if(probes[i] == PROBE_EXISTS) {
+          WsDB dbentry(dbfilename,  config.dbuid,  config.dbgid);
           wsdir = dbentry.getwsdir();
           extension = dbentry.getextension();
           expiration = dbentry.getexpiration();
           // if it exists, print it, if extension is required, extend it
           if(extensionflag) {
-              if ( config["workspaces"][cfilesystem]["extendable"] ) {
-                  if ( config["workspaces"][cfilesystem]["extendable"].as<bool>() == false ) {
-                      cerr << "Error: workspaces can not be extended in this filesystem." << endl;
-                      exit(1);
-                  }
+              if ( !config.fs(cfilesystem).extendable ) {
+                  throw WsError(1, "workspaces can not be extended in this filesystem.");
               }
               // we allow a user to specify -u -x together, and to extend a workspace if he has rights on the workspace
               if(user_option.length()>0 && (user_option != username) && (getuid() != 0)) {
                   cerr << "Info: you are not owner of the workspace." << endl;
                   if(access(wsdir.c_str(), R_OK|W_OK|X_OK)!=0) {
-                      cerr << "Info: and you have no permissions to access the workspace, workspace will not be extended." << endl;
-                      exit(-1);
+                      throw WsError(-1, "you have no permissions to access the workspace, workspace will not be extended.");
                   }
               }
               cerr << "Info: extending workspace." << endl;
@@ -258,27 +418,25 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
           break;
       } else {
       	if (opt.count("debug")) {
-		  cerr << "error: existence check: " << ec << " for " << dbfilename << endl;
+		  cerr << "debug: no db entry <" << dbfilename << ">" << endl;
 		}
 	  }
     } // loop over searchlist
 
     if (!ws_exists) {
         if(extensionflag && user_option.length()>0) {
-            dbfilename=config["workspaces"][filesystem]["database"].as<string>() + "/"+user_option+"-"+name;
-            if(!fs::exists(dbfilename)) {
-                cerr << "Error: workspace does not exist, can not be extended!" << endl;
-                exit(-1);
+            dbfilename=config.fs(filesystem).database + "/"+user_option+"-"+name;
+            if(!WsShards::exists(dbfilename)) {
+                throw WsError(-1, "workspace does not exist, can not be extended!");
             }
         } else {
             if(user_option.length()>0 && (getuid()==0)) {
-                dbfilename=config["workspaces"][filesystem]["database"].as<string>() + "/"+user_option+"-"+name;
+                dbfilename=config.fs(filesystem).database + "/"+user_option+"-"+name;
             } else {
-                dbfilename=config["workspaces"][filesystem]["database"].as<string>() + "/"+username+"-"+name;
+                dbfilename=config.fs(filesystem).database + "/"+username+"-"+name;
                 if(extensionflag) {
-                      if(!fs::exists(dbfilename)) {
-                          cerr << "Error: workspace does not exist, can not be extended!" << endl;
-                          exit(-1);
+                      if(!WsShards::exists(dbfilename)) {
+                          throw WsError(-1, "workspace does not exist, can not be extended!");
                       }
                 }
             }
@@ -286,15 +444,11 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 
 
         // workspace does not exist, we have to create one
-        if( config["workspaces"][filesystem]["allocatable"] &&
-            config["workspaces"][filesystem]["allocatable"].as<bool>() == false )  {
-            cerr << "Error: this workspace can not be used for allocation." << endl;
-            exit(1);
+        if( !config.fs(filesystem).allocatable )  {
+            throw WsError(1, "this workspace can not be used for allocation.");
         }
         // if it does not exist, create it
         cerr << "Info: creating workspace." << endl;
-        // read the possible spaces for the filesystem
-        vector<string> spaces = config["workspaces"][filesystem]["spaces"].as<vector<string> >();
         string prefix = "";
 
         // the lua function "prefix" gets called as prefix(filesystem, username)
@@ -312,12 +466,12 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
         }
 #endif
 
-        // add some randomness
-        srand(time(NULL));
+        // pick a space by the placement policy of the filesystem
+        string owner = (user_option.length()>0 && getuid()==0) ? user_option : username;
+        string randspace = WsPlacement::choose(config.fs(filesystem), owner, db_uid, db_gid, opt.count("debug"));
         if (user_option.length()>0 && (user_option != username) && (getuid() != 0)) {
-            wsdir = spaces[rand()%spaces.size()]+prefix+"/"+username+"-"+name;
+            wsdir = randspace+prefix+"/"+username+"-"+name;
         } else {  // we are root and can change owner!
-            string randspace = spaces[rand()%spaces.size()];
             wsdir_nopostfix = randspace+prefix;
             if (user_option.length()>0 && (getuid()==0)) {
                 wsdir = randspace+prefix+"/"+user_option+"-"+name;
@@ -326,19 +480,6 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
             }
         }
 
-        // make directory and change owner + permissions
-        try {
-            raise_cap(CAP_DAC_OVERRIDE);
-            mode_t oldmask = umask( 077 );    // as we create intermediate directories, we better take care of umask!!
-            fs::create_directories(wsdir);
-            umask(oldmask);
-            lower_cap(CAP_DAC_OVERRIDE, db_uid);
-        } catch (...) {
-            lower_cap(CAP_DAC_OVERRIDE, db_uid);
-            cerr << "Error: could not create workspace directory!"  << endl;
-            exit(-1);
-        }
-
         uid_t tuid=getuid();
         gid_t tgid=getgid();
 
@@ -356,23 +497,6 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 			}
 		}
 
-        raise_cap(CAP_CHOWN);
-        /*
-        // removed 3.6.2020, what was it good for??
-        if(prefix.length()>0) {  // in case we have a prefix, we change owner of that one
-            chown(wsdir_nopostfix.c_str(), tuid, tgid);
-        }
-        */
-
-        if(chown(wsdir.c_str(), tuid, tgid)) {
-            lower_cap(CAP_CHOWN, db_uid);
-            cerr << "Error: could not change owner of workspace!" << endl;
-            unlink(wsdir.c_str());
-            exit(-1);
-        }
-        lower_cap(CAP_CHOWN, db_uid);
-
-        raise_cap(CAP_DAC_OVERRIDE);
 		mode_t mode = S_IRUSR | S_IWUSR | S_IXUSR;
         // group workspaces can be read and listed by group
 		if (opt.count("group") || groupname!="") {
@@ -381,22 +505,52 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 		if (groupname!="") {
 			mode |= S_IWGRP | S_ISGID;
 		}
-        if(chmod(wsdir.c_str(), mode)) {
-            lower_cap(CAP_DAC_OVERRIDE, db_uid);
-            cerr << "Error: could not change permissions of workspace!" << endl;
-            unlink(wsdir.c_str());
-            exit(-1);
+
+        /*
+        // removed 3.6.2020, what was it good for??
+        if(prefix.length()>0) {  // in case we have a prefix, we change owner of that one
+            chown(wsdir_nopostfix.c_str(), tuid, tgid);
+        }
+        */
+
+        // make directory and change owner + permissions, relative to the space directory
+        // and with privileges raised once for all steps
+        {
+            WsPrivileges priv({CAP_DAC_OVERRIDE, CAP_CHOWN});
+            string parent = fs::path(wsdir).parent_path().string();
+            string leaf = fs::path(wsdir).filename().string();
+            if (prefix.length()>0) {
+                mode_t oldmask = umask( 077 );    // as we create intermediate directories, we better take care of umask!!
+                boost::system::error_code ec;
+                fs::create_directories(parent, ec);
+                umask(oldmask);
+            }
+            int dirfd = WsDirs::get(parent);
+            if (dirfd < 0) {
+                throw WsError(-1, "could not create workspace directory!");
+            }
+            // an existing directory without DB entry is taken over, as before
+            bool created = mkdirat(dirfd, leaf.c_str(), S_IRWXU) == 0;
+            struct stat st;
+            if (!created && (errno != EEXIST || fstatat(dirfd, leaf.c_str(), &st, AT_SYMLINK_NOFOLLOW) || !S_ISDIR(st.st_mode))) {
+                throw WsError(-1, "could not create workspace directory!");
+            }
+            if (fchownat(dirfd, leaf.c_str(), tuid, tgid, AT_SYMLINK_NOFOLLOW)) {
+                if (created) unlinkat(dirfd, leaf.c_str(), AT_REMOVEDIR);
+                throw WsError(-1, "could not change owner of workspace!");
+            }
+            if (fchmodat(dirfd, leaf.c_str(), mode, 0)) {
+                if (created) unlinkat(dirfd, leaf.c_str(), AT_REMOVEDIR);
+                throw WsError(-1, "could not change permissions of workspace!");
+            }
         }
-        lower_cap(CAP_DAC_OVERRIDE, db_uid);
 
         extension = maxextensions;
         expiration = time(NULL)+duration*24*3600;
         string primarygroup;
         if (opt.count("group")) {
-            struct group *grp;
-            grp=getgrgid(getegid());
-            // grp should be ok here, was validated before
-            primarygroup = string(grp->gr_name);
+            // should be ok here, was validated before
+            WsGroups::getgroupname(getegid(), primarygroup);
         }
 
 		if (groupname!="") {
@@ -407,10 +561,14 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 
         syslog(LOG_INFO, "created for user <%s> DB <%s> with space <%s>.", username.c_str(), dbfilename.c_str(), wsdir.c_str());
     } // ! exists
-    cout << wsdir << endl;
-    cerr << "remaining extensions  : " << extension << endl;
-    cerr << "remaining time in days: " << (expiration-time(NULL))/(24*3600) << endl;
 
+    WsAllocation result;
+    result.wsdir = wsdir;
+    result.expiration = expiration;
+    result.extensions = extension;
+    result.created = !ws_exists;
+    result.dbfilename = dbfilename;
+    return result;
 }
 
 /*
@@ -420,8 +578,8 @@ void Workspace::allocate(const string name, const bool extensionflag, const int
 void Workspace::release(string name) {
     string wsdir;
 
-    int dbuid = config["dbuid"].as<int>();
-    int dbgid = config["dbgid"].as<int>();
+    int dbuid = config.dbuid;
+    int dbgid = config.dbgid;
 
     string userprefix;
 
@@ -432,80 +590,84 @@ void Workspace::release(string name) {
         userprefix=username+"-";
     }
 
-    string dbfilename=config["workspaces"][filesystem]["database"].as<string>()+"/"+userprefix+name;
+    string dbfilename=config.fs(filesystem).database+"/"+userprefix+name;
 
     // does db entry exist?
     // cout << "file: " << dbfilename << endl;
-    if(fs::exists(dbfilename)) {
-        WsDB dbentry(dbfilename,  config["dbuid"].as<int>(),  config["dbgid"].as<int>());
+    if(WsShards::exists(dbfilename)) {
+        WsDB dbentry(dbfilename,  config.dbuid,  config.dbgid);
         wsdir = dbentry.getwsdir();
 
         string timestamp = lexical_cast<string>(time(NULL));
 
-	// set expiration to now so it gets deleted earlier after beeing released
-	dbentry.setexpiration(time(NULL));
-	// set released flag so released workspaces can be distinguished from expired ones
-    	dbentry.setreleased(time(NULL));
-	dbentry.write_dbfile();
-
-        string dbtargetname = fs::path(dbfilename).parent_path().string() + "/" +
-                              config["workspaces"][filesystem]["deleted"].as<string>() +
-                              "/" + userprefix + name + "-" + timestamp;
-        // cout << dbfilename.c_str() << "-" << dbtargetname.c_str() << endl;
-        raise_cap(CAP_DAC_OVERRIDE);
-#ifdef SETUID
-        // for filesystem with root_squash, we need to be DB user here
-        if(setegid(dbgid) || seteuid(dbuid)) {
-			cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
-			exit(-1);
-		}
-#endif
-        if(rename(dbfilename.c_str(), dbtargetname.c_str())) {
-            // cerr << "rename " << dbfilename.c_str() << " -> " << dbtargetname.c_str() << " failed" << endl;
-            lower_cap(CAP_DAC_OVERRIDE, config["dbuid"].as<int>());
-            cerr << "Error: database entry could not be deleted." << endl;
-            exit(-1);
-        }
-        lower_cap(CAP_DAC_OVERRIDE, config["dbuid"].as<int>());
-
         // rational: we move the workspace into deleted directory and append a timestamp to name
         // as a new workspace could have same name and releasing the new one would lead to a name
         // collision, so the timestamp is kind of generation label attached to a workspace
 
+        string wsprefix = fs::path(wsdir).parent_path().string() + "/" +
+                              config.fs(filesystem).deleted +
+                              "/" + userprefix + name + "-";
+
+        // an interrupted release of this workspace continues with its timestamp
+        string pending;
+        {
+            WsPrivileges priv({CAP_DAC_OVERRIDE});
+            pending = movetarget(wsdir);
+        }
+        if (boost::starts_with(pending, wsprefix)) {
+            timestamp = pending.substr(wsprefix.size());
+        }
+
+        string wstargetname = wsprefix + timestamp;
 
-        string wstargetname = fs::path(wsdir).parent_path().string() + "/" +
-                              config["workspaces"][filesystem]["deleted"].as<string>() +
-                              "/" + userprefix + name + "-" + timestamp;
-       
         // FIXME when a prefix is used, this is the wrong place!!!
         // may be check in case of prefix callout .. and ../.. for config["workspaces"][filesystem]["deleted"] ??
 
+	// set expiration to now so it gets deleted earlier after beeing released
+	dbentry.setexpiration(time(NULL));
+	// set released flag so released workspaces can be distinguished from expired ones
+    	dbentry.setreleased(time(NULL));
+	dbentry.write_dbfile();
+
 /*
 		cout << "RELEASE:" <<
 			"\n  filesystem:" << filesystem <<
 			"\n  wstargetname:" << wstargetname << endl;
 */
 
+        // the workspace is moved first, if a copy is interrupted, the DB entry is still
+        // in place and releasing again continues the move
         // cout << wsdir.c_str() << " - " << wstargetname.c_str() << endl;
-        raise_cap(CAP_DAC_OVERRIDE);
-        if(rename(wsdir.c_str(), wstargetname.c_str())) {
+        WsPrivileges priv({CAP_DAC_OVERRIDE});
+        if(!pending.empty() || WsDirs::renamenoreplace(wsdir, wstargetname)) {
             // cerr << "rename " << wsdir.c_str() << " -> " << wstargetname.c_str() << " failed " << geteuid() << " " << getuid() << endl;
 
             // fallback to mv for filesystems where rename() of directories returns EXDEV
             int r = mv(wsdir.c_str(), wstargetname.c_str());
             if(r!=0) {
-                lower_cap(CAP_DAC_OVERRIDE, config["dbuid"].as<int>());
-                cerr << "Error: could not remove workspace!" << endl;
-                exit(-1);
+                throw WsError(-1, "could not remove workspace!");
             }
         }
-        lower_cap(CAP_DAC_OVERRIDE, config["dbuid"].as<int>());
+
+        string dbtargetname = fs::path(dbfilename).parent_path().string() + "/" +
+                              config.fs(filesystem).deleted +
+                              "/" + userprefix + name + "-" + timestamp;
+        // cout << dbfilename.c_str() << "-" << dbtargetname.c_str() << endl;
+        // still privileged from the move, for filesystem with root_squash, we need to be DB user here
+        priv.asdb(dbuid, dbgid);
+        if(WsDirs::renamenoreplace(WsShards::locate(dbfilename), WsShards::canonical(dbtargetname))) {
+            // cerr << "rename " << dbfilename.c_str() << " -> " << dbtargetname.c_str() << " failed" << endl;
+            throw WsError(-1, "database entry could not be deleted.");
+        }
+        WsIndex::remove(dbfilename);
+        WsIndex::update(dbtargetname, dbentry);
+        WsUsers::add(dbtargetname, dbuid, dbgid);
+        priv.lower();
 
         syslog(LOG_INFO, "release for user <%s> from <%s> to <%s> done, moved DB entry from <%s> to <%s>.", username.c_str(), wsdir.c_str(), wstargetname.c_str(), dbfilename.c_str(), dbtargetname.c_str());
 
     } else {
-        cerr << "Error: workspace does not exist!" << endl;
-        exit(-1);
+        throw WsError(-1, "workspace does not exist!");
     }
 
 }
@@ -515,39 +677,21 @@ void Workspace::release(string name) {
  *  validate the commandline versus the configuration file, to see if the user
  *  is allowed to do what he asks for.
  */
-void Workspace::validate(const whichclient wc, YAML::Node &config, YAML::Node &userconfig,
+void Workspace::validate(const whichclient wc, YAML::Node &userconfig,
                          po::variables_map &opt, string &filesystem, int &duration, int &maxextensions, string &primarygroup)
 {
 
     // get user name, group names etc
-    vector<string> groupnames;
-
-    struct group *grp;
-    int ngroups = 128;
-    gid_t gids[128];
-    int nrgroups;
-
-    nrgroups = getgrouplist(username.c_str(), getgid(), gids, &ngroups);
-    if(nrgroups == -1) {
-        cerr << "Error: user in too many groups!" << endl;
-        exit(-1);
-    }
-    for(int i=0; i<nrgroups; i++) {
-        grp=getgrgid(gids[i]);
-        if(grp) {
-			groupnames.push_back(string(grp->gr_name));
-			if (opt.count("debug")) {
-				cerr << "debug: secondary group " << string(grp->gr_name) << endl; 
-			}
-		}
+    const vector<string> &groupnames = WsGroups::getgroupnames(username, getgid());
+    if (opt.count("debug")) {
+        for(const string &grp: groupnames) {
+            cerr << "debug: secondary group " << grp << endl;
+        }
     }
     // get current group
-    grp=getgrgid(getgid());
-    if (grp==NULL) {
-        cerr << "Error: user has no group anymore!" << endl;
-        exit(-1);
+    if (!WsGroups::getgroupname(getgid(), primarygroup)) {
+        throw WsError(-1, "user has no group anymore!");
     }
-    primarygroup=string(grp->gr_name);
 
     if (opt.count("debug")) {
         cerr << "debug: primarygroup=" << primarygroup << endl;
@@ -555,8 +699,7 @@ void Workspace::validate(const whichclient wc, YAML::Node &config, YAML::Node &u
 
     if(wc==WS_Allocate && opt["groupname"].as<string>()!="") {
         if ( find(groupnames.begin(), groupnames.end(), opt["groupname"].as<string>()) == groupnames.end() ) {
-            cerr << "Error: invalid group specified!" << endl;
-            exit(-1);
+            throw WsError(-1, "invalid group specified!");
         }
     }
 
@@ -567,62 +710,34 @@ void Workspace::validate(const whichclient wc, YAML::Node &config, YAML::Node &u
             cerr << "debug: filesystem given: " << opt["filesystem"].as<string>() << endl;
         }
         
-        // check ACLs
-        vector<string>user_acl;
-        vector<string>group_acl;
-
         // check if filesystem is valid
-        if (!config["workspaces"][opt["filesystem"].as<string>()]) {
-			cerr << "Error: please specify an existing filesystem with -F!" << endl;
-            exit(1);
-        }
-
-        // read ACL lists
-        if ( config["workspaces"][opt["filesystem"].as<string>()]["user_acl"]) {
-            for(string v: config["workspaces"][opt["filesystem"].as<string>()]["user_acl"].as<vector<string> >())
-                user_acl.push_back(v);
-        }
-
-        if ( config["workspaces"][opt["filesystem"].as<string>()]["group_acl"]) {
-            for(string v: config["workspaces"][opt["filesystem"].as<string>()]["group_acl"].as<vector<string> >())
-                group_acl.push_back(v);
+        if (!config.getfs(opt["filesystem"].as<string>())) {
+			throw WsError(1, "please specify an existing filesystem with -F!");
         }
 
         // check ACLs
-        bool userok=true;
-        if(user_acl.size()>0 || group_acl.size()>0) {
-            userok=false;
-            if (opt.count("debug")) {
-                cerr << "debug: acls non-empty, all user access denied before check." << endl;
-            }
-        }
-
-        if( find(group_acl.begin(), group_acl.end(), primarygroup) != group_acl.end() ) {
-            userok=true;
-            if (opt.count("debug")) {
-                cerr << "debug: group found in group acl, access granted." << endl;
-            }
-        }
-#ifdef CHECK_ALL_GROUPS
-        for(string grp: groupnames) {
-            if( find(group_acl.begin(), group_acl.end(), grp) != group_acl.end() ) {
-                userok=true;
-                if (opt.count("debug")) {
+        AclMatch match = WsAcl::get().check(opt["filesystem"].as<string>(), username, primarygroup, groupnames);
+        bool userok = match!=ACL_DENIED;
+        if (opt.count("debug")) {
+            switch(match) {
+                case ACL_DENIED:
+                    cerr << "debug: acls non-empty, all user access denied." << endl;
+                    break;
+                case ACL_PRIMARYGROUP:
+                    cerr << "debug: group found in group acl, access granted." << endl;
+                    break;
+                case ACL_SECONDARYGROUP:
                     cerr << "debug: secondary group found in group acl, access granted." << endl;
-                }
-                break;
-            }
-        }
-#endif
-        if( find(user_acl.begin(), user_acl.end(), username) != user_acl.end() ) {
-            userok=true;
-            if (opt.count("debug")) {
-                cerr << "debug: user found in user acl, access granted." << endl;
+                    break;
+                case ACL_USER:
+                    cerr << "debug: user found in user acl, access granted." << endl;
+                    break;
+                default:
+                    break;
             }
         }
         if(!userok && getuid()!=0) {
-            cerr << "Error: You are not allowed to use the specified workspace!" << endl;
-            exit(4);
+            throw WsError(4, "You are not allowed to use the specified workspace!");
 			// FIXME this case is hit for -F -x -u and should not
 			// global default to workspace without ACL entry ends in that case, caller has to allowed, not owner
         }
@@ -633,32 +748,25 @@ void Workspace::validate(const whichclient wc, YAML::Node &config, YAML::Node &u
         }
         map<string, string>groups_defaults;
         map<string, string>user_defaults;
-        YAML::Node node = config["workspaces"];
-        for(YAML::const_iterator it = node.begin(); it!=node.end(); ++it ) {
-            // cout << "v=" <<  it->first << endl;
-            std::string v = it->first.as<std::string>();
+        for(const FilesystemConfig &cfs: config.filesystems) {
+            std::string v = cfs.name;
             if (opt.count("debug")) {
                 cerr << "debug: searching " << v << endl;
             }
             // check permissions during search, has to be repeated later in case
             // no search performed
             if(wc==WS_Allocate && !opt.count("extension")) {
-                if( config["workspaces"] [it->first] ["allocatable"] &&
-                    config["workspaces"][it->first]["allocatable"].as<bool>() == false ) {
+                if( !cfs.allocatable ) {
                     if (opt.count("debug")) {
                         cerr << "debug: not allocatable, skipping " << endl;
                     }
                     continue;
                 }
             }
-            if(config["workspaces"][it->first]["groupdefault"]) {
-                for(string u: config["workspaces"][it->first]["groupdefault"].as<vector<string> >())
-                    groups_defaults[u]=v;
-            }
-            if(config["workspaces"][it->first]["userdefault"]) {
-                for(string u: config["workspaces"][it->first]["userdefault"].as<vector<string> >())
-                    user_defaults[u]=v;
-            }
+            for(string u: cfs.groupdefault)
+                groups_defaults[u]=v;
+            for(string u: cfs.userdefault)
+                user_defaults[u]=v;
         }
 
         if( user_defaults.count(username) > 0 ) {
@@ -685,21 +793,19 @@ void Workspace::validate(const whichclient wc, YAML::Node &config, YAML::Node &u
         }
 #endif
         // fallback, if no per user or group default, we use the config default
-		try {
-        	filesystem=config["default"].as<string>();
+		if (config.defaultfs != "") {
+        	filesystem=config.defaultfs;
             if (opt.count("debug")) {
                 cerr << "debug: fallback, using global default, ending search" << endl;
             }
           goto found;
-		} catch (...) {
-			cerr << "Error: please specify a valid filesystem with -F!" << endl;
-            exit(1);
+		} else {
+			throw WsError(1, "please specify a valid filesystem with -F!");
 		}
     // fallback, we end here if user does not specify a filesystem and does
     // not have any default
-    cerr << "Error: please specify a valid filesystem with -F." << endl;
-    cerr << "The administrator did not configure a default filesystem for you." << endl;
-    exit(1);
+    throw WsError(1, "please specify a valid filesystem with -F.\n"
+                     "The administrator did not configure a default filesystem for you.");
 found:
         ;
     }
@@ -710,10 +816,10 @@ found:
         if(userconfig["workspaces"][filesystem]["userexceptions"][username]["duration"]) {
             configduration = userconfig["workspaces"][filesystem]["userexceptions"][username]["duration"].as<int>();
         } else {
-            if(config["workspaces"][filesystem]["duration"]) {
-                configduration = config["workspaces"][filesystem]["duration"].as<int>();
+            if(config.fs(filesystem).duration >= 0) {
+                configduration = config.fs(filesystem).duration;
             } else {
-                configduration = config["duration"].as<int>();
+                configduration = config.duration;
             }
         }
 
@@ -728,10 +834,10 @@ found:
         if(userconfig["workspaces"][filesystem]["userexceptions"][username]["maxextensions"]) {
             maxextensions = userconfig["workspaces"][filesystem]["userexceptions"][username]["maxextensions"].as<int>();
         } else {
-            if(config["workspaces"][filesystem]["maxextensions"]) {
-                maxextensions = config["workspaces"][filesystem]["maxextensions"].as<int>();
+            if(config.fs(filesystem).maxextensions >= 0) {
+                maxextensions = config.fs(filesystem).maxextensions;
             } else {
-                maxextensions = config["maxextensions"].as<int>();
+                maxextensions = config.maxextensions;
             }
         }
     }
@@ -739,20 +845,19 @@ found:
 
 /*
  * fallback for rename in case of EXDEV
- * we do not use system() as we are in setuid
- * and it would fail, and it sucks anyhow,
+ * moves in process with the parallel copy of wsmove, an interrupted
+ * move of the same source continues from its journal
  */
 int Workspace::mv(const char * source, const char *target) {
-    pid_t pid;
-    int status;
-    pid = fork();
-    if (pid==0) {
-        execl("/bin/mv", "mv", source, target, NULL);
-    } else if (pid<0) {
-        //
-    } else {
-        waitpid(pid, &status, 0);
-        return WEXITSTATUS(status);
+    MoveStats stats;
+    string error;
+    if (!movetree(source, target, config.fs(filesystem).movethreads, stats, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    if (!stats.renamed) {
+        syslog(LOG_INFO, "moved <%s> to <%s> by copy, %lu files, %lu bytes in %.1f seconds.", source, target,
+               (unsigned long)stats.files, (unsigned long)stats.bytes, stats.seconds);
     }
     return 0;
 }
@@ -764,10 +869,11 @@ int Workspace::mv(const char * source, const char *target) {
  */
 string Workspace::getusername()
 {
-    struct passwd *pw;
-
-    pw = getpwuid(getuid());
-    return string(pw->pw_name);
+    string name, home;
+    if (!WsGroups::getuser(getuid(), name, home)) {
+        throw WsError(1, "no passwd entry for uid " + to_string(getuid()) + "!");
+    }
+    return name;
 }
 
 /*
@@ -775,10 +881,11 @@ string Workspace::getusername()
  */
 string Workspace::getuserhome()
 {
-    struct passwd *pw;
-
-    pw = getpwuid(getuid());
-    return string(pw->pw_dir);
+    string name, home;
+    if (!WsGroups::getuser(getuid(), name, home)) {
+        throw WsError(1, "no passwd entry for uid " + to_string(getuid()) + "!");
+    }
+    return home;
 }
 
 
@@ -795,73 +902,61 @@ string Workspace::getfilesystem()
  * restore a workspace, argument is name of workspace DB entry including username and timestamp, form user-name-timestamp
  */
 void Workspace::restore(const string name, const string target, const string username) {
-    string dbfilename = fs::path(config["workspaces"][filesystem]["database"].as<string>()).string()
-                         + "/" + config["workspaces"][filesystem]["deleted"].as<string>()+"/"+name;
+    string dbfilename = config.fs(filesystem).database
+                         + "/" + config.fs(filesystem).deleted+"/"+name;
 
-    string targetdbfilename = fs::path(config["workspaces"][filesystem]["database"].as<string>()).string()
+    string targetdbfilename = config.fs(filesystem).database
                             + "/" + username + "-" + target;
 
     string targetwsdir;
 
     // FIXME should root be able to override this?
-    if (config["workspaces"][filesystem]["restorable"]) {
-        if (config["workspaces"][filesystem]["restorable"].as<bool>() == false) {
-            cerr << "Error: it is not possible to restore workspaces in this filesystem." << endl;
-            exit(1);
-        }
+    if (!config.fs(filesystem).restorable) {
+        throw WsError(1, "it is not possible to restore workspaces in this filesystem.");
     }
 
 
     // check for target existance and get directory name of workspace, which will be target of mv operations
-    if(fs::exists(targetdbfilename)) {
-        WsDB targetdbentry(targetdbfilename, config["dbuid"].as<int>(),  config["dbgid"].as<int>());
+    if(WsShards::exists(targetdbfilename)) {
+        WsDB targetdbentry(targetdbfilename, config.dbuid,  config.dbgid);
         targetwsdir = targetdbentry.getwsdir();
     } else {
-        cerr << "Error: target workspace does not exist!" << endl;
       	if (opt.count("debug")) {
 			cerr << "debug: target=" << targetdbfilename << endl;
 		}
-        exit(1);
+        throw WsError(1, "target workspace does not exist!");
     }
 
-    if(fs::exists(dbfilename)) {
-        WsDB dbentry(dbfilename,  config["dbuid"].as<int>(),  config["dbgid"].as<int>());
+    if(WsShards::exists(dbfilename)) {
+        WsDB dbentry(dbfilename,  config.dbuid,  config.dbgid);
         // this is path of original workspace, from this we derive the deleted name
         string wsdir = dbentry.getwsdir();
 
         // go one up, add deleted subdirectory and add workspace name
         string wssourcename = fs::path(wsdir).parent_path().string() + "/" +
-                              config["workspaces"][filesystem]["deleted"].as<string>() +
+                              config.fs(filesystem).deleted +
                               "/" + name;
 
         // log restore request
         // syslog(LOG_INFO, "restore for user <%s> from <%s> to <%s>.", username, wssourcename.c_str(), targetwsdir.c_str());
 
-        raise_cap(CAP_DAC_OVERRIDE);
+        WsPrivileges priv({CAP_DAC_OVERRIDE});
 
         int ret = mv(wssourcename.c_str(), targetwsdir.c_str());
-#ifdef SETUID
         // get db user to be able to unlink db entry from root_squash filesystems
-        if(setegid(config["dbgid"].as<int>()) || seteuid(config["dbuid"].as<int>())) {
-			cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
-			exit(-1);
-		}
-#endif
+        priv.asdb(config.dbuid, config.dbgid);
         if (ret == 0) {
-            unlink(dbfilename.c_str());
+            string dbname;
+            int dbdir = WsDirs::parent(WsShards::locate(dbfilename), dbname);
+            unlinkat(dbdir, dbname.c_str(), 0);
+            WsIndex::remove(dbfilename);
             syslog(LOG_INFO, "restore for user <%s> from <%s> to <%s> done, removed DB entry <%s>.", username.c_str(), wssourcename.c_str(), targetwsdir.c_str(), dbfilename.c_str());
             cerr << "Info: restore successful, database entry removed." << endl;
         } else {
             syslog(LOG_INFO, "restore for user <%s> from <%s> to <%s> failed, kept DB entry <%s>.", username.c_str(), wssourcename.c_str(), targetwsdir.c_str(), dbfilename.c_str());
             cerr << "Error: moving data failed, database entry kept!" << endl;
         }
-#ifdef SETUID
-        if(seteuid(0)||setegid(0)) {
-			cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
-			exit(-1);
-		}
-#endif
-        lower_cap(CAP_DAC_OVERRIDE, config["dbuid"].as<int>());
+        priv.lower();
 
 
     } else {
@@ -870,12 +965,32 @@ void Workspace::restore(const string name, const string target, const string use
 }
 
 
+#ifndef SETUID
+/*
+ * capabilities of this process, for error messages
+ */
+static string runningcaps()
+{
+    cap_t cap = cap_get_proc();
+    char *text = cap_to_text(cap, NULL);
+    string running = text ? text : "";
+    cap_free(text);
+    cap_free(cap);
+    return running;
+}
+#endif
+
+bool Workspace::embedded = false;
+
 /*
  * drop effective capabilities, except CAP_DAC_OVERRIDE | CAP_CHOWN
  */
 void Workspace::drop_cap(cap_value_t cap_arg, int dbuid)
 {
 #ifndef SETUID
+    // the permitted set of a process using libworkspace is left alone
+    if (embedded) return;
+
     cap_t caps;
     cap_value_t cap_list[1];
 
@@ -887,24 +1002,19 @@ void Workspace::drop_cap(cap_value_t cap_arg, int dbuid)
     // cap_list[1] = CAP_CHOWN;
 
     if (cap_set_flag(caps, CAP_PERMITTED, 1, cap_list, CAP_SET) == -1) {
-        cerr << "Error: problem with capabilities." << endl;
-        exit(1);
+        throw WsError(1, "problem with capabilities.");
     }
 
     if (cap_set_proc(caps) == -1) {
-        cerr << "Error: problem dropping capabilities." << endl;
-        cap_t cap = cap_get_proc();
-        cerr << "Running with capabilities: " << cap_to_text(cap, NULL) << endl;
-        cap_free(cap);
-        exit(1);
+        cap_free(caps);
+        throw WsError(1, "problem dropping capabilities.\nRunning with capabilities: " + runningcaps());
     }
 
     cap_free(caps);
 #else
     // seteuid(0);
     if(seteuid(dbuid)) {
-        cerr << "Error: can not change uid." << endl;
-        exit(1);
+        throw WsError(1, "can not change uid.");
     }
 #endif
 }
@@ -912,6 +1022,8 @@ void Workspace::drop_cap(cap_value_t cap_arg, int dbuid)
 void Workspace::drop_cap(cap_value_t cap_arg1, cap_value_t cap_arg2, int dbuid)
 {
 #ifndef SETUID
+    if (embedded) return;
+
     cap_t caps;
     cap_value_t cap_list[2];
 
@@ -924,24 +1036,19 @@ void Workspace::drop_cap(cap_value_t cap_arg1, cap_value_t cap_arg2, int dbuid)
     // cap_list[1] = CAP_CHOWN;
 
     if (cap_set_flag(caps, CAP_PERMITTED, 2, cap_list, CAP_SET) == -1) {
-        cerr << "Error: problem with capabilities." << endl;
-        exit(1);
+        throw WsError(1, "problem with capabilities.");
     }
 
     if (cap_set_proc(caps) == -1) {
-        cerr << "Error: problem dropping capabilities." << endl;
-        cap_t cap = cap_get_proc();
-        cerr << "Running with capabilities: " << cap_to_text(cap, NULL) << endl;
-        cap_free(cap);
-        exit(1);
+        cap_free(caps);
+        throw WsError(1, "problem dropping capabilities.\nRunning with capabilities: " + runningcaps());
     }
 
     cap_free(caps);
 #else
     // seteuid(0);
     if(seteuid(dbuid)) {
-        cerr << "Error: can not change uid." << endl;
-        exit(1);
+        throw WsError(1, "can not change uid.");
     }
 #endif
 
@@ -960,16 +1067,12 @@ void Workspace::lower_cap(int cap, int dbuid)
 
     cap_list[0] = cap;
     if (cap_set_flag(caps, CAP_EFFECTIVE, 1, cap_list, CAP_CLEAR) == -1) {
-        cerr << "Error: problem with capabilities." << endl;
-        exit(1);
+        throw WsError(1, "problem with capabilities.");
     }
 
     if (cap_set_proc(caps) == -1) {
-        cerr << "Error: problem lowering capabilities." << endl;
-        cap_t cap = cap_get_proc();
-        cerr << "Running with capabilities: " << cap_to_text(cap, NULL) << endl;
-        cap_free(cap);
-        exit(1);
+        cap_free(caps);
+        throw WsError(1, "problem lowering capabilities.\nRunning with capabilities: " + runningcaps());
     }
 
     cap_free(caps);
@@ -977,8 +1080,7 @@ void Workspace::lower_cap(int cap, int dbuid)
     // seteuid(0);
 
     if(seteuid(dbuid)) {
-        cerr << "Error: can not change uid." << endl;
-        exit(1);
+        throw WsError(1, "can not change uid.");
     }
 #endif
 }
@@ -996,23 +1098,91 @@ void Workspace::raise_cap(int cap)
 
     cap_list[0] = cap;
     if (cap_set_flag(caps, CAP_EFFECTIVE, 1, cap_list, CAP_SET) == -1) {
-        cerr << "Error: problem with capabilities." << endl;
-        exit(1);
+        throw WsError(1, "problem with capabilities.");
     }
 
     if (cap_set_proc(caps) == -1) {
-        cerr << "Error: problem raising capabilities." << endl;
-        cap_t cap = cap_get_proc();
-        cerr << "Running with capabilities: " << cap_to_text(cap, NULL) << endl;
-        cap_free(cap);
-        exit(1);
+        cap_free(caps);
+        throw WsError(1, "problem raising capabilities.\nRunning with capabilities: " + runningcaps());
     }
 
     cap_free(caps);
 #else
     if (seteuid(0)) {
-        cerr << "Error: can not change uid." << endl;
-        exit(1);
+        throw WsError(1, "can not change uid.");
+    }
+#endif
+}
+
+/*
+ * raise all capabilities of the scope with one cap_set_proc (one seteuid in SETUID builds)
+ */
+WsPrivileges::WsPrivileges(std::initializer_list<cap_value_t> caps) : euid(geteuid()), egid(getegid()), raised(false)
+{
+#ifndef SETUID
+    saved = cap_get_proc();
+    cap_t raise = cap_dup(saved);
+    vector<cap_value_t> cap_list(caps);
+
+    if (cap_set_flag(raise, CAP_EFFECTIVE, cap_list.size(), cap_list.data(), CAP_SET) == -1) {
+        cap_free(raise);
+        cap_free(saved);
+        throw WsError(1, "problem with capabilities.");
+    }
+    if (cap_set_proc(raise) == -1) {
+        cap_free(raise);
+        cap_free(saved);
+        throw WsError(1, "problem raising capabilities.\nRunning with capabilities: " + runningcaps());
+    }
+    cap_free(raise);
+#else
+    if (seteuid(0)) {
+        throw WsError(1, "can not change uid.");
+    }
+#endif
+    raised = true;
+}
+
+WsPrivileges::~WsPrivileges()
+{
+    if (raised) {
+        try {
+            lower();
+        } catch (const WsError &e) {
+            // never continue with privileges left raised
+            cerr << "Error: " << e.what() << endl;
+            abort();
+        }
+    }
+#ifndef SETUID
+    cap_free(saved);
+#endif
+}
+
+void WsPrivileges::asdb(const int dbuid, const int dbgid)
+{
+#ifdef SETUID
+    if (setegid(dbgid) || seteuid(dbuid)) {
+        throw WsError(-1, "can not seteuid or setgid. Bad installation?");
+    }
+#endif
+}
+
+void WsPrivileges::lower()
+{
+    if (!raised) return;
+    raised = false;
+#ifndef SETUID
+    if (cap_set_proc(saved) == -1) {
+        throw WsError(1, "problem lowering capabilities.\nRunning with capabilities: " + runningcaps());
+    }
+#else
+    // egid can only be changed back as root
+    if (getegid() != egid && (seteuid(0) || setegid(egid))) {
+        throw WsError(-1, "can not seteuid or setgid. Bad installation?");
+    }
+    if (geteuid() != euid && seteuid(euid)) {
+        throw WsError(1, "can not change uid.");
     }
 #endif
 }
@@ -1021,84 +1191,40 @@ std::vector<string> Workspace::get_valid_fslist() {
   vector<string> fslist;
 
   // get user name, group names etc
-  vector<string> groupnames;
-
-  struct group *grp;
-  int ngroups = 128;
-  gid_t gids[128];
-  int nrgroups;
+  const vector<string> &groupnames = WsGroups::getgroupnames(username, getgid());
   string primarygroup;
 
-  nrgroups = getgrouplist(username.c_str(), geteuid(), gids, &ngroups);
-  if(nrgroups<=0) {
-      cerr << "Error: user in too many groups!" << endl;
-  }
-  for(int i=0; i<nrgroups; i++) {
-      grp=getgrgid(gids[i]);
-      if(grp) groupnames.push_back(string(grp->gr_name));
-  }
   // get current group
-  grp=getgrgid(getegid());
-  if(grp==NULL) {
-       cerr << "Error: user has no group anymore!" << endl;
-       exit(-1);
+  if (!WsGroups::getgroupname(getegid(), primarygroup)) {
+       throw WsError(-1, "user has no group anymore!");
   }
-  primarygroup=string(grp->gr_name);
 
-  // iterate over all filesystems and search the ones allowed for current user
-  YAML::Node node = config["workspaces"];
-  for(YAML::const_iterator it = node.begin(); it!=node.end(); ++it ) {
-      std::string cfilesystem = it->first.as<std::string>();
-      // check ACLs
-      vector<string>user_acl;
-      vector<string>group_acl;
+  // check all filesystems at once and keep the ones allowed for current user
+  vector<AclMatch> acl = WsAcl::get().checkall(username, primarygroup, groupnames);
+  for(size_t i=0; i<config.filesystems.size(); i++) {
+      std::string cfilesystem = config.filesystems[i].name;
 
       if (opt.count("debug")) {
           cerr << "debug: find_valid_fs:" << cfilesystem << endl;
-      }
-
-      // read ACL lists
-      if ( config["workspaces"][cfilesystem]["user_acl"]) {
-          for(string v: config["workspaces"][cfilesystem]["user_acl"].as<vector<string> >())
-              user_acl.push_back(v);
-      }
-      if ( config["workspaces"][cfilesystem]["group_acl"]) {
-          for(string v: config["workspaces"][cfilesystem]["group_acl"].as<vector<string> >())
-              group_acl.push_back(v);
-      }
-
-      // check ACLs
-      bool userok=true;
-      if(user_acl.size()>0 || group_acl.size()>0) {
-          if (opt.count("debug")) {
-              cerr << "debug: find_valid_fs, has ACL, access denied." << endl;
+          switch(acl[i]) {
+              case ACL_DENIED:
+                  cerr << "debug: find_valid_fs, has ACL, access denied." << endl;
+                  break;
+              case ACL_PRIMARYGROUP:
+                  cerr << "debug: find_valid_fs, in group ACL, access granted." << endl;
+                  break;
+              case ACL_SECONDARYGROUP:
+                  cerr << "debug: find_valid_fs, in group ACL, access granted (secondary)." << endl;
+                  break;
+              case ACL_USER:
+                  cerr << "debug: find_valid_fs, in user ACL, access granted." << endl;
+                  break;
+              default:
+                  break;
           }
-          userok=false;
       }
 
-      if( find(group_acl.begin(), group_acl.end(), primarygroup) != group_acl.end() ) {
-          userok=true;
-          if (opt.count("debug")) {
-              cerr << "debug: find_valid_fs, in group ACL, access granted." << endl;
-          }
-      }
-#ifdef CHECK_ALL_GROUPS
-      for(string grp: groupnames) {
-          if( find(group_acl.begin(), group_acl.end(), grp) != group_acl.end() ) {
-			  if (opt.count("debug")) {
-				  cerr << "debug: find_valid_fs, in group ACL, access granted (secondary)." << endl;
-			  }
-              userok=true;
-              break;
-          }
-      }
-#endif
-      if( find(user_acl.begin(), user_acl.end(), username) != user_acl.end() ) {
-          userok=true;
-          if (opt.count("debug")) {
-              cerr << "debug: find_valid_fs, in user ACL, access granted." << endl;
-          }
-      }
+      bool userok = acl[i]!=ACL_DENIED;
       if(userok || getuid()==0) {
           if (opt.count("debug")) {
               cerr << "debug: find_valid_fs, granted" << endl;
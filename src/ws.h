@@ -9,6 +9,8 @@
  *  This version is not DB and configuration compatible with the older version, the DB and
  *    configuration was changed to YAML files.
  *
+ *  errors are thrown as WsError (wserror.h), the tools print them and exit.
+ *
  *  differences to old workspace version
  *    - usage of YAML file format
  *    - using setuid or capabilities (needs support by filesystem!)
@@ -45,6 +47,7 @@
 #include <boost/smart_ptr.hpp>
 
 #include "wsdb.h"
+#include "wsconfig.h"
 
 #ifndef SETUID
 #include <sys/capability.h>
@@ -57,6 +60,15 @@ namespace po = boost::program_options;
 using namespace std;
 
 
+// result of Workspace::allocate
+struct WsAllocation {
+    string wsdir;
+    long expiration;
+    int extensions;         // remaining extensions
+    bool created;           // false if an existing workspace was reused or extended
+    string dbfilename;      // DB entry of the workspace
+};
+
 enum whichclient {
     WS_Allocate,
     WS_Release
@@ -68,13 +80,14 @@ enum whichclient {
 class Workspace {
 
 private:
-    YAML::Node config, userconfig;
+    const WsConfig &config;
+    YAML::Node userconfig;
     int db_uid, db_gid;
     po::variables_map opt;
     int maxextensions, duration;
     string filesystem, acctcode, username;
 
-    void validate(const whichclient wc, YAML::Node &config, YAML::Node &userconfig,
+    void validate(const whichclient wc, YAML::Node &userconfig,
                   po::variables_map &opt, string &filesystem, int &duration, int &maxextensions, string &primarygroup);
 
 
@@ -92,11 +105,21 @@ public:
     static void raise_cap(int cap);
     static void lower_cap(int cap, int dbuid);
 
+    // load lua callouts of all filesystems ahead of use (ws_brokerd)
+    static void preload_callouts();
+
+    // set by libworkspace, keeps the capabilities of the calling process
+    static bool embedded;
+
     // constructor reads config and userconfig
     Workspace(const whichclient clientcode, const po::variables_map opt, const int _duration, string filesystem);
 
+    // validate the next request of a batch with this object, instead of constructing
+    // one per request, config, private config and groups are read once
+    void setrequest(const whichclient clientcode, const po::variables_map opt, const int _duration, string filesystem);
+
     // allocate a new workspace, create workspace and DB entry
-    void allocate(const string name, const bool extensionsflag, const int reminder, const string mailaddress, string user_option, const string groupname, const string comment);
+    WsAllocation allocate(const string name, const bool extensionsflag, const int reminder, const string mailaddress, string user_option, const string groupname, const string comment);
 
     // release an existing workspace, move workspace and DB entry
     void release(string name);
@@ -117,4 +140,34 @@ public:
 
 };
 
+
+/*
+ * privileges for a group of operations: raises all given capabilities (root in
+ * SETUID builds) at once, and restores the state from before when lower() is
+ * called or the scope is left, also by an exception
+ */
+class WsPrivileges {
+
+private:
+    uid_t euid;
+    gid_t egid;
+    bool raised;
+#ifndef SETUID
+    cap_t saved;
+#endif
+
+    WsPrivileges(const WsPrivileges&);
+    WsPrivileges& operator=(const WsPrivileges&);
+
+public:
+    explicit WsPrivileges(std::initializer_list<cap_value_t> caps);
+    ~WsPrivileges();
+
+    // continue as DB user, for DB filesystems with root_squash (SETUID builds only)
+    void asdb(const int dbuid, const int dbgid);
+
+    // back to the state from before the scope
+    void lower();
+};
+
 #endif
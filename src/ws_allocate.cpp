@@ -36,6 +36,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cctype>
 #ifdef USE_BOOST_REGEXP
 	#include <boost/regex.hpp>
     #define REGEX boost::regex
@@ -44,6 +45,12 @@
     #define REGEX std::regex
 #endif
 #include <syslog.h>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
 
 // YAML
 #include <yaml-cpp/yaml.h>
@@ -60,18 +67,49 @@ const int CAP_CHOWN = 1;
 #endif
 
 #include "ws.h"
+#include "wsbroker.h"
+#include "wserror.h"
 
 namespace po = boost::program_options;
 using namespace std;
 
 
+/*
+ *  check the workspace name for bad characters
+ */
+static bool validname(const string &name) {
+    //  static const std::regex e("^[a-zA-Z0-9][a-zA-Z0-9_.-]*$");  // #77
+
+	// bugfix: as regexp parser are recursiv, split in two parts, complex match for start, simple search for remainder
+	static const REGEX e1("^[[:alnum:]][[:alnum:]_.-]*$");
+    if (!regex_match(name.substr(0,2) , e1)) {
+            return false;
+    }
+	static const REGEX e2("[^[:alnum:]_.-]");
+    return !regex_search(name, e2);
+}
+
+
+/*
+ *  check the mail address for characters that could break the reminder mail
+ */
+static bool validmailaddress(const string &address) {
+    for (const char c: address) {
+        if (iscntrl((unsigned char)c) || isspace((unsigned char)c) || c == '<' || c == '>') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 /* 
  *  parse the commandline and see if all required arguments are passed, and check the workspace name for 
  *  bad characters
  */
-void commandline(po::variables_map &opt, string &name, int &duration, const int durationdefault, string &filesystem, 
+static void commandline(po::variables_map &opt, string &name, int &duration, const int durationdefault, string &filesystem, 
                     bool &extension, int &reminder, string &mailaddress, string &user, string &groupname, string &comment,
-                    int argc, char**argv, std::stringstream &userconf) {
+                    string &batchfile, int argc, char**argv, std::stringstream &userconf) {
     // define all options
 
     po::options_description cmd_options( "\nOptions" );
@@ -88,6 +126,7 @@ void commandline(po::variables_map &opt, string &name, int &duration, const int
             ("group,g", "group workspace")
             ("groupname,G", po::value<string>(&groupname)->default_value(""), "groupname")
             ("comment,c", po::value<string>(&comment), "comment")
+            ("batch,b", po::value<string>(&batchfile), "read lines of workspace_name [duration [filesystem]] from file, - for stdin")
     ;
 
     po::options_description secret_options("Secret");
@@ -142,7 +181,12 @@ void commandline(po::variables_map &opt, string &name, int &duration, const int
         extension = false;
     }
 
-    if (opt.count("name"))
+    if (opt.count("batch")) {
+        if (opt.count("name")) {
+            cerr << "Error: workspace names are taken from the batch input with --batch." << endl;
+            exit(1);
+        }
+    } else if (opt.count("name"))
     {
         //cout << " name: " << name << "\n";
     } else {
@@ -175,7 +219,7 @@ void commandline(po::variables_map &opt, string &name, int &duration, const int
                 cerr << "Info: reminder email will be sent to local user account" << endl;
             }
         }
-		if (reminder>=duration) {
+		if (reminder>=duration && !opt.count("batch")) {
                 cerr << "Warning: reminder is only sent after workspace expiry!" << endl;
 		}
     } else {
@@ -186,17 +230,14 @@ void commandline(po::variables_map &opt, string &name, int &duration, const int
         } 
     }
 
-    // validate workspace name against nasty characters    
-    //  static const std::regex e("^[a-zA-Z0-9][a-zA-Z0-9_.-]*$");  // #77
-
-	// bugfix: as regexp parser are recursiv, split in two parts, complex match for start, simple search for remainder
-	static const REGEX e1("^[[:alnum:]][[:alnum:]_.-]*$");
-    if (!regex_match(name.substr(0,2) , e1)) {
-            cerr << "Error: Illegal workspace name, use characters and numbers, -,. and _ only!" << endl;
+    // the address ends up in the mail headers of the reminder
+    if (!validmailaddress(mailaddress)) {
+            cerr << "Error: Illegal mail address, no spaces, control characters, < or > allowed!" << endl;
             exit(1);
     }
-	static const REGEX e2("[^[:alnum:]_.-]");
-    if (regex_search(name, e2)) {
+
+    // validate workspace name against nasty characters    
+    if (!opt.count("batch") && !validname(name)) {
             cerr << "Error: Illegal workspace name, use characters and numbers, -,. and _ only!" << endl;
             exit(1);
     }
@@ -205,11 +246,204 @@ void commandline(po::variables_map &opt, string &name, int &duration, const int
 
 
 
+/*
+ *  for humans on stderr
+ */
+static void printremaining(const WsAllocation &result) {
+    cerr << "remaining extensions  : " << result.extensions << endl;
+    cerr << "remaining time in days: " << (result.expiration-time(NULL))/(24*3600) << endl;
+}
+
+/*
+ *  path on stdout, the rest for humans on stderr
+ */
+static void printallocation(const WsAllocation &result) {
+    cout << result.wsdir << endl;
+    printremaining(result);
+}
+
+
+/*
+ *  one line of the batch input and its result
+ */
+struct BatchRequest {
+    string name;
+    int duration;
+    string filesystem;
+    string error;           // reason if the request failed
+    string wsdir;
+    string dbfilename;      // DB entry written for the request
+    string messages;        // stderr of the request
+};
+
+
+/*
+ *  read batch input, lines of "workspace_name [duration [filesystem]]", # starts a comment
+ */
+static vector<BatchRequest> readbatch(istream &in, const int duration, const string &filesystem) {
+    vector<BatchRequest> requests;
+    string line;
+    while (getline(in, line)) {
+        size_t comment = line.find('#');
+        if (comment != string::npos) {
+            line.erase(comment);
+        }
+        istringstream fields(line);
+        BatchRequest r;
+        if (!(fields >> r.name)) {
+            continue;
+        }
+        r.duration = duration;
+        r.filesystem = filesystem;
+
+        string field;
+        if (fields >> field) {
+            size_t pos = 0;
+            try {
+                r.duration = stoi(field, &pos);
+            } catch (...) {
+                pos = 0;
+            }
+            if (pos != field.size()) {
+                r.error = "invalid duration <" + field + ">";
+            }
+            if (fields >> field) {
+                r.filesystem = field;
+            }
+            if (fields >> field) {
+                r.error = "too many fields";
+            }
+        }
+        if (r.error.empty() && !validname(r.name)) {
+            r.error = "Illegal workspace name, use characters and numbers, -,. and _ only!";
+        }
+        requests.push_back(r);
+    }
+    return requests;
+}
+
+
+/*
+ *  set an option of a request, replacing the one of the command line
+ */
+static void setoption(po::variables_map &opt, const string key, const boost::any value) {
+    opt.erase(key);
+    opt.insert(make_pair(key, po::variable_value(value, false)));
+}
+
+
+/*
+ *  allocate one batch request with the workspace object of the batch, its messages
+ *  to stderr are kept for the result
+ */
+static void allocaterequest(BatchRequest &r, unique_ptr<Workspace> &ws, const po::variables_map &opt,
+                            const bool extensionflag, const int reminder, const string &mailaddress,
+                            const string &user_option, const string &groupname, const string &comment) {
+    ostringstream messages;
+    streambuf *stderrbuf = cerr.rdbuf(messages.rdbuf());
+    try {
+        po::variables_map ropt = opt;
+        setoption(ropt, "duration", boost::any(r.duration));
+        if (r.filesystem != "") {
+            setoption(ropt, "filesystem", boost::any(r.filesystem));
+        }
+        // config and private config are read and capabilities dropped once per batch,
+        // further requests are validated in memory
+        if (ws) {
+            ws->setrequest(WS_Allocate, ropt, r.duration, r.filesystem);
+        } else {
+            ws.reset(new Workspace(WS_Allocate, ropt, r.duration, r.filesystem));
+        }
+        WsAllocation result = ws->allocate(r.name, extensionflag, reminder, mailaddress, user_option, groupname, comment);
+        printremaining(result);
+        r.wsdir = result.wsdir;
+        r.dbfilename = result.dbfilename;
+    } catch (const WsError &e) {
+        cerr << "Error: " << e.what() << endl;
+        r.error = e.what();
+    }
+    cerr.rdbuf(stderrbuf);
+    r.messages = messages.str();
+}
+
+
+/*
+ *  results of requests, in input order, one line per request:
+ *    workspace_name ok workspace_directory
+ *    workspace_name error message
+ *  the messages of each request go to stderr, prefixed with the workspace name.
+ */
+static bool printrequests(vector<BatchRequest>::iterator begin, vector<BatchRequest>::iterator end) {
+    bool ok = true;
+    for (vector<BatchRequest>::iterator r = begin; r != end; r++) {
+        istringstream lines(r->messages);
+        string line;
+        while (getline(lines, line)) {
+            cerr << r->name << ": " << line << endl;
+        }
+        if (r->error.empty()) {
+            cout << r->name << " ok " << r->wsdir << endl;
+        } else {
+            cout << r->name << " error " << r->error << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+// requests whose DB entries are synced together
+static const size_t batchcommit = 1000;
+
+/*
+ *  allocate all requests of a batch in this process, with one workspace object.
+ *  The DB entries of up to batchcommit requests are committed with one sync of the
+ *  DB directory (WsDB::begin_batch), a request is reported when its entry is committed.
+ *  A name repeated in a batch commits the requests before it, so it finds its entry.
+ */
+static bool runbatch(vector<BatchRequest> &requests, const po::variables_map &opt,
+                     const bool extensionflag, const int reminder, const string &mailaddress,
+                     const string &user_option, const string &groupname, const string &comment) {
+    unique_ptr<Workspace> ws;
+    set<string> names;
+    size_t first = 0;
+    bool ok = true;
+
+    WsDB::begin_batch();
+    for (size_t i=0; i<=requests.size(); i++) {
+        if (i == requests.size() || names.size() >= batchcommit || names.count(requests[i].name)) {
+            vector<string> failed;
+            WsDB::commit_batch(&failed);
+            for (size_t j=first; j<i; j++) {
+                BatchRequest &r = requests[j];
+                if (r.error.empty() && find(failed.begin(), failed.end(), r.dbfilename) != failed.end()) {
+                    r.error = "could not write database entry " + r.dbfilename;
+                }
+            }
+            ok = printrequests(requests.begin() + first, requests.begin() + i) && ok;
+            cout.flush();
+            first = i;
+            names.clear();
+            if (i == requests.size()) {
+                break;
+            }
+            WsDB::begin_batch();
+        }
+        BatchRequest &r = requests[i];
+        names.insert(r.name);
+        if (r.error.empty()) {
+            allocaterequest(r, ws, opt, extensionflag, reminder, mailaddress, user_option, groupname, comment);
+        }
+    }
+    return ok;
+}
+
+
 /*
  *  main logic here
  */
 
-int main(int argc, char **argv) {
+static int run(int argc, char **argv) {
     int duration, durationdefault;
     bool extensionflag;
     string name;
@@ -218,6 +452,7 @@ int main(int argc, char **argv) {
     string user_option, groupname;
 	string comment;
     int reminder = 0;
+    string batchfile;
     po::variables_map opt;
 
     // we only support C locale, if the used local is not installed on the system
@@ -230,19 +465,12 @@ int main(int argc, char **argv) {
 	boost::filesystem::path::imbue(std::locale());
     
     // read config (for dbuid, reminder and duration default only)
-    YAML::Node config;
-    try {
-        config = YAML::LoadFile("/etc/ws.conf");
-    } catch (const YAML::BadFile& e) {
-        cerr << "Error: Could not read config file!" << endl;
-        cerr << e.what() << endl;
-        exit(-1);
-    }
+    const WsConfig &config = WsConfig::get();
 
-    reminder = config["reminderdefault"].as<int>(0);
-	durationdefault = config["durationdefault"].as<int>(1);
+    reminder = config.reminderdefault;
+	durationdefault = config.durationdefault;
 
-    int db_uid = config["dbuid"].as<int>();
+    int db_uid = config.dbuid;
 
     // read user config before dropping privileges to DB user
     //
@@ -267,14 +495,52 @@ int main(int argc, char **argv) {
 
     // check commandline, get flags which are used to create ws object or for workspace allocation
     commandline(opt, name, duration, durationdefault , filesystem, extensionflag, 
-				reminder, mailaddress, user_option, groupname, comment, argc, argv, user_conf);
+				reminder, mailaddress, user_option, groupname, comment, batchfile, argc, argv, user_conf);
 
     openlog("ws_allocate", 0, LOG_USER); // SYSLOG
 
+    if (opt.count("batch")) {
+        // read batch input as user, like the user config
+        Workspace::drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, getuid());
+        vector<BatchRequest> requests;
+        if (batchfile == "-") {
+            requests = readbatch(cin, duration, filesystem);
+        } else {
+            std::ifstream in(batchfile.c_str());
+            if (!in) {
+                cerr << "Error: can not read batch file " << batchfile << "!" << endl;
+                exit(1);
+            }
+            requests = readbatch(in, duration, filesystem);
+        }
+        Workspace::raise_cap(CAP_DAC_OVERRIDE);
+        Workspace::drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, db_uid);
+
+        return runbatch(requests, opt, extensionflag, reminder, mailaddress, user_option, groupname, comment) ? 0 : 1;
+    }
+
     // get workspace object
     Workspace ws(WS_Allocate, opt, duration, filesystem);
     
     // allocate workspace
-    ws.allocate(name, extensionflag, reminder, mailaddress, user_option, groupname, comment);
-    
+    printallocation(ws.allocate(name, extensionflag, reminder, mailaddress, user_option, groupname, comment));
+
+    return 0;
+}
+
+// also run by ws_brokerd on behalf of the user
+int ws_allocate_main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
 }
+
+
+#ifndef WS_BROKERD
+int main(int argc, char **argv) {
+    // let a running ws_brokerd do the work, with hot config, ACLs and NSS lookups
+    int status;
+    if (WsBroker::forward("ws_allocate", argc, argv, status)) {
+        return status;
+    }
+    return ws_allocate_main(argc, argv);
+}
+#endif
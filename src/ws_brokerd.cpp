@@ -0,0 +1,490 @@
+/*
+ *  workspace++
+ *
+ *  ws_brokerd
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *
+ *  optional daemon for ws_allocate and ws_release (and so ws_extend), runs as root.
+ *  It keeps the compiled config, the ACLs, NSS lookups and lua callouts in memory,
+ *  and runs each request in a forked process with the credentials the setuid tool
+ *  would have, so a request does the same work as the tool minus the startup.
+ *  The tools use the daemon if its socket exists and run in process otherwise.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <boost/program_options.hpp>
+
+#ifndef SETUID
+#include <sys/capability.h>
+#else
+typedef int cap_value_t;
+const int CAP_DAC_OVERRIDE = 0;
+const int CAP_CHOWN = 1;
+#endif
+
+#include "ws.h"
+#include "wsconfig.h"
+#include "wsacl.h"
+#include "wsgroups.h"
+#include "wsbroker.h"
+#include "wserror.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+
+static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t stopping = 0;
+
+static void onsignal(int sig) {
+    if (sig == SIGHUP) {
+        reload = 1;
+    } else if (sig != SIGCHLD) {
+        stopping = 1;
+    }
+}
+
+/*
+ * limits for the request processes, which can wait for a slow client, a slow
+ * filesystem or a slow directory service
+ */
+struct Limits {
+    int nssttl;
+    int maxrequests;    // at once, more connections wait in the backlog
+    int maxperuser;     // at once for one uid, more run the tool in process
+};
+
+
+static void commandline(po::variables_map &opt, Limits &limits, int &listenfd, int argc, char**argv) {
+    po::options_description cmd_options( "\nOptions" );
+    cmd_options.add_options()
+            ("help,h", "produce help message")
+            ("version,V", "show version")
+            ("nssttl", po::value<int>(&limits.nssttl)->default_value(60),
+                    "seconds to keep user and group lookups in memory")
+            ("max-requests", po::value<int>(&limits.maxrequests)->default_value(256),
+                    "requests handled at once, further connections wait")
+            ("max-per-user", po::value<int>(&limits.maxperuser)->default_value(16),
+                    "requests of one user handled at once, further ones run in the tool")
+    ;
+    // listening socket kept over a reload
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("listenfd", po::value<int>(&listenfd)->default_value(-1), "")
+    ;
+    po::options_description all_options;
+    all_options.add(cmd_options).add(hidden_options);
+
+    try{
+        po::store(po::command_line_parser(argc, argv).options(all_options).run(), opt);
+        po::notify(opt);
+    } catch (...) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("help")) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(0);
+    }
+
+    if (opt.count("version")) {
+#ifdef IS_GIT_REPOSITORY
+        cout << "workspace build from git commit hash " << GIT_COMMIT_HASH
+             << " on top of release " << WS_VERSION << endl;
+#else
+        cout << "workspace version " << WS_VERSION << endl;
+#endif
+        exit(1);
+    }
+
+    if (limits.maxrequests < 1 || limits.maxperuser < 1) {
+        cerr << "Error: --max-requests and --max-per-user have to be at least 1." << endl;
+        exit(1);
+    }
+}
+
+
+/*
+ * socket for clients, any user may connect, the identity comes from SO_PEERCRED
+ */
+static int listensocket() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(WS_BROKERSOCKET) >= sizeof(addr.sun_path)) {
+        cerr << "Error: socket path " << WS_BROKERSOCKET << " too long." << endl;
+        exit(1);
+    }
+    strcpy(addr.sun_path, WS_BROKERSOCKET);
+
+    struct stat st;
+    if (lstat(WS_BROKERSOCKET, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            cerr << "Error: " << WS_BROKERSOCKET << " exists and is not a socket." << endl;
+            exit(1);
+        }
+        unlink(WS_BROKERSOCKET);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || chmod(WS_BROKERSOCKET, 0666) ||
+        listen(fd, SOMAXCONN)) {
+        cerr << "Error: can not listen on " << WS_BROKERSOCKET << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+    return fd;
+}
+
+
+/*
+ * the config is compiled once, a change of the config file restarts the daemon
+ */
+static bool configchanged(const struct stat &loaded) {
+    struct stat st;
+    if (stat(WS_CONFIGFILE, &st)) return false;
+    return st.st_ino != loaded.st_ino || st.st_dev != loaded.st_dev || st.st_size != loaded.st_size ||
+           st.st_mtim.tv_sec != loaded.st_mtim.tv_sec || st.st_mtim.tv_nsec != loaded.st_mtim.tv_nsec ||
+           st.st_ctim.tv_sec != loaded.st_ctim.tv_sec || st.st_ctim.tv_nsec != loaded.st_ctim.tv_nsec;
+}
+
+static void restart(char *argv0, const int listenfd, const Limits &limits) {
+    syslog(LOG_INFO, "config changed or SIGHUP, restarting");
+    // keep the socket, waiting clients stay in the backlog
+    fcntl(listenfd, F_SETFD, 0);
+    string fdarg = "--listenfd=" + to_string(listenfd);
+    string ttlarg = "--nssttl=" + to_string(limits.nssttl);
+    string maxarg = "--max-requests=" + to_string(limits.maxrequests);
+    string userarg = "--max-per-user=" + to_string(limits.maxperuser);
+    char *args[] = {argv0, (char *)fdarg.c_str(), (char *)ttlarg.c_str(), (char *)maxarg.c_str(),
+                    (char *)userarg.c_str(), NULL};
+    execv("/proc/self/exe", args);
+    syslog(LOG_ERR, "restart failed: %s", strerror(errno));
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+}
+
+
+/*
+ * supplementary groups of the caller at connect time
+ */
+static bool peergroups(const int conn, const struct ucred &cred, vector<gid_t> &groups) {
+#ifdef SO_PEERGROUPS
+    groups.resize(64);
+    socklen_t len = groups.size() * sizeof(gid_t);
+    int ret;
+    while ((ret = getsockopt(conn, SOL_SOCKET, SO_PEERGROUPS, groups.data(), &len)) != 0 && errno == ERANGE) {
+        groups.resize(len / sizeof(gid_t));
+    }
+    if (ret == 0) {
+        groups.resize(len / sizeof(gid_t));
+        return true;
+    }
+#endif
+    // older kernels, the caller waits for the answer, so its pid is not reused
+    ifstream status(("/proc/" + to_string(cred.pid) + "/status").c_str());
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 7, "Groups:") == 0) {
+            istringstream in(line.substr(7));
+            gid_t g;
+            groups.clear();
+            while (in >> g) groups.push_back(g);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * credentials of the tool started by the caller, with real uid and gid of the
+ * caller, as setuid root binary or as binary with capabilities
+ */
+static bool becomeuser(const struct ucred &cred, const vector<gid_t> &groups) {
+    if (setgroups(groups.size(), groups.data()) || setresgid(cred.gid, cred.gid, cred.gid)) {
+        return false;
+    }
+#ifdef SETUID
+    if (setresuid(cred.uid, 0, 0)) {
+        return false;
+    }
+#else
+    if (prctl(PR_SET_KEEPCAPS, 1) || setresuid(cred.uid, cred.uid, cred.uid)) {
+        return false;
+    }
+    Workspace::drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, cred.uid);
+#endif
+    return true;
+}
+
+
+/*
+ * one request, in a process of its own: read it, run the tool in a child with the
+ * descriptors and credentials of the caller, and send the exit status back
+ */
+static void handle(const int conn, const struct ucred &cred) {
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    // clients send the whole request at once
+    struct timeval timeout = {10, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    string tool;
+    vector<string> args;
+    int fds[4];
+    if (!WsBroker::receive(conn, tool, args, fds)) {
+        syslog(LOG_WARNING, "bad request from uid %d pid %d", (int)cred.uid, (int)cred.pid);
+        _exit(1);
+    }
+    vector<gid_t> groups;
+    bool havegroups = peergroups(conn, cred, groups);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int i=0; i<3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        close(conn);
+
+        if (!havegroups || !becomeuser(cred, groups)) {
+            cerr << "Error: ws_brokerd can not take the identity of the caller." << endl;
+            exit(1);
+        }
+        // relative paths, like a batch file, are relative to the caller
+        if (fchdir(fds[3])) {
+            cerr << "Error: can not change to working directory of the caller." << endl;
+            exit(1);
+        }
+        close(fds[3]);
+        if (args.empty()) {
+            cerr << "Error: empty request." << endl;
+            exit(1);
+        }
+        vector<char *> argv;
+        for (string &a: args) {
+            argv.push_back(&a[0]);
+        }
+        argv.push_back(NULL);
+        if (tool == "ws_allocate") {
+            exit(ws_allocate_main(args.size(), argv.data()));
+        }
+        if (tool == "ws_release") {
+            exit(ws_release_main(args.size(), argv.data()));
+        }
+        cerr << "Error: ws_brokerd can not run " << tool << "." << endl;
+        exit(1);
+    }
+    for (int i=0; i<4; i++) {
+        close(fds[i]);
+    }
+
+    int status = 1;
+    if (pid > 0) {
+        int wstatus;
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR);
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+    } else {
+        syslog(LOG_ERR, "fork failed: %s", strerror(errno));
+    }
+    WsBroker::reply(conn, status);
+    _exit(0);
+}
+
+
+static int run(int argc, char **argv) {
+    po::variables_map opt;
+    Limits limits;
+    int listenfd;
+
+    if (getuid()!=0 || geteuid()!=0) {
+        cerr << "Error: you are not root." << endl;
+        exit(-1);
+    }
+
+    commandline(opt, limits, listenfd, argc, argv);
+
+    // same locale as the tools set for themselves
+    setenv("LANG","C",1);
+    setenv("LC_CTYPE","C",1);
+    setenv("LC_ALL","C",1);
+    std::setlocale(LC_ALL, "C");
+    std::locale::global(std::locale("C"));
+
+    // requests get descriptors 0-2 of the caller, ours must not be taken by other files
+    for (int i=0; i<3; i++) {
+        if (fcntl(i, F_GETFD) < 0 && open("/dev/null", O_RDWR) != i) {
+            cerr << "Error: can not open /dev/null." << endl;
+            exit(1);
+        }
+    }
+
+    // everything requests would load on their own
+    struct stat loaded;
+    if (stat(WS_CONFIGFILE, &loaded)) {
+        memset(&loaded, 0, sizeof(loaded));
+    }
+    WsConfig::get();
+    WsAcl::get();
+    Workspace::preload_callouts();
+
+    openlog("ws_brokerd", 0, LOG_DAEMON);
+    if (listenfd < 0) {
+        listenfd = listensocket();
+    }
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+    syslog(LOG_INFO, "listening on %s", WS_BROKERSOCKET);
+
+#ifndef SETUID
+    // NSS warmup may lower capabilities through the group cache file, this restores them
+    cap_t rootcaps = cap_get_proc();
+#endif
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onsignal;
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    // a request process ending interrupts the poll below
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // running request processes and their uid, and the number per uid
+    map<pid_t, uid_t> requests;
+    map<uid_t, int> peruser;
+
+    time_t nssflush = time(NULL) + limits.nssttl;
+    while (!stopping) {
+        pid_t done;
+        while ((done = waitpid(-1, NULL, WNOHANG)) > 0) {
+            auto it = requests.find(done);
+            if (it != requests.end()) {
+                if (--peruser[it->second] == 0) peruser.erase(it->second);
+                requests.erase(it);
+            }
+        }
+
+        if (reload || configchanged(loaded)) {
+            reload = 0;
+            restart(argv[0], listenfd, limits);
+            // still running with the old config, try again later
+            if (stat(WS_CONFIGFILE, &loaded)) {
+                memset(&loaded, 0, sizeof(loaded));
+            }
+        }
+        if (time(NULL) >= nssflush) {
+            WsGroups::clear();
+            nssflush = time(NULL) + limits.nssttl;
+        }
+
+        // at the limit, new connections wait in the backlog until a request is done
+        struct pollfd pfd = {listenfd, POLLIN, 0};
+        if (poll(&pfd, (int)requests.size() < limits.maxrequests ? 1 : 0, 1000) <= 0) {
+            continue;
+        }
+        int conn = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            continue;
+        }
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+            close(conn);
+            continue;
+        }
+        // one user can not take all request processes
+        auto running = peruser.find(cred.uid);
+        if (running != peruser.end() && running->second >= limits.maxperuser) {
+            syslog(LOG_WARNING, "uid %d has %d requests running, request of pid %d sent back",
+                   (int)cred.uid, running->second, (int)cred.pid);
+            WsBroker::busy(conn);
+            close(conn);
+            continue;
+        }
+
+        // do the lookups of the tool here, so they stay for the next requests of the user
+        string username, home;
+        if (WsGroups::getuser(cred.uid, username, home)) {
+            WsGroups::getgroupnames(username, cred.gid);
+#ifdef SETUID
+            if (seteuid(0)) {
+                syslog(LOG_ERR, "can not change uid back to root");
+                exit(1);
+            }
+#else
+            cap_set_proc(rootcaps);
+#endif
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listenfd);
+            handle(conn, cred);
+        }
+        if (pid < 0) {
+            syslog(LOG_ERR, "fork failed: %s", strerror(errno));
+        } else {
+            requests[pid] = cred.uid;
+            peruser[cred.uid]++;
+        }
+        close(conn);
+    }
+
+    unlink(WS_BROKERSOCKET);
+    syslog(LOG_INFO, "terminated");
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
+}
@@ -0,0 +1,762 @@
+/*
+ *  workspace++
+ *
+ *  ws_expirer
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *
+ *  to be called from a cronjob to expire workspaces, does delete the data as well,
+ *  only for root.
+ *
+ *  differences to python version (sbin/ws_expirer.py)
+ *    - DB directories of a filesystem are read once, all phases work on that snapshot
+ *    - filesystems are processed in parallel, output is collected per filesystem and
+ *      printed in the order of the python version, so runs can be compared with diff
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+// YAML
+#include <yaml-cpp/yaml.h>
+
+#include <boost/program_options.hpp>
+
+#include "wsconfig.h"
+#include "wsdb.h"
+#include "wsdirs.h"
+#include "wsindex.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsexpiry.h"
+#include "wsmail.h"
+#include "wsreminders.h"
+#include "wspyprint.h"
+#include "wsdelete.h"
+#include "wserror.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+
+// like str() of a python list of strings
+static string pylist(const vector<string> &l) {
+    string s = "[";
+    for (size_t i=0; i<l.size(); i++) {
+        if (i>0) s += ", ";
+        s += "'" + l[i] + "'";
+    }
+    return s + "]";
+}
+
+// like time.time()
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// like os.path.join with two components
+static string pathjoin(const string a, const string b) {
+    if (!b.empty() && b[0] == '/') return b;
+    if (a.empty() || a[a.size()-1] == '/') return a + b;
+    return a + "/" + b;
+}
+
+// like os.path.basename
+static string basename(const string p) {
+    size_t pos = p.rfind('/');
+    return pos == string::npos ? p : p.substr(pos+1);
+}
+
+// like os.path.dirname
+static string dirname(const string p) {
+    size_t pos = p.rfind('/');
+    if (pos == string::npos) return "";
+    string head = p.substr(0, pos+1);
+    if (head.find_first_not_of('/') != string::npos) {
+        while (!head.empty() && head[head.size()-1] == '/') head.erase(head.size()-1);
+    }
+    return head;
+}
+
+static bool exists(const string p) {
+    return WsDirs::exists(p);
+}
+
+// unlinkat relative to the directory of path
+static int unlinkpath(const string path, const int flags) {
+    string name;
+    int dirfd = WsDirs::parent(path, name);
+    return dirfd < 0 ? -1 : unlinkat(dirfd, name.c_str(), flags);
+}
+
+// record of getdents64, not declared by glibc before 2.30
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// like glob.glob(os.path.join(dir, pattern)), in directory order, hidden files are skipped.
+// getdents64 with a large buffer, big directories take few round trips on Lustre and NFS
+static vector<string> globdir(const string dir, const char *pattern) {
+    vector<string> result;
+    int dirfd = WsDirs::get(dir);
+    int fd = dirfd < 0 ? -1 : openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return result;
+    }
+    vector<char> buf(1024*1024);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf.data(), buf.size())) > 0) {
+        for (long pos = 0; pos < n; ) {
+            const struct linux_dirent64 *de = (const struct linux_dirent64 *)(buf.data() + pos);
+            pos += de->d_reclen;
+            if (de->d_name[0] == '.') continue;
+            if (fnmatch(pattern, de->d_name, 0) == 0) {
+                result.push_back(pathjoin(dir, de->d_name));
+            }
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// globdir of all dirs at once, one thread each, as the spaces can be on different servers
+static vector<vector<string>> globdirs(const vector<string> &dirs, const char *pattern) {
+    vector<vector<string>> result(dirs.size());
+    vector<thread> threads;
+    for (size_t i=0; i<dirs.size(); i++) {
+        threads.push_back(thread([&, i]() { result[i] = globdir(dirs[i], pattern); }));
+    }
+    for (thread &t: threads) {
+        t.join();
+    }
+    return result;
+}
+
+
+/*
+ * one DB entry as read by the python version, YAML or old two line format
+ */
+struct DbEntry {
+    string filename;
+    bool empty;                 // neither YAML nor old format
+    string readerror;           // reason if old format could not be read
+    bool yaml;
+    string expiration;          // as found in file, parsed in the phases
+    string workspace;
+    int reminder;
+    string mailaddress;
+    bool hasreleased;
+    long released;
+
+    DbEntry() : empty(true), yaml(false), reminder(0), hasreleased(false), released(0) {}
+};
+
+static DbEntry readentry(const string filename) {
+    DbEntry e;
+    e.filename = filename;
+
+    // one open relative to the DB directory, both formats are parsed from the content
+    string content;
+    string name;
+    int dirfd = WsDirs::parent(filename, name);
+    int fd = dirfd < 0 ? -1 : openat(dirfd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) content.append(buf, n);
+        close(fd);
+    }
+
+    try {
+        YAML::Node node = YAML::Load(content);
+        if (node.IsMap() && node["workspace"] && node["expiration"]) {
+            e.workspace = node["workspace"].as<string>();
+            e.expiration = node["expiration"].as<string>();
+            e.reminder = node["reminder"].as<int>(0);
+            e.mailaddress = node["mailaddress"].as<string>("");
+            if (node["released"]) {
+                e.hasreleased = true;
+                e.released = node["released"].as<long>(0);
+            }
+            e.yaml = true;
+            e.empty = false;
+            return e;
+        }
+    } catch (const YAML::Exception&) {
+        // try old format
+    }
+
+    // old format: expiration and workspace path in first two lines
+    istringstream in(content);
+    string l1, l2;
+    if (getline(in, l1) && getline(in, l2)) {
+        e.expiration = l1;
+        e.workspace = l2;
+        e.empty = false;
+    } else {
+        e.readerror = "Exception while trying to read " + filename + ". list index out of range";
+    }
+    return e;
+}
+
+// entries of a DB directory, flat and in its shards
+static vector<DbEntry> readentries(const string dir, const char *pattern) {
+    vector<DbEntry> entries;
+    vector<string> dirs = WsShards::dirs(dir);
+    // an entry moved by a migration while reading can be seen twice
+    set<string> seen;
+    for (const string &d: dirs) {
+        for (const string &f: globdir(d, pattern)) {
+            if (dirs.size() > 1 && !seen.insert(basename(f)).second) continue;
+            entries.push_back(readentry(f));
+        }
+    }
+    return entries;
+}
+
+// entries of dir from its index instead of the YAML files, with their flat
+// names, false if dir has no valid index
+static bool indexentries(const string dir, vector<DbEntry> &entries) {
+    if (!WsIndex::exists(dir)) return false;
+    WsIndex index(dir);
+    if (!index.valid()) return false;
+    for (const WsIndexRecord *r: index.entries()) {
+        DbEntry e;
+        e.filename = pathjoin(dir, index.getstring(r->name));
+        e.expiration = to_string(r->expiration);
+        e.workspace = index.getstring(r->workspace);
+        e.reminder = r->reminder;
+        e.mailaddress = index.getstring(r->mailaddress);
+        e.hasreleased = r->released != 0;
+        e.released = r->released;
+        e.yaml = true;
+        e.empty = false;
+        entries.push_back(e);
+    }
+    return true;
+}
+
+// like int() of python for the values we expect, false if not a number
+static bool parselong(const string s, long &value) {
+    const char *p = s.c_str();
+    char *end;
+    errno = 0;
+    value = strtol(p, &end, 10);
+    if (end == p || errno != 0) return false;
+    while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r') end++;
+    return *end == '\0';
+}
+
+
+static void deldir(ostream &out, const string dir, const int threads, DeleteLimit *limit) {
+    pyprint(out, "   deldir(fast)", dir);
+    if (!exists(dir)) {
+        out << "Error: Path to delete does not exist: " << dir << endl;
+        return;
+    }
+    DeleteStats stats;
+    string error;
+    if (!deletetree(dir, threads, stats, error, limit)) {
+        out << "Error: could not delete " << dir << ", " << stats.errors << " errors, first: " << error << endl;
+    }
+    out << "   deleted " << stats.files << " files, " << stats.dirs << " directories, " << stats.bytes
+        << " bytes in " << stats.seconds << " seconds, "
+        << (stats.seconds > 0 ? (uint64_t)(stats.files / stats.seconds) : stats.files) << " files/s" << endl;
+}
+
+
+static void send_reminder(ostream &out, const WsConfig &config, const string wsname,
+                          const long expiration, const string mailaddress) {
+    string text = " \n        Your workspace " + wsname + " on system " + config.clustername +
+                  " will expire at " + pyctime(expiration) + ".\n    ";
+    string sender = config.mail_from != "" ? config.mail_from : "wsadmin";
+    string subject = "Workspace " + wsname + " will expire at " + pyctime(expiration);
+
+    switch (sendmail(config.smtphost, sender, mailaddress, subject, text)) {
+        case MAIL_OK:
+            break;
+        case MAIL_RECIPIENTREFUSED:
+            pyprint(out, "Recipient refused: {}", "['" + mailaddress + "']");
+            break;
+        case MAIL_SENDERREFUSED:
+            pyprint(out, "Sender refused: {}", sender);
+            break;
+        case MAIL_SOCKETERROR:
+            pyprint(out, "Socket error");
+            break;
+        default:
+            pyprint(out, "Could not send reminder email. Other reason.", "['" + mailaddress + "']");
+    }
+}
+
+/*
+ * all work for one filesystem, output of each phase goes into its own buffer
+ */
+struct FsRun {
+    string fs;
+    ostringstream phase[3];
+};
+
+static void expirefs(FsRun &run, const WsConfig &config, const bool dryrun, const bool fullspeed) {
+    const string &fs = run.fs;
+    const FilesystemConfig *cfs = config.getfs(fs);
+    if (cfs == NULL) {
+        for (int i=0; i<3; i++) {
+            pyprint(run.phase[i], "  FAILED to access", fs, "in config file");
+        }
+        return;
+    }
+
+    const string dbdir = cfs->database;
+    const string dbdeldir = pathjoin(dbdir, cfs->deleted);
+    const string workspacedelprefix = cfs->deleted;
+    const vector<string> &spaces = cfs->spaces;
+
+    // one deletion budget for the whole filesystem
+    DeleteLimit limit(fullspeed ? 0 : cfs->deleteopsrate, fullspeed ? 0 : cfs->deletebytesrate);
+
+    // read the DB once, the phases work on this snapshot, from the index if there is one.
+    // Entries from an index have flat names, they are located when they are moved or removed
+    vector<DbEntry> dbentries, dbdelentries;
+    if (!indexentries(dbdir, dbentries)) {
+        dbentries = readentries(dbdir, "*-*");
+    }
+    if (!indexentries(dbdeldir, dbdelentries)) {
+        dbdelentries = readentries(dbdeldir, "*-*");
+    }
+
+    /*
+     * phase 1: cleanup stray directories, this removes stuff that was released (no DB entry any more)
+     * from spaces, and checks if anything is left over in removed state for whatever reasons
+     */
+    ostream &out1 = run.phase[0];
+
+    // workspaces of the DB entries by name, and names of the deleted entries
+    unordered_map<string, string> dbentryworkspaces;
+    for (const DbEntry &e: dbentries) {
+        if (e.empty) {
+            if (e.readerror != "") out1 << e.readerror << endl;
+            pyprint(out1, "Empty DB entry?", e.filename);
+            continue;
+        }
+        dbentryworkspaces[basename(e.workspace)] = e.workspace;
+    }
+    unordered_set<string> dbdelentrynames;
+    for (const DbEntry &e: dbdelentries) {
+        dbdelentrynames.insert(basename(e.filename));
+    }
+
+    // all spaces and their deleted directories are listed concurrently
+    vector<string> scandirs = spaces;
+    for (const string &space: spaces) {
+        scandirs.push_back(pathjoin(space, cfs->deleted));
+    }
+    vector<vector<string>> listings = globdirs(scandirs, "*-*");
+
+    // first for visible workspaces
+    unordered_set<string> seen;
+    pyprint(out1, "PHASE: checking for stray workspaces for", fs, dbdir, pylist(spaces));
+    for (size_t i=0; i<spaces.size(); i++) {
+        for (const string &ws: listings[i]) {
+            string name = basename(ws);
+            auto entry = dbentryworkspaces.find(name);
+            // looked up again, the entry could have been created or moved into a shard since it was read
+            if (entry == dbentryworkspaces.end() && !WsShards::exists(pathjoin(dbdir, name))) {
+                pyprint(out1, "  stray workspace", ws);
+                string target = pathjoin(pathjoin(dirname(ws), workspacedelprefix), name + "-" + to_string(time(NULL)));
+                if (!dryrun) {
+                    if (WsDirs::renamenoreplace(ws, target) == 0) {
+                        pyprint(out1, "  OS.RENAME", ws, target);
+                    } else {
+                        pyprint(out1, "  OS.RENAME FAILED", ws, target);
+                    }
+                } else {
+                    pyprint(out1, "  MV", ws, target);
+                }
+            } else if (entry != dbentryworkspaces.end() && dirname(entry->second) != dirname(ws)) {
+                // same name in another space, left alone, the DB entry decides which one is used
+                pyprint(out1, "  duplicate workspace", ws, "DB entry points to", entry->second);
+            } else {
+                pyprint(out1, "  valid workspace", ws);
+                seen.insert(name);
+            }
+        }
+    }
+    for (const DbEntry &e: dbentries) {
+        if (!e.empty && !seen.count(basename(e.workspace))) {
+            pyprint(out1, "  orphaned DB entry, workspace not found", e.filename, e.workspace);
+        }
+    }
+
+    // second for removed workspaces
+    for (size_t i=0; i<spaces.size(); i++) {
+        for (const string &ws: listings[spaces.size() + i]) {
+            if (!dbdelentrynames.count(basename(ws)) && !WsShards::exists(pathjoin(dbdeldir, basename(ws)))) {
+                pyprint(out1, "  stray removed workspace", ws);
+                if (!dryrun) {
+                    deldir(out1, ws, cfs->deletethreads, &limit);
+                } else {
+                    pyprint(out1, "  DELDIR", ws);
+                }
+            } else {
+                pyprint(out1, "  valid removed workspace", ws);
+            }
+        }
+    }
+
+    /*
+     * phase 2: expire the workspaces by moving them into deleted spaces, dbentry + workspace itself
+     */
+    ostream &out2 = run.phase[1];
+    pyprint(out2, "PHASE: checking for workspaces to be expired for", fs, dbdir, pylist(spaces));
+    // with an expiration queue, only entries with an expiration or reminder due are looked at
+    bool queued = WsExpiry::exists(dbdir);
+    // with a reminder spool, reminders are sent after all filesystems are done
+    bool spooled = WsReminders::exists(dbdir);
+    vector<string> buckets;
+    vector<DbEntry> dueentries;
+    if (queued) {
+        for (const string &name: WsExpiry::due(dbdir, time(NULL), buckets)) {
+            string filename = WsShards::locate(pathjoin(dbdir, name));
+            // stale lines of released entries
+            if (exists(filename)) {
+                dueentries.push_back(readentry(filename));
+            }
+        }
+        pyprint(out2, "  queue:", dueentries.size(), "of", dbentries.size(), "entries due");
+    }
+    for (const DbEntry &e: queued ? dueentries : dbentries) {
+        const string dbentryfilename = WsShards::locate(e.filename);
+        if (e.empty) {
+            if (e.readerror != "") out2 << e.readerror << endl;
+            pyprint(out2, "   ERROR, skiping empty db entry:", dbentryfilename);
+            continue;
+        }
+        long expiration;
+        if (!parselong(e.expiration, expiration)) {
+            pyprint(out2, "   ERROR in parsing expiration <", e.expiration, "> for", dbentryfilename);
+            continue;
+        }
+        const string &workspace = e.workspace;
+        if (workspace == "" || expiration == 0) {
+            pyprint(out2, "  FAILED to parse DB for", dbentryfilename);
+            continue;
+        }
+        if (now() > expiration) {
+            pyprint(out2, "  expiring", dbentryfilename, "  (expired", pyctime(expiration), ")");
+            string timestamp = to_string(time(NULL));
+            string dbtarget = WsShards::canonical(pathjoin(dbdeldir, basename(dbentryfilename)) + "-" + timestamp);
+            string wstarget = pathjoin(pathjoin(dirname(workspace), workspacedelprefix), basename(dbentryfilename) + "-" + timestamp);
+            if (!dryrun) {
+                if (WsDirs::renamenoreplace(dbentryfilename, dbtarget) != 0) {
+                    pyprint(out2, "  OS.RENAME FAILED", dbentryfilename, dbtarget);
+                    // try again next run
+                    if (queued) WsExpiry::add(dbdir, basename(dbentryfilename), time(NULL), config.dbuid, config.dbgid);
+                    continue;
+                }
+                pyprint(out2, "  OS.RENAME", dbentryfilename, dbtarget);
+                // index and manifests follow the entry, like ws_release does it
+                string flattarget = pathjoin(dbdeldir, basename(dbentryfilename) + "-" + timestamp);
+                WsIndex::remove(pathjoin(dbdir, basename(dbentryfilename)));
+                if (WsIndex::exists(dbdeldir)) {
+                    try {
+                        WsDB moved(flattarget, config.dbuid, config.dbgid);
+                        WsIndex::update(flattarget, moved);
+                    } catch (...) {
+                        pyprint(out2, "  FAILED to read", dbtarget, "for the index");
+                    }
+                }
+                WsUsers::add(flattarget, config.dbuid, config.dbgid);
+                // the moved entry is handled by phase 3 like in the python version
+                DbEntry moved = e;
+                moved.filename = dbtarget;
+                dbdelentries.push_back(moved);
+            } else {
+                pyprint(out2, "  MV", dbentryfilename, dbtarget);
+            }
+
+            // FIXME this could fail on scatefs, should fallback to 'mv'
+            if (!dryrun) {
+                if (WsDirs::renamenoreplace(workspace, wstarget) == 0) {
+                    pyprint(out2, "  OS.RENAME", workspace, wstarget);
+                } else {
+                    pyprint(out2, "  OS.RENAME FAILED", workspace, wstarget);
+                }
+            } else {
+                pyprint(out2, "  MV", workspace, wstarget);
+            }
+        } else {
+            pyprint(out2, "  keeping", dbentryfilename, "  (expires ", pyctime(expiration), ")");
+            if (now() > (expiration - (e.reminder*(24*3600)))) {
+                string name = basename(dbentryfilename);
+                string swsname = name.substr(name.find('-')+1);
+                if (!dryrun) {
+                    if (e.mailaddress != "" && spooled) {
+                        WsReminder r = {name, swsname, expiration, e.mailaddress, 0, 0, 0};
+                        if (WsReminders::requeue(dbdir, r)) {
+                            pyprint(out2, "  QUEUE_REMINDER", swsname, expiration, e.mailaddress);
+                        } else {
+                            pyprint(out2, "  FAILED to queue reminder", swsname, expiration, e.mailaddress);
+                        }
+                    } else if (e.mailaddress != "") {
+                        send_reminder(out2, config, swsname, expiration, e.mailaddress);
+                        pyprint(out2, "  SEND_REMINDER", swsname, expiration, e.mailaddress);
+                    }
+                    // remind daily until expiration
+                    if (queued) {
+                        WsExpiry::add(dbdir, name, min((long)time(NULL) + 24*3600, expiration), config.dbuid, config.dbgid);
+                    }
+                } else {
+                    pyprint(out2, "  MAIL", swsname, expiration, e.mailaddress);
+                }
+            }
+        }
+    }
+
+    if (queued && !dryrun) {
+        WsExpiry::consume(dbdir, buckets);
+    }
+
+    /*
+     * phase 3: delete the already expired workspaces which are over "keeptime" days old
+     */
+    ostream &out3 = run.phase[2];
+    pyprint(out3, "PHASE: checking for expired workspaces for", fs, dbdir, pylist(spaces));
+    long keeptime = cfs->keeptime;
+    pyprint(out3, "  keeptime:", keeptime);
+    for (const DbEntry &e: dbdelentries) {
+        const string &dbentryfilename = e.filename;
+        if (fnmatch("*-*-*", basename(dbentryfilename).c_str(), 0) != 0) continue;
+
+        long expiration = 0;
+        if (!e.empty && !parselong(e.expiration, expiration)) {
+            pyprint(out3, "  FAILED to parse DB for", dbentryfilename);
+            continue;
+        }
+        const string &workspace = e.workspace;
+        if (workspace == "" || expiration == 0) {
+            pyprint(out3, "  FAILED to parse DB for", dbentryfilename);
+            continue;
+        }
+        // take time of release from filename
+        string released = dbentryfilename.substr(dbentryfilename.rfind('-')+1);
+        if (!parselong(released, expiration)) {
+            pyprint(out3, "   ERROR in parsing expiration <", released, "> for", dbentryfilename);
+            continue;
+        }
+
+        // check if the entry was released or was expired
+        double was_released;
+        if (e.hasreleased) {
+            was_released = e.released;
+            // released before 2001, makes no sense, ignore
+            if (was_released < 1000000000) {
+                was_released = now() + 3600000;     // time in future never reached
+                pyprint(out3, "  IGNORING RELEASED <", released, "> for", dbentryfilename);
+            }
+        } else {
+            was_released = now() + 3600000;         // time in future never reached
+        }
+
+        string target = pathjoin(pathjoin(dirname(workspace), workspacedelprefix), basename(dbentryfilename));
+        if ((now() > (expiration + keeptime*24*3600)) || (now() > (was_released + 3600))) {
+            if (now() > (was_released + 3600)) {
+                pyprint(out3, "  deleting", dbentryfilename, "  (was released", pyctime(was_released), ")");
+            } else {
+                pyprint(out3, "  deleting", dbentryfilename, "  (expired", pyctime(expiration), ")");
+            }
+
+            if (!dryrun) {
+                // remove the DB entry
+                string flatname = pathjoin(dbdeldir, basename(dbentryfilename));
+                if (unlinkpath(WsShards::locate(dbentryfilename), 0) != 0) {
+                    // an entry only left in the index is dropped from it
+                    if (errno == ENOENT) WsIndex::remove(flatname);
+                    pyprint(out3, "  OS.UNLINK FAILED", dbentryfilename);
+                    continue;
+                }
+                pyprint(out3, " OS.UNLINK", dbentryfilename);
+                WsIndex::remove(flatname);
+                // remove the workspace directory
+                deldir(out3, target, cfs->deletethreads, &limit);
+                pyprint(out3, "  DELDIR", target);
+                if (unlinkpath(target, AT_REMOVEDIR) == 0) {
+                    pyprint(out3, "  OS.RMDIR", target);
+                }
+            } else {
+                pyprint(out3, "  DELDIR", dbentryfilename);
+                pyprint(out3, "  RM", target);
+            }
+        } else {
+            pyprint(out3, "  (keeping further restorable", dbentryfilename, "until", pyctime(expiration + keeptime*24*3600), ")");
+        }
+    }
+}
+
+
+void commandline(po::variables_map &opt, vector<string> &fslist, bool &cleaner, bool &fullspeed, bool &sendonly,
+                 int argc, char**argv) {
+    po::options_description cmd_options( "\nOptions" );
+    cmd_options.add_options()
+            ("help,h", "produce help message")
+            ("version,V", "show version")
+            ("workspaces,w", po::value<vector<string> >(&fslist)->multitoken(),
+                    "pass a list of workspace filesystems to clean up (whitespace-separated)")
+            ("cleaner,c", "enable cleanup run (default is dry run)")
+            ("full-speed", "ignore deleteopsrate and deletebytesrate, e.g. for runs at night")
+            ("send-reminders", "only send the queued reminders, e.g. to retry failed ones between cleanup runs")
+    ;
+
+    try{
+        po::store(po::command_line_parser(argc, argv).options(cmd_options).run(), opt);
+        po::notify(opt);
+    } catch (...) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("help")) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(0);
+    }
+
+    if (opt.count("version")) {
+#ifdef IS_GIT_REPOSITORY
+        cout << "workspace build from git commit hash " << GIT_COMMIT_HASH
+             << " on top of release " << WS_VERSION << endl;
+#else
+        cout << "workspace version " << WS_VERSION << endl;
+#endif
+        exit(1);
+    }
+
+    cleaner = opt.count("cleaner") > 0;
+    fullspeed = opt.count("full-speed") > 0;
+    sendonly = opt.count("send-reminders") > 0;
+}
+
+
+static int run(int argc, char **argv) {
+    po::variables_map opt;
+    vector<string> fslist;
+    bool cleaner, fullspeed, sendonly;
+
+    if (getuid()!=0) {
+        cerr << "Error: you are not root." << endl;
+        exit(-1);
+    }
+
+    const WsConfig &config = WsConfig::get();
+
+    double start = now();
+    pyprint(cout, "start of expirer run", pyctime(start));
+
+    commandline(opt, fslist, cleaner, fullspeed, sendonly, argc, argv);
+    if (fslist.empty()) {
+        for (const FilesystemConfig &cfs: config.filesystems) {
+            fslist.push_back(cfs.name);
+        }
+    }
+    if (fslist.empty()) {
+        cout << "Error: no workspace defined" << endl;
+        exit(2);
+    }
+
+    bool dryrun = !cleaner;
+    if (dryrun) {
+        cout << "simulate cleaning ... (dryrun)" << endl;
+    } else {
+        cout << "really cleaning ..." << endl;
+    }
+    cout.flush();
+
+    if (sendonly) {
+        WsReminders::send(cout, config, fslist, dryrun);
+        double end = now();
+        pyprint(cout, "end of expirer run after ", end-start, "seconds at", pyctime(end));
+        return 0;
+    }
+
+    // filesystems are independent, work on all in parallel
+    vector<FsRun> runs(fslist.size());
+    vector<thread> threads;
+    for (size_t i=0; i<fslist.size(); i++) {
+        runs[i].fs = fslist[i];
+        threads.push_back(thread(expirefs, ref(runs[i]), cref(config), dryrun, fullspeed));
+    }
+    for (thread &t: threads) {
+        t.join();
+    }
+
+    // print in order of the python version, phase by phase
+    for (int p=0; p<3; p++) {
+        for (FsRun &run: runs) {
+            cout << run.phase[p].str();
+        }
+    }
+
+    // the reminders queued in phase 2, dry runs queue nothing
+    if (!dryrun) {
+        WsReminders::send(cout, config, fslist, dryrun);
+    }
+
+    double end = now();
+    pyprint(cout, "end of expirer run after ", end-start, "seconds at", pyctime(end));
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
+}
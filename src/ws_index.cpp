@@ -0,0 +1,234 @@
+/*
+ *  workspace++
+ *
+ *  ws_index
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *
+ *  maintains and queries the binary index of the DB directories,
+ *  and checks that the workspaces of the DB entries exist,
+ *  rebuild and quarantine are for root only.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <time.h>
+
+#include <boost/program_options.hpp>
+
+#include "wsconfig.h"
+#include "wsindex.h"
+#include "wsexpiry.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsverify.h"
+#include "wserror.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+
+void commandline(po::variables_map &opt, vector<string> &fslist, string &user, string &name,
+                 long &at, int &shards, int &threads, int argc, char**argv) {
+
+    po::options_description cmd_options( "\nOptions" );
+    cmd_options.add_options()
+            ("help,h", "produce help message")
+            ("version,V", "show version")
+            ("filesystem,F", po::value<vector<string> >(&fslist), "filesystem(s) to work on, default all")
+            ("deleted,d", "work on index of deleted entries")
+            ("rebuild", "create or rebuild index from DB entries (root only)")
+            ("rebuild-queue", "create or rebuild expiration queue from DB entries (root only)")
+            ("rebuild-users", "create or update per user manifests from DB entries (root only)")
+            ("shards", po::value<int>(&shards), "move DB entries and deleted entries into n shards, can run while the DB is in use (root only)")
+            ("verify", "list DB entries whose workspace directory does not exist")
+            ("quarantine", "with --verify, move DB entries without workspace to the quarantine directory (root only)")
+            ("threads", po::value<int>(&threads)->default_value(16), "parallel checks for --verify")
+            ("list,l", "list entries from index")
+            ("find,f", po::value<string>(&name), "show entry with given workspace name")
+            ("expired,e", "list entries expired at time given with --at")
+            ("at", po::value<long>(&at)->default_value(time(NULL)), "time for --expired, seconds since epoch")
+            ("username,u", po::value<string>(&user), "only entries of this user")
+    ;
+
+    try{
+        po::store(po::command_line_parser(argc, argv).options(cmd_options).run(), opt);
+        po::notify(opt);
+    } catch (...) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("help")) {
+        cout << "Usage: " << argv[0] << ": [options]" << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("version")) {
+#ifdef IS_GIT_REPOSITORY
+        cout << "workspace build from git commit hash " << GIT_COMMIT_HASH
+             << " on top of release " << WS_VERSION << endl;
+#else
+        cout << "workspace version " << WS_VERSION << endl;
+#endif
+        exit(1);
+    }
+
+    if (!opt.count("rebuild") && !opt.count("rebuild-queue") && !opt.count("rebuild-users") && !opt.count("shards") &&
+        !opt.count("verify") && !opt.count("list") && !opt.count("find") && !opt.count("expired")) {
+        cout << "Error: one of --rebuild, --rebuild-queue, --rebuild-users, --shards, --verify, --list, --find or --expired is required." << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("find") && !opt.count("username")) {
+        cout << "Error: --find requires --username." << endl;
+        exit(1);
+    }
+
+    if (opt.count("quarantine") && !opt.count("verify")) {
+        cout << "Error: --quarantine requires --verify." << endl;
+        exit(1);
+    }
+
+    if (opt.count("rebuild-queue") && opt.count("deleted")) {
+        cout << "Error: deleted entries have no expiration queue." << endl;
+        exit(1);
+    }
+}
+
+
+void printrecord(WsIndex &index, const WsIndexRecord *r) {
+    cout << index.getstring(r->name) << " " << r->expiration << " " << r->extensions << " "
+         << index.getstring(r->workspace) << endl;
+}
+
+
+static int run(int argc, char **argv) {
+    po::variables_map opt;
+    vector<string> fslist;
+    string user, name;
+    long at;
+    int shards = 0;
+    int threads;
+    const WsConfig &config = WsConfig::get();
+
+    commandline(opt, fslist, user, name, at, shards, threads, argc, argv);
+
+    if (fslist.empty()) {
+        for(const FilesystemConfig &cfs: config.filesystems) {
+            fslist.push_back(cfs.name);
+        }
+    }
+
+    int ret = 0;
+    for (string fs: fslist) {
+        if (!config.getfs(fs)) {
+            cerr << "Error: no such filesystem " << fs << endl;
+            ret = 1;
+            continue;
+        }
+        string dbdir = config.fs(fs).database;
+        if (opt.count("deleted")) {
+            dbdir += "/" + config.fs(fs).deleted;
+        }
+
+        if (opt.count("shards")) {
+            if (getuid() != 0) {
+                cerr << "Error: you are not root." << endl;
+                exit(-1);
+            }
+            // the deleted entries are in a subdirectory of the DB directory, they get their own shards
+            string dbdir = config.fs(fs).database;
+            if (!WsShards::migrate(dbdir, shards, config.dbuid, config.dbgid) ||
+                !WsShards::migrate(dbdir + "/" + config.fs(fs).deleted, shards, config.dbuid, config.dbgid)) {
+                ret = 1;
+            }
+            continue;
+        }
+
+        if (opt.count("rebuild") || opt.count("rebuild-queue") || opt.count("rebuild-users")) {
+            if (getuid() != 0) {
+                cerr << "Error: you are not root." << endl;
+                exit(-1);
+            }
+            if (opt.count("rebuild") && !WsIndex::rebuild(dbdir, config.dbuid, config.dbgid)) {
+                ret = 1;
+            }
+            if (opt.count("rebuild-queue") && !WsExpiry::rebuild(dbdir, config.dbuid, config.dbgid)) {
+                ret = 1;
+            }
+            if (opt.count("rebuild-users") && !WsUsers::rebuild(dbdir, config.dbuid, config.dbgid)) {
+                ret = 1;
+            }
+            continue;
+        }
+
+        if (opt.count("verify")) {
+            if (opt.count("quarantine") && getuid() != 0) {
+                cerr << "Error: you are not root." << endl;
+                exit(-1);
+            }
+            long dangling;
+            string deleted = opt.count("deleted") ? config.fs(fs).deleted : "";
+            if (!WsVerify::verify(dbdir, deleted, threads, opt.count("quarantine"), config.dbuid, config.dbgid, dangling) ||
+                dangling > 0) {
+                ret = 1;
+            }
+            continue;
+        }
+
+        WsIndex index(dbdir);
+        if (!index.valid()) {
+            cerr << "Error: no valid index in " << dbdir << ", use --rebuild." << endl;
+            ret = 1;
+            continue;
+        }
+
+        if (opt.count("find")) {
+            const WsIndexRecord *r = index.find(user + "-" + name);
+            if (r) {
+                printrecord(index, r);
+            } else {
+                ret = 1;
+            }
+            continue;
+        }
+
+        for (const WsIndexRecord *r: index.entries()) {
+            if (user != "" && index.getowner(r) != user) continue;
+            if (opt.count("expired") && r->expiration > at) continue;
+            printrecord(index, r);
+        }
+    }
+
+    return ret;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
+}
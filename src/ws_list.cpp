@@ -0,0 +1,545 @@
+/*
+ *  workspace++
+ *
+ *  ws_list
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *
+ *  list workspaces for all or selected users sorted or unsorted
+ *  with different output formats, no privileges necessary.
+ *  Reads the binary index of a DB directory if there is one, the YAML entries otherwise.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <set>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+// Posix
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include <boost/program_options.hpp>
+
+#include "ws.h"
+#include "wsdb.h"
+#include "wsindex.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsconfig.h"
+#include "wsacl.h"
+#include "wsgroups.h"
+#include "wsoutput.h"
+#include "wserror.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+
+/*
+ * what is printed for one workspace, filled from a DB entry or an index record
+ */
+struct ListEntry {
+    string name;            // basename of DB entry
+    string filesystem;
+    string workspace;
+    long expiration;
+    long creation;
+    int extensions;
+    string acctcode;
+    int reminder;
+    string mailaddress;
+    string group;
+    string comment;
+    long released;
+};
+
+/*
+ * sort key of an entry, sorting works on these, the entry itself is only
+ * read when it is printed, unless it had to be read for the key
+ */
+struct SortKey {
+    double key;                     // ctime with fraction, like the python version
+    string path;                    // for sorting by name, like the python version
+    string name;
+    string filename;                // if read from YAML entries
+    WsIndex *index;                 // if read from index
+    const WsIndexRecord *record;
+    const string *filesystem;
+    shared_ptr<const ListEntry> entry;  // if read from YAML entries for the key
+};
+
+enum SortBy { SORT_NONE, SORT_NAME, SORT_CREATION, SORT_REMAINING };
+
+struct ListOptions {
+    bool admin;
+    bool groupws;
+    bool shortlist;
+    bool expired;
+    bool terse;
+    bool verbose;
+    bool revert;
+    SortBy sort;
+    string user;
+    string pattern;
+    WsOutput::Format format;
+    WsOutput *output;               // NULL for human readable output
+};
+
+
+// spaces of the listed filesystems, in config order, and the filesystem of each
+static vector<string> spaces;
+static map<string, string> space2fs;
+
+
+// like time.ctime of python
+static string pyctime(const long t) {
+    time_t tt = t;
+    char buf[64];
+    struct tm tm;
+    localtime_r(&tt, &tm);
+    strftime(buf, sizeof(buf), "%a %b %e %H:%M:%S %Y", &tm);
+    return buf;
+}
+
+static void printentry(const ListEntry &entry, const ListOptions &o) {
+    if (o.output) {
+        size_t dash = entry.name.find('-');
+        o.output->value(entry.name.substr(dash+1)).value(entry.name.substr(0, dash))
+                 .value(entry.filesystem).value(entry.workspace).value(entry.creation)
+                 .value(entry.expiration).value(entry.extensions).value(entry.acctcode)
+                 .value(entry.reminder).value(entry.mailaddress).value(entry.group)
+                 .value(entry.comment).value(entry.released).end();
+        return;
+    }
+    bool terse = o.verbose ? false : o.terse;
+    if (o.admin) {
+        cout << "id: " << entry.name << "\n";
+    } else {
+        cout << "id: " << entry.name.substr(entry.name.find('-')+1) << "\n";
+    }
+    cout << "     workspace directory  : " << entry.workspace << "\n";
+    cout << "     remaining time       : ";
+    long now = time(NULL);
+    if (now > entry.expiration) {
+        cout << "expired" << "\n";
+    } else {
+        long remaining = entry.expiration - now;
+        cout << remaining/(24*3600) << " days " << (remaining%(24*3600))/3600 << " hours" << "\n";
+    }
+    if (!terse) {
+        if (entry.comment != "") {
+            cout << "     comment              : " << entry.comment << "\n";
+        }
+        cout << "     creation time        : " << pyctime(entry.creation) << "\n";
+        cout << "     expiration date      : " << pyctime(entry.expiration) << "\n";
+        for (const string &s: spaces) {
+            if (entry.workspace.compare(0, s.size(), s) == 0) {
+                cout << "     filesystem name      : " << space2fs[s] << "\n";
+            }
+        }
+    }
+    cout << "     available extensions : " << entry.extensions << "\n";
+    if (o.verbose) {
+        cout << "     acctcode             : " << entry.acctcode << "\n";
+        cout << "     reminder             : " << pyctime(entry.expiration - entry.reminder*(24*3600)) << "\n";
+        cout << "     mailaddress          : " << entry.mailaddress << "\n";
+    }
+}
+
+static void fromrecord(WsIndex &index, const WsIndexRecord *r, const string &filesystem, ListEntry &entry) {
+    entry.name = index.getstring(r->name);
+    entry.filesystem = filesystem;
+    entry.workspace = index.getstring(r->workspace);
+    entry.expiration = r->expiration;
+    entry.creation = r->creation;
+    entry.extensions = r->extensions;
+    entry.acctcode = index.getstring(r->acctcode);
+    entry.reminder = r->reminder;
+    entry.mailaddress = index.getstring(r->mailaddress);
+    entry.group = index.getstring(r->group);
+    entry.comment = index.getstring(r->comment);
+    entry.released = r->released;
+}
+
+// read a DB entry, false if it can not be listed
+static bool fromfile(const string filename, const string name, const string &filesystem, ListEntry &entry) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return false;
+    if (st.st_size == 0) {
+        cerr << "ws-db file is empty: " << filename << endl;
+        return false;
+    }
+    try {
+        WsDB db(filename, -1, -1);
+        entry.name = name;
+        entry.filesystem = filesystem;
+        entry.workspace = db.getwsdir();
+        entry.expiration = db.getexpiration();
+        entry.creation = st.st_ctime;
+        entry.extensions = db.getextension();
+        entry.acctcode = db.getacctcode();
+        entry.reminder = db.getreminder();
+        entry.mailaddress = db.getmailaddress();
+        entry.group = db.getgroup();
+        entry.comment = db.getcomment();
+        entry.released = db.getreleased();
+    } catch (...) {
+        cerr << "Error: could not read " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool ingroups(const string &group, const vector<string> &groupnames) {
+    return group != "" && find(groupnames.begin(), groupnames.end(), group) != groupnames.end();
+}
+
+/*
+ * list one DB directory, entries are printed as they are found if not sorted,
+ * otherwise only their keys are added to keys
+ */
+static void listdir(const string &filesystem, const string dbdir, const string username, const vector<string> &groupnames,
+                    const ListOptions &o, WsIndex &index, vector<SortKey> &keys) {
+    // the entries a user may see, like the glob patterns of the python version
+    string owner = (o.admin && o.user != "") ? o.user : username;
+    bool anyowner = (o.admin && o.user == "") || (!o.admin && o.groupws);
+    string pattern = (anyowner ? string("*") : owner) + "-" + o.pattern;
+    ListEntry entry;
+
+    // one entry read from its file, dbdir/name is its name for sorting
+    auto fromentry = [&](const string &name, const string &filename) {
+        if (o.groupws && name.compare(0, username.size()+1, username + "-") != 0) {
+            // group workspaces have the x-bit set
+            struct stat st;
+            if (stat(filename.c_str(), &st) != 0 || !(st.st_mode & S_IXUSR)) return;
+            try {
+                WsDB db(filename, -1, -1);
+                if (!ingroups(db.getgroup(), groupnames)) return;
+            } catch (...) {
+                return;
+            }
+        }
+        if (o.shortlist) {
+            cout << name.substr(name.find('-')+1) << "\n";
+        } else if (o.sort == SORT_NAME || o.sort == SORT_CREATION) {
+            SortKey k = { 0, dbdir + "/" + name, name, filename, NULL, NULL, &filesystem };
+            struct stat st;
+            if (o.sort == SORT_CREATION) {
+                if (stat(filename.c_str(), &st) != 0) return;
+                k.key = st.st_ctim.tv_sec + st.st_ctim.tv_nsec * 1e-9;
+            }
+            keys.push_back(k);
+        } else if (fromfile(filename, name, filesystem, entry)) {
+            if (o.sort == SORT_REMAINING) {
+                SortKey k = { (double)entry.expiration, dbdir + "/" + name, name, filename, NULL, NULL, &filesystem,
+                              make_shared<const ListEntry>(entry) };
+                keys.push_back(k);
+            } else {
+                printentry(entry, o);
+            }
+        }
+    };
+
+    // the manifest of the owner has exactly the entries to read
+    if (!anyowner && WsUsers::exists(dbdir)) {
+        for (const string &name: WsUsers::entries(dbdir, owner)) {
+            if (fnmatch(pattern.c_str(), name.c_str(), FNM_PERIOD) != 0) continue;
+            fromentry(name, WsShards::locate(dbdir + "/" + name));
+        }
+        return;
+    }
+
+    if (index.valid()) {
+        for (const WsIndexRecord *r: index.entries()) {
+            if (!anyowner && r->ownerlength != owner.size()) continue;
+            string name = index.getstring(r->name);
+            if (fnmatch(pattern.c_str(), name.c_str(), FNM_PERIOD) != 0) continue;
+            // foreign entries only for group workspaces of our groups
+            if (o.groupws && name.compare(0, username.size()+1, username + "-") != 0
+                    && !ingroups(index.getstring(r->group), groupnames)) {
+                continue;
+            }
+            if (o.shortlist) {
+                cout << name.substr(name.find('-')+1) << "\n";
+            } else if (o.sort != SORT_NONE) {
+                SortKey k = { 0, dbdir + "/" + name, name, "", &index, r, &filesystem };
+                if (o.sort == SORT_CREATION) k.key = r->creation;
+                if (o.sort == SORT_REMAINING) k.key = r->expiration;
+                keys.push_back(k);
+            } else {
+                fromrecord(index, r, filesystem, entry);
+                printentry(entry, o);
+            }
+        }
+        return;
+    }
+
+    // the shard of the owner is enough, unless entries of all users are listed
+    vector<string> dirs = WsShards::dirs(dbdir, anyowner ? "" : owner);
+    // an entry moved by a migration while listing can be seen twice
+    set<string> seen;
+    for (const string &d: dirs) {
+        DIR *dir = opendir(d.c_str());
+        if (dir == NULL) continue;
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            string name = de->d_name;
+            if (fnmatch(pattern.c_str(), name.c_str(), FNM_PERIOD) != 0) continue;
+            if (dirs.size() > 1 && !seen.insert(name).second) continue;
+            fromentry(name, d + "/" + name);
+        }
+        closedir(dir);
+    }
+}
+
+
+void commandline(po::variables_map &opt, ListOptions &o, bool &fslist, string &filesystem, int argc, char**argv) {
+    string format;
+    po::options_description cmd_options( "\nOptions" );
+    cmd_options.add_options()
+            ("help,h", "produce help message")
+            ("version,V", "show version")
+            ("filesystem,F", po::value<string>(&filesystem), "filesystem to list workspaces from")
+            ("group,g", "also list group workspaces")
+            ("listfilesystems,l", "list available filesystems")
+            ("short,s", "only show names of workspaces")
+            ("sort-name,N", "sort by name")
+            ("sort-creation,C", "sort by creation")
+            ("sort-remaining,R", "sort by remaining time")
+            ("reverted,r", "revert sorting order")
+            ("terse,t", "terse output format")
+            ("verbose,v", "verbose output format")
+            ("format", po::value<string>(&format)->default_value("human"),
+                    "human, jsonl or csv, jsonl and csv have all fields and times in seconds since epoch")
+            ("all,a", "for compatibility")
+    ;
+    po::options_description admin_options( "\nAdmin options" );
+    admin_options.add_options()
+            ("user,u", po::value<string>(&o.user), "only show workspaces of selected user")
+            ("expired,e", "show expired workspaces, can be combined with -F and -u to reduce output")
+    ;
+    po::options_description secret_options("Secret");
+    secret_options.add_options()
+            ("pattern", po::value<string>(&o.pattern), "pattern to match workspace names")
+            ("acl", "print the filesystems the ACLs let the user list, one per line, for the scripts")
+    ;
+    po::positional_options_description p;
+    p.add("pattern", 1);
+
+    po::options_description all_options;
+    all_options.add(cmd_options).add(secret_options);
+    if (o.admin) {
+        cmd_options.add(admin_options);
+        all_options.add(admin_options);
+    }
+
+    try{
+        po::store(po::command_line_parser(argc, argv).options(all_options).positional(p).run(), opt);
+        po::notify(opt);
+    } catch (...) {
+        cout << "Usage: " << argv[0] << ": [options] [pattern]" << endl;
+        cout << cmd_options << "\n";
+        exit(1);
+    }
+
+    if (opt.count("help")) {
+        cout << "Usage: " << argv[0] << ": [options] [pattern]" << endl;
+        cout << cmd_options << "\n";
+        exit(0);
+    }
+
+    if (opt.count("version")) {
+#ifdef IS_GIT_REPOSITORY
+        cout << "workspace build from git commit hash " << GIT_COMMIT_HASH
+             << " on top of release " << WS_VERSION << endl;
+#else
+        cout << "workspace version " << WS_VERSION << endl;
+#endif
+        exit(1);
+    }
+
+    o.groupws = opt.count("group") > 0;
+    o.shortlist = opt.count("short") > 0;
+    o.expired = opt.count("expired") > 0;
+    o.terse = opt.count("terse") > 0;
+    o.verbose = opt.count("verbose") > 0;
+    o.revert = opt.count("reverted") > 0;
+    fslist = opt.count("listfilesystems") > 0;
+    if (!WsOutput::parseformat(format, o.format)) {
+        cerr << "Error: unknown output format " << format << endl;
+        exit(1);
+    }
+    // machine readable records are always complete
+    if (o.format != WsOutput::HUMAN) o.shortlist = false;
+    if (o.pattern == "") o.pattern = "*";
+
+    // as in the python version, the last of -N -C -R wins
+    o.sort = SORT_NONE;
+    if (opt.count("sort-name")) o.sort = SORT_NAME;
+    if (opt.count("sort-creation")) o.sort = SORT_CREATION;
+    if (opt.count("sort-remaining")) o.sort = SORT_REMAINING;
+}
+
+
+static int run(int argc, char **argv) {
+    po::variables_map opt;
+    ListOptions o;
+    bool listfs;
+    string filesystem;
+
+    const WsConfig &config = WsConfig::get();
+
+    string username = Workspace::getusername();
+    string primarygroup;
+    if (!WsGroups::getgroupname(getgid(), primarygroup)) {
+        cerr << "Error: user has no group anymore!" << endl;
+        exit(-1);
+    }
+    const vector<string> &groupnames = WsGroups::getgroupnames(username, getgid());
+
+    // root is always admin, seeing admin options and admin output
+    o.admin = find(config.admins.begin(), config.admins.end(), username) != config.admins.end()
+              || getuid() == 0 || geteuid() == 0;
+
+    commandline(opt, o, listfs, filesystem, argc, argv);
+
+    vector<string> fsnames;
+    if (filesystem != "") {
+        if (!config.getfs(filesystem)) {
+            cerr << "Error: no such filesystem." << endl;
+            exit(-1);
+        }
+        fsnames.push_back(filesystem);
+    } else {
+        for (const FilesystemConfig &cfs: config.filesystems) {
+            fsnames.push_back(cfs.name);
+        }
+    }
+
+    // reduce list to allowed filesystems, admin can see workspaces from anywhere
+    vector<string> legal;
+    vector<string> listable = WsAcl::get().listable(username, primarygroup, groupnames);
+
+    // the python tools ask here instead of evaluating the ACLs themselves
+    if (opt.count("acl")) {
+        for (const string &fs: listable) {
+            cout << fs << endl;
+        }
+        exit(0);
+    }
+    for (const string &fs: fsnames) {
+        if (o.admin || find(listable.begin(), listable.end(), fs) != listable.end()) {
+            legal.push_back(fs);
+        }
+    }
+
+    if (listfs) {
+        cout << "available filesystems:" << endl;
+        string mydefault;
+        for (const string &fs: legal) {
+            const FilesystemConfig &cfs = config.fs(fs);
+            if (find(cfs.userdefault.begin(), cfs.userdefault.end(), username) != cfs.userdefault.end() ||
+                find(cfs.groupdefault.begin(), cfs.groupdefault.end(), primarygroup) != cfs.groupdefault.end()) {
+                mydefault = fs;
+            }
+        }
+        if (mydefault == "") mydefault = config.defaultfs;
+        for (const string &fs: legal) {
+            cout << fs << (fs == mydefault ? " (default)" : "") << endl;
+        }
+        exit(0);
+    }
+
+    for (const string &fs: legal) {
+        for (const string &s: config.fs(fs).spaces) {
+            space2fs[s] = fs;
+            spaces.push_back(s);
+        }
+    }
+
+    o.output = NULL;
+    if (o.format != WsOutput::HUMAN) {
+        o.output = new WsOutput(cout, o.format, {"name", "user", "filesystem", "workspace", "creation",
+                                "expiration", "extensions", "acctcode", "reminder", "mailaddress",
+                                "group", "comment", "released"});
+    }
+
+    // list workspaces, the normal case. indexes stay mapped until sorted keys are printed
+    vector<SortKey> keys;
+    vector<WsIndex*> indexes;
+    for (const string &fs: legal) {
+        string dbdir = config.fs(fs).database;
+        if (o.admin && o.expired) {
+            dbdir += "/" + config.fs(fs).deleted;
+        }
+        WsIndex *index = new WsIndex(dbdir);
+        indexes.push_back(index);
+        listdir(fs, dbdir, username, groupnames, o, *index, keys);
+    }
+
+    if (o.sort != SORT_NONE) {
+        // stable, and equal keys keep their order also if reverted, like sorted() of python
+        if (o.sort == SORT_NAME) {
+            stable_sort(keys.begin(), keys.end(), [&](const SortKey &a, const SortKey &b) {
+                return o.revert ? a.path > b.path : a.path < b.path;
+            });
+        } else {
+            stable_sort(keys.begin(), keys.end(), [&](const SortKey &a, const SortKey &b) {
+                return o.revert ? a.key > b.key : a.key < b.key;
+            });
+        }
+        ListEntry entry;
+        for (const SortKey &k: keys) {
+            if (k.entry) {
+                printentry(*k.entry, o);
+                continue;
+            }
+            if (k.record) {
+                fromrecord(*k.index, k.record, *k.filesystem, entry);
+            } else if (!fromfile(k.filename, k.name, *k.filesystem, entry)) {
+                continue;
+            }
+            printentry(entry, o);
+        }
+    }
+
+    for (WsIndex *index: indexes) {
+        delete index;
+    }
+    delete o.output;
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
+}
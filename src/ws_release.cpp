@@ -53,6 +53,8 @@ const int CAP_CHOWN = 1;
 #endif
 
 #include "ws.h"
+#include "wsbroker.h"
+#include "wserror.h"
 
 namespace po = boost::program_options;
 using namespace std;
@@ -62,7 +64,7 @@ using namespace std;
  *  parse the commandline and see if all required arguments are passed, and check the workspace name for 
  *  bad characters
  */
-void commandline(po::variables_map &opt, string &name, int &duration, 
+static void commandline(po::variables_map &opt, string &name, int &duration, 
                     string &filesystem, bool &extension,  int argc, char**argv) {
     // define all options
 
@@ -154,7 +156,7 @@ void commandline(po::variables_map &opt, string &name, int &duration,
  *  main logic here
  */
 
-int main(int argc, char **argv) {
+static int run(int argc, char **argv) {
     int duration;
     bool extensionflag;
     string name;
@@ -162,7 +164,7 @@ int main(int argc, char **argv) {
     string acctcode, wsdir;
     string mailaddress;
     po::variables_map opt;
-    YAML::Node config, userconfig;
+    YAML::Node userconfig;
 
     // we only support C locale, if the used local is not installed on the system
     // ws_release fails
@@ -173,15 +175,9 @@ int main(int argc, char **argv) {
     std::locale::global(std::locale("C"));
 	
     // read config
-    try {
-        config = YAML::LoadFile("/etc/ws.conf");
-    } catch (const YAML::BadFile& e) {
-        cerr << "Error: Could not read config file!" << endl;
-        cerr << e.what() << endl;
-        exit(-1);
-    }
+    const WsConfig &config = WsConfig::get();
 
-    int db_uid = config["dbuid"].as<int>();
+    int db_uid = config.dbuid;
 
     // lower capabilities to minimum
     Workspace::drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, db_uid);
@@ -196,7 +192,23 @@ int main(int argc, char **argv) {
     
     // release workspace
     ws.release(name);
-    
+
+    return 0;
+}
+
+// also run by ws_brokerd on behalf of the user
+int ws_release_main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
 }
 
 
+#ifndef WS_BROKERD
+int main(int argc, char **argv) {
+    // let a running ws_brokerd do the work, with hot config, ACLs and NSS lookups
+    int status;
+    if (WsBroker::forward("ws_release", argc, argv, status)) {
+        return status;
+    }
+    return ws_release_main(argc, argv);
+}
+#endif
@@ -40,6 +40,7 @@
 
 #include <iostream>
 #include <string>
+#include <set>
 #ifdef USE_BOOST_REGEXP
     #include <boost/regex.hpp>
     #define REGEX boost::regex
@@ -69,6 +70,12 @@ const int CAP_CHOWN = 1;
 
 #include "ws.h"
 #include "ruh.h"
+#include "wsacl.h"
+#include "wsgroups.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsoutput.h"
+#include "wserror.h"
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -77,7 +84,9 @@ using boost::lexical_cast;
 
 
 void commandline(po::variables_map &opt, string &name, string &target,
-                    string &filesystem, bool &listflag, bool &terse, string &username,  int argc, char**argv) {
+                    string &filesystem, bool &listflag, bool &terse, string &username,
+                    WsOutput::Format &format, int argc, char**argv) {
+    string formatname;
     // define all options
 
     po::options_description cmd_options( "\nOptions" );
@@ -90,6 +99,8 @@ void commandline(po::variables_map &opt, string &name, string &target,
             ("target,t", po::value<string>(&target), "existing target workspace name")
             ("filesystem,F", po::value<string>(&filesystem), "filesystem")
             ("username,u", po::value<string>(&username), "username")
+            ("format", po::value<string>(&formatname)->default_value("human"),
+                    "format of list, human, jsonl or csv, times in seconds since epoch")
     ;
 
     po::options_description secret_options("Secret");
@@ -146,6 +157,11 @@ void commandline(po::variables_map &opt, string &name, string &target,
         terse = false;
     }
 
+    if (!WsOutput::parseformat(formatname, format)) {
+        cerr << "Error: unknown output format " << formatname << endl;
+        exit(1);
+    }
+
     if (opt.count("name"))
     {
         if (!opt.count("target")) {
@@ -197,126 +213,74 @@ bool check_name(const string name, const string username, const string real_user
 std::vector<string> get_valid_fslist() {
   vector<string> fslist;
 
-  YAML::Node config;
   // read config
-  try {
-      config = YAML::LoadFile("/etc/ws.conf");
-  } catch (const YAML::BadFile& e) {
-      cerr << "Error: Could not read config file!" << endl;
-      cerr << e.what() << endl;
-      exit(-1);
-  }
+  const WsConfig &config = WsConfig::get();
 
   // get user name, group names etc
-  vector<string> groupnames;
-
   string username = Workspace::getusername(); // FIXME is this correct? what if username given on commandline?
 
-  struct group *grp;
-  int ngroups = 128;
-  gid_t gids[128];
-  int nrgroups;
+  const vector<string> &groupnames = WsGroups::getgroupnames(username, getgid());
   string primarygroup;
 
-  nrgroups = getgrouplist(username.c_str(), geteuid(), gids, &ngroups);
-  if(nrgroups<=0) {
-      cerr << "Error: user in too many groups!" << endl;
-  }
-  for(int i=0; i<nrgroups; i++) {
-      grp=getgrgid(gids[i]);
-      if(grp) groupnames.push_back(string(grp->gr_name));
-  }
   // get current group
-  grp=getgrgid(getegid());
-  if(grp==NULL) {
+  if (!WsGroups::getgroupname(getegid(), primarygroup)) {
       cerr << "Error: user has no group anymore!" << endl;
       exit(-1);
   }
-  primarygroup=string(grp->gr_name);
-
-  // iterate over all filesystems and search the ones allowed for current user
-  YAML::Node node = config["workspaces"];
-  for(YAML::const_iterator it = node.begin(); it!=node.end(); ++it ) {
-      std::string cfilesystem = it->first.as<std::string>();
-      // check ACLs
-      vector<string>user_acl;
-      vector<string>group_acl;
-
-      // read ACL lists
-      if ( config["workspaces"][cfilesystem]["user_acl"]) {
-          for(string v: config["workspaces"][cfilesystem]["user_acl"].as<vector<string> >())
-              user_acl.push_back(v);
-      }
-      if ( config["workspaces"][cfilesystem]["group_acl"]) {
-          for(string v: config["workspaces"][cfilesystem]["group_acl"].as<vector<string> >())
-              group_acl.push_back(v);
-      }
 
-      // check ACLs
-      bool userok=true;
-      if(user_acl.size()>0 || group_acl.size()>0) userok=false;
-
-      if( find(group_acl.begin(), group_acl.end(), primarygroup) != group_acl.end() ) {
-          userok=true;
-      }
-#ifdef CHECK_ALL_GROUPS
-      for(string grp: groupnames) {
-          if( find(group_acl.begin(), group_acl.end(), grp) != group_acl.end() ) {
-              userok=true;
-              break;
-          }
-      }
-#endif
-      if( find(user_acl.begin(), user_acl.end(), username) != user_acl.end() ) {
-          userok=true;
-      }
-      if(userok || getuid()==0) {
-          fslist.push_back(cfilesystem);
+  // root may use all filesystems
+  if(getuid()==0) {
+      for(const FilesystemConfig &cfs: config.filesystems) {
+          fslist.push_back(cfs.name);
       }
+      return fslist;
   }
-  return fslist;
+
+  // search the ones allowed for current user
+  return WsAcl::get().allowed(username, primarygroup, groupnames);
 }
 
 // get restorable workspaces as names
 vector<string> getRestorable(string filesystem, string username)
 {
-    YAML::Node config;
     // read config
-    try {
-        config = YAML::LoadFile("/etc/ws.conf");
-    } catch (const YAML::BadFile& e) {
-        cerr << "Error: Could not read config file!" << endl;
-        cerr << e.what() << endl;
-        exit(-1);
-    }
+    const WsConfig &config = WsConfig::get();
+
+    string dbprefix = config.fs(filesystem).database + "/" + config.fs(filesystem).deleted;
 
-    string dbprefix = config["workspaces"][filesystem]["database"].as<string>() + "/" +
-                      config["workspaces"][filesystem]["deleted"].as<string>();
+    // only the entries of the user, if there are manifests
+    if (WsUsers::exists(dbprefix)) {
+        return WsUsers::entries(dbprefix, username);
+    }
 
     vector<string> namelist;
+    set<string> seen;
 
-    fs::directory_iterator end;
-    for (fs::directory_iterator it(dbprefix); it!=end; ++it) {
+    // the flat directory and the shard of the user, if the directory is sharded
+    for (const string &dir: WsShards::dirs(dbprefix, username)) {
+        fs::directory_iterator end;
+        for (fs::directory_iterator it(dir); it!=end; ++it) {
 #if BOOST_VERSION < 105000
-        if (boost::starts_with(it->path().filename(), username + "-" )) {
-            namelist.push_back(it->path().filename());
-        }
+            string name = it->path().filename();
 #else
-        if (boost::starts_with(it->path().filename().string(), username + "-" )) {
-            namelist.push_back(it->path().filename().string());
-        }
+            string name = it->path().filename().string();
 #endif
+            if (boost::starts_with(name, username + "-") && seen.insert(name).second) {
+                namelist.push_back(name);
+            }
+        }
     }
 
     return namelist;
 }
 
-int main(int argc, char **argv) {
+static int run(int argc, char **argv) {
     po::variables_map opt;
     string name, target, filesystem, acctcode, username;
     bool listflag, terse;
+    WsOutput::Format format;
     int duration=0;
-    YAML::Node config, userconfig;
+    YAML::Node userconfig;
 
     // we only support C locale, if the used local is not installed on the system
     // ws_restore fails
@@ -327,29 +291,27 @@ int main(int argc, char **argv) {
 	std::locale::global(std::locale("C"));
 
     // read config
-    try {
-        config = YAML::LoadFile("/etc/ws.conf");
-    } catch (const YAML::BadFile& e) {
-        cerr << "Error: Could not read config file!" << endl;
-        cerr << e.what() << endl;
-        exit(-1);
-    }
+    const WsConfig &config = WsConfig::get();
 
-    int db_uid = config["dbuid"].as<int>();
+    int db_uid = config.dbuid;
 
     // lower capabilities to minimum
     Workspace::drop_cap(CAP_DAC_OVERRIDE, CAP_CHOWN, db_uid);
 
 
     // check commandline, get flags which are used to create ws object or for workspace allocation
-    commandline(opt, name, target, filesystem, listflag, terse, username, argc, argv);
+    commandline(opt, name, target, filesystem, listflag, terse, username, format, argc, argv);
 
     openlog("ws_restore", 0, LOG_USER); // SYSLOG
 
     if (listflag) {
-        
+        WsOutput *output = NULL;
+        if (format != WsOutput::HUMAN) {
+            output = new WsOutput(cout, format, {"name", "user", "filesystem", "unavailable"});
+        }
+
         for(string fs: get_valid_fslist()) {
-            std::cout << fs << ":" << std::endl;
+            if (!output) std::cout << fs << ":" << std::endl;
 
             // construct db-entry username  name
             string real_username = Workspace::getusername();
@@ -363,16 +325,21 @@ int main(int argc, char **argv) {
                 }
             }
             for(string dn: getRestorable(fs, username)) {
+                std::vector<std::string> splitted;
+                boost::split(splitted, dn, boost::is_any_of("-"));
+                time_t t = atol(splitted[splitted.size()-1].c_str());
+                if (output) {
+                    output->value(dn).value(username).value(fs).value((long)t).end();
+                    continue;
+                }
                 cout << dn << endl;
                 if (!terse) {
-                    std::vector<std::string> splitted;
-                    boost::split(splitted, dn, boost::is_any_of("-"));
-                    time_t t = atol(splitted[splitted.size()-1].c_str());
                     cout << "\tunavailable since " << std::ctime(&t);
                 }
             }
 
         }
+        delete output;
 
     } else {
         // get workspace object
@@ -397,4 +364,10 @@ int main(int argc, char **argv) {
             }
         }
     }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
 }
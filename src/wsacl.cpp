@@ -0,0 +1,138 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+
+#include "wsacl.h"
+
+using namespace std;
+
+
+WsAcl::WsAcl(const WsConfig &_config)
+    : config(_config)
+{
+    for (size_t i=0; i<config.filesystems.size(); i++) {
+        const FilesystemConfig &cfs = config.filesystems[i];
+        fsindex[cfs.name] = i;
+        hasacl.push_back(cfs.user_acl.size()>0 || cfs.group_acl.size()>0);
+        for (const string &u: cfs.user_acl) {
+            vector<size_t> &l = userfs[u];
+            if (l.empty() || l.back() != i) l.push_back(i);
+        }
+        for (const string &g: cfs.group_acl) {
+            vector<size_t> &l = groupfs[g];
+            if (l.empty() || l.back() != i) l.push_back(i);
+        }
+    }
+}
+
+/*
+ * mark all filesystems listing name as granted, keeping an earlier reason
+ */
+void WsAcl::grant(vector<AclMatch> &result, const unordered_map<string, vector<size_t> > &table,
+                  const string &name, AclMatch match) const {
+    auto it = table.find(name);
+    if (it == table.end()) return;
+    for (size_t i: it->second) {
+        if (result[i] == ACL_DENIED) result[i] = match;
+    }
+}
+
+vector<AclMatch> WsAcl::checkall(const string &username, const string &primarygroup,
+                                 const vector<string> &groupnames) const {
+    vector<AclMatch> result(hasacl.size(), ACL_DENIED);
+    for (size_t i=0; i<hasacl.size(); i++) {
+        if (!hasacl[i]) result[i] = ACL_NOACL;
+    }
+    grant(result, groupfs, primarygroup, ACL_PRIMARYGROUP);
+#ifdef CHECK_ALL_GROUPS
+    for (const string &grp: groupnames) {
+        grant(result, groupfs, grp, ACL_SECONDARYGROUP);
+    }
+#endif
+    grant(result, userfs, username, ACL_USER);
+    return result;
+}
+
+AclMatch WsAcl::check(const string &filesystem, const string &username, const string &primarygroup,
+                      const vector<string> &groupnames) const {
+    auto fs = fsindex.find(filesystem);
+    if (fs == fsindex.end()) return ACL_DENIED;
+    size_t i = fs->second;
+    if (!hasacl[i]) return ACL_NOACL;
+
+    auto it = groupfs.find(primarygroup);
+    if (it != groupfs.end() && binary_search(it->second.begin(), it->second.end(), i)) {
+        return ACL_PRIMARYGROUP;
+    }
+#ifdef CHECK_ALL_GROUPS
+    for (const string &grp: groupnames) {
+        it = groupfs.find(grp);
+        if (it != groupfs.end() && binary_search(it->second.begin(), it->second.end(), i)) {
+            return ACL_SECONDARYGROUP;
+        }
+    }
+#endif
+    it = userfs.find(username);
+    if (it != userfs.end() && binary_search(it->second.begin(), it->second.end(), i)) {
+        return ACL_USER;
+    }
+    return ACL_DENIED;
+}
+
+vector<string> WsAcl::allowed(const string &username, const string &primarygroup,
+                              const vector<string> &groupnames) const {
+    vector<string> fslist;
+    vector<AclMatch> result = checkall(username, primarygroup, groupnames);
+    for (size_t i=0; i<result.size(); i++) {
+        if (result[i] != ACL_DENIED) fslist.push_back(config.filesystems[i].name);
+    }
+    return fslist;
+}
+
+vector<string> WsAcl::listable(const string &username, const string &primarygroup,
+                               const vector<string> &groupnames) const {
+    vector<string> fslist;
+    vector<AclMatch> result(hasacl.size(), ACL_DENIED);
+    for (size_t i=0; i<hasacl.size(); i++) {
+        if (!hasacl[i]) result[i] = ACL_NOACL;
+    }
+    grant(result, groupfs, primarygroup, ACL_PRIMARYGROUP);
+    for (const string &grp: groupnames) {
+        grant(result, groupfs, grp, ACL_SECONDARYGROUP);
+    }
+    grant(result, userfs, username, ACL_USER);
+    for (size_t i=0; i<result.size(); i++) {
+        if (result[i] != ACL_DENIED) fslist.push_back(config.filesystems[i].name);
+    }
+    return fslist;
+}
+
+const WsAcl& WsAcl::get() {
+    static WsAcl acl(WsConfig::get());
+    return acl;
+}
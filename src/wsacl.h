@@ -0,0 +1,94 @@
+#ifndef WSACL_H
+#define WSACL_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "wsconfig.h"
+
+using namespace std;
+
+/*
+ * result of an ACL check, reason for access or denial
+ */
+enum AclMatch {
+    ACL_DENIED = 0,         // ACLs exist and nothing matched
+    ACL_NOACL,              // filesystem has no ACLs, open for everybody
+    ACL_PRIMARYGROUP,       // primary group in group_acl
+    ACL_SECONDARYGROUP,     // secondary group in group_acl (CHECK_ALL_GROUPS only)
+    ACL_USER                // user in user_acl
+};
+
+/*
+ * user_acl and group_acl of all filesystems, compiled into hash tables
+ *
+ * the tables map user and group names to the filesystems listing them, so
+ * checking a user against all filesystems costs one lookup per name instead of
+ * a search of each ACL for each group of the user.
+ */
+class WsAcl {
+
+private:
+    const WsConfig &config;
+    vector<bool> hasacl;                                    // per filesystem, in config order
+    unordered_map<string, vector<size_t> > userfs;          // user -> filesystems with user in user_acl
+    unordered_map<string, vector<size_t> > groupfs;         // group -> filesystems with group in group_acl
+    unordered_map<string, size_t> fsindex;
+
+    void grant(vector<AclMatch> &result, const unordered_map<string, vector<size_t> > &table,
+               const string &name, AclMatch match) const;
+
+public:
+    WsAcl(const WsConfig &_config);
+
+    // check all filesystems in one pass, result is in config order
+    vector<AclMatch> checkall(const string &username, const string &primarygroup,
+                              const vector<string> &groupnames) const;
+
+    // check one filesystem, ACL_DENIED for unknown filesystems
+    AclMatch check(const string &filesystem, const string &username, const string &primarygroup,
+                   const vector<string> &groupnames) const;
+
+    // names of filesystems the user may use, in config order
+    vector<string> allowed(const string &username, const string &primarygroup,
+                           const vector<string> &groupnames) const;
+
+    // names of filesystems the user may list workspaces of, in config order,
+    // unlike allowed() any group of the user matches group_acl
+    vector<string> listable(const string &username, const string &primarygroup,
+                            const vector<string> &groupnames) const;
+
+    // ACLs of the config of this process
+    static const WsAcl& get();
+};
+
+#endif
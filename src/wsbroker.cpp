@@ -0,0 +1,232 @@
+/*
+ *  workspace++
+ *
+ *  wsbroker
+ *
+ *  request protocol of ws_brokerd, client and server side
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "wsbroker.h"
+
+using namespace std;
+
+static const uint32_t WS_BROKERMAGIC = 0x57534231;     // "WSB1"
+static const uint32_t WS_BROKERMAXREQUEST = 1024*1024;
+// answer instead of an exit status, which is 0 to 255
+static const int32_t WS_BROKERBUSY = -1;
+
+
+static bool readall(const int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool writeall(const int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+bool WsBroker::forward(const string &tool, const int argc, char **argv, int &status) {
+    struct stat st;
+    if (lstat(WS_BROKERSOCKET, &st) || !S_ISSOCK(st.st_mode) || st.st_uid != 0) {
+        return false;
+    }
+
+    string payload = tool;
+    payload += '\0';
+    for (int i=0; i<argc; i++) {
+        payload += argv[i];
+        payload += '\0';
+    }
+    if (payload.size() > WS_BROKERMAXREQUEST) {
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(WS_BROKERSOCKET) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, WS_BROKERSOCKET);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0) {
+        return false;
+    }
+
+    // connect as the user, the broker takes the identity from SO_PEERCRED
+    uid_t euid = geteuid();
+    gid_t egid = getegid();
+    if (setegid(getgid()) || seteuid(getuid())) {
+        close(conn);
+        return false;
+    }
+    bool connected = connect(conn, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (seteuid(euid) || setegid(egid)) {
+        cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
+        exit(-1);
+    }
+    if (!connected) {
+        close(conn);
+        return false;
+    }
+
+    // header with the standard descriptors and the working directory, then the payload
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0) {
+        cwd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    uint32_t header[2] = {WS_BROKERMAGIC, (uint32_t)payload.size()};
+    int fds[4] = {0, 1, 2, cwd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {header, sizeof(header)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    bool sent = sendmsg(conn, &msg, MSG_NOSIGNAL) == sizeof(header) && writeall(conn, payload.data(), payload.size());
+    close(cwd);
+    if (!sent) {
+        // incomplete requests are dropped by the broker
+        close(conn);
+        return false;
+    }
+
+    int32_t result;
+    if (!readall(conn, (char *)&result, sizeof(result))) {
+        cerr << "Error: lost connection to ws_brokerd, " << tool << " may or may not have completed." << endl;
+        result = 1;
+    }
+    close(conn);
+    if (result == WS_BROKERBUSY) {
+        return false;
+    }
+    status = result;
+    return true;
+}
+
+
+bool WsBroker::receive(const int conn, string &tool, vector<string> &argv, int fds[4]) {
+    uint32_t header[2];
+    char control[CMSG_SPACE(4*sizeof(int))];
+    struct iovec iov = {header, sizeof(header)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+
+    // take the descriptors first, so they are closed on all errors
+    int nfds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), min(nfds, 4) * sizeof(int));
+        }
+    }
+    bool ok = nfds == 4 && !(msg.msg_flags & MSG_CTRUNC);
+    if (!ok) {
+        for (int i=0; i<min(nfds, 4); i++) close(fds[i]);
+        return false;
+    }
+
+    if (n < (ssize_t)sizeof(header) && !readall(conn, (char *)header + n, sizeof(header) - n)) {
+        ok = false;
+    }
+    if (ok && (header[0] != WS_BROKERMAGIC || header[1] == 0 || header[1] > WS_BROKERMAXREQUEST)) {
+        ok = false;
+    }
+    vector<char> payload;
+    if (ok) {
+        payload.resize(header[1]);
+        ok = readall(conn, payload.data(), payload.size()) && payload.back() == '\0';
+    }
+    if (!ok) {
+        for (int i=0; i<4; i++) close(fds[i]);
+        return false;
+    }
+
+    const char *p = payload.data(), *end = p + payload.size();
+    tool = p;
+    p += tool.size() + 1;
+    argv.clear();
+    while (p < end) {
+        argv.push_back(p);
+        p += argv.back().size() + 1;
+    }
+    return true;
+}
+
+
+void WsBroker::reply(const int conn, const int status) {
+    int32_t result = status;
+    writeall(conn, (const char *)&result, sizeof(result));
+}
+
+void WsBroker::busy(const int conn) {
+    reply(conn, WS_BROKERBUSY);
+}
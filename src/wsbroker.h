@@ -0,0 +1,77 @@
+#ifndef WSBROKER_H
+#define WSBROKER_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+using namespace std;
+
+// socket of ws_brokerd, clients use it only if it is a socket owned by root
+#ifndef WS_BROKERSOCKET
+#define WS_BROKERSOCKET "/run/ws_brokerd.sock"
+#endif
+
+/*
+ * protocol between ws_allocate/ws_release and ws_brokerd
+ *
+ * the client connects with the real uid and gid as effective ids, so the broker
+ * gets the identity of the user from SO_PEERCRED, and sends one request:
+ *   header (magic, length of payload) with stdin, stdout, stderr and the working
+ *   directory as SCM_RIGHTS
+ *   payload: tool name and argv, each terminated by a NUL
+ * the broker runs the tool in a process with the credentials the setuid tool
+ * would have, writing to the passed descriptors, and answers with the exit
+ * status as int32. A client that could not deliver a complete request runs
+ * the tool in process, as does a client the broker answers with busy() when
+ * it runs as many requests as it may.
+ */
+class WsBroker {
+
+public:
+    // run tool by the broker, false if no broker is available, status is the exit status
+    static bool forward(const string &tool, const int argc, char **argv, int &status);
+
+    // read a request from conn, fds gets the 4 passed descriptors, false on bad request
+    static bool receive(const int conn, string &tool, vector<string> &argv, int fds[4]);
+
+    // send exit status of a request
+    static void reply(const int conn, const int status);
+
+    // refuse a request without reading it, the client runs the tool itself
+    static void busy(const int conn);
+};
+
+// main functions of the brokered tools, ws_allocate.cpp and ws_release.cpp
+// are compiled with WS_BROKERD for ws_brokerd, which omits their main
+int ws_allocate_main(int argc, char **argv);
+int ws_release_main(int argc, char **argv);
+
+#endif
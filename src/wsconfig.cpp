@@ -0,0 +1,419 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+// YAML
+#include <yaml-cpp/yaml.h>
+
+#include "wsconfig.h"
+#include "wserror.h"
+
+using namespace std;
+
+// bump if layout of cache changes
+static const uint32_t cache_version = 8;
+static const char cache_magic[8] = { 'W','S','C','O','N','F','\0','\0' };
+
+
+/*
+ * identity of the config file, the cache is valid as long as this is unchanged
+ */
+struct ConfigKey {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+};
+
+static void getkey(const struct stat &st, ConfigKey &key) {
+    memset(&key, 0, sizeof(key));
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+    key.mtime_sec = st.st_mtim.tv_sec;
+    key.mtime_nsec = st.st_mtim.tv_nsec;
+    key.ctime_sec = st.st_ctim.tv_sec;
+    key.ctime_nsec = st.st_ctim.tv_nsec;
+}
+
+
+/*
+ * simple serializer for the cache, the cache is only read by the same binary version
+ */
+class CacheWriter {
+public:
+    string buf;
+    void put(const void *p, size_t len) { buf.append((const char *)p, len); }
+    void putint(int32_t v) { put(&v, sizeof(v)); }
+    void putstring(const string &s) { putint(s.size()); put(s.data(), s.size()); }
+    void putlist(const vector<string> &l) {
+        putint(l.size());
+        for (const string &s: l) putstring(s);
+    }
+};
+
+class CacheReader {
+private:
+    const string &buf;
+    size_t pos;
+public:
+    bool ok;
+    CacheReader(const string &_buf) : buf(_buf), pos(0), ok(true) {}
+    void get(void *p, size_t len) {
+        if (!ok || pos + len > buf.size()) {
+            ok = false;
+            memset(p, 0, len);
+            return;
+        }
+        memcpy(p, buf.data() + pos, len);
+        pos += len;
+    }
+    int32_t getint() { int32_t v; get(&v, sizeof(v)); return v; }
+    string getstring() {
+        int32_t len = getint();
+        if (!ok || len < 0 || pos + len > buf.size()) {
+            ok = false;
+            return "";
+        }
+        string s(buf.data() + pos, len);
+        pos += len;
+        return s;
+    }
+    vector<string> getlist() {
+        vector<string> l;
+        int32_t n = getint();
+        for (int32_t i=0; ok && i<n; i++) l.push_back(getstring());
+        return l;
+    }
+};
+
+
+static vector<string> getlist(const YAML::Node &node, const char *key) {
+    if (node[key] && !node[key].IsNull()) {
+        return node[key].as<vector<string> >();
+    }
+    return vector<string>();
+}
+
+
+WsConfig::WsConfig()
+    : duration(-1), durationdefault(1), reminderdefault(0), maxextensions(-1), dbuid(-1), dbgid(-1),
+      groupcachettl(0), dbsync(false)
+{
+}
+
+/*
+ * parse the YAML content of filename
+ */
+void WsConfig::parse(const string filename, const string &content) {
+    YAML::Node config;
+    try {
+        config = YAML::Load(content);
+    } catch (const YAML::Exception& e) {
+        throw WsError(-1, "invalid config file " + filename + ", check with ws_validate_config!\n" + e.what());
+    }
+
+    try {
+        clustername = config["clustername"].as<string>("");
+        smtphost = config["smtphost"].as<string>("");
+        mail_from = config["mail_from"].as<string>("");
+        defaultfs = config["default"].as<string>("");
+        duration = config["duration"].as<int>(-1);
+        durationdefault = config["durationdefault"].as<int>(1);
+        reminderdefault = config["reminderdefault"].as<int>(0);
+        maxextensions = config["maxextensions"].as<int>(-1);
+        dbuid = config["dbuid"].as<int>();
+        dbgid = config["dbgid"].as<int>();
+        groupcachettl = config["groupcachettl"].as<int>(0);
+        dbsync = config["dbsync"].as<bool>(false);
+        admins = getlist(config, "admins");
+
+        filesystems.clear();
+        YAML::Node node = config["workspaces"];
+        for(YAML::const_iterator it = node.begin(); it!=node.end(); ++it ) {
+            const YAML::Node &ws = it->second;
+            FilesystemConfig fs;
+            fs.name = it->first.as<string>();
+            fs.database = ws["database"].as<string>("");
+            fs.deleted = ws["deleted"].as<string>("");
+            fs.spaces = getlist(ws, "spaces");
+            fs.keeptime = ws["keeptime"].as<int>(0);
+            fs.deletethreads = ws["deletethreads"].as<int>(1);
+            fs.deleteopsrate = ws["deleteopsrate"].as<double>(0);
+            fs.deletebytesrate = ws["deletebytesrate"].as<double>(0);
+            fs.movethreads = ws["movethreads"].as<int>(1);
+            fs.probetimeout = ws["probetimeout"].as<int>(0);
+            fs.placement = ws["placement"].as<string>("random");
+            if (fs.placement != "random" && fs.placement != "capacity" && fs.placement != "lru" &&
+                fs.placement != "userhash") {
+                throw WsError(-1, "unknown placement " + fs.placement + " for workspace " + fs.name +
+                                  ", check with ws_validate_config!");
+            }
+            fs.maxfill = ws["maxfill"].as<int>(100);
+            fs.placementttl = ws["placementttl"].as<int>(60);
+            fs.duration = ws["duration"].as<int>(-1);
+            fs.maxextensions = ws["maxextensions"].as<int>(-1);
+            fs.user_acl = getlist(ws, "user_acl");
+            fs.group_acl = getlist(ws, "group_acl");
+            fs.userdefault = getlist(ws, "userdefault");
+            fs.groupdefault = getlist(ws, "groupdefault");
+            fs.allocatable = ws["allocatable"].as<bool>(true);
+            fs.extendable = ws["extendable"].as<bool>(true);
+            fs.restorable = ws["restorable"].as<bool>(true);
+            fs.prefix_callout = ws["prefix_callout"].as<string>("");
+            filesystems.push_back(fs);
+        }
+    } catch (const YAML::Exception& e) {
+        throw WsError(-1, "invalid config file " + filename + ", check with ws_validate_config!\n" + e.what());
+    }
+}
+
+void WsConfig::buildindex() {
+    fsindex.clear();
+    for (size_t i=0; i<filesystems.size(); i++) {
+        fsindex[filesystems[i].name] = i;
+    }
+}
+
+
+/*
+ * read cache if it is owned by root and matches the config file
+ */
+bool WsConfig::readcache(const ConfigKey &key, const string cachefile) {
+    ConfigKey cachedkey;
+
+    int fd = open(cachefile.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH)) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    string buf(st.st_size, '\0');
+    ssize_t r = read(fd, &buf[0], st.st_size);
+    close(fd);
+    if (r != st.st_size) return false;
+
+    CacheReader in(buf);
+    char magic[8];
+    in.get(magic, sizeof(magic));
+    if (!in.ok || memcmp(magic, cache_magic, sizeof(magic)) != 0) return false;
+    if ((uint32_t)in.getint() != cache_version) return false;
+    in.get(&cachedkey, sizeof(cachedkey));
+    if (!in.ok || memcmp(&key, &cachedkey, sizeof(key)) != 0) return false;
+
+    WsConfig c;
+    c.clustername = in.getstring();
+    c.smtphost = in.getstring();
+    c.mail_from = in.getstring();
+    c.defaultfs = in.getstring();
+    c.duration = in.getint();
+    c.durationdefault = in.getint();
+    c.reminderdefault = in.getint();
+    c.maxextensions = in.getint();
+    c.dbuid = in.getint();
+    c.dbgid = in.getint();
+    c.groupcachettl = in.getint();
+    c.dbsync = in.getint() != 0;
+    c.admins = in.getlist();
+    int32_t nfs = in.getint();
+    for (int32_t i=0; in.ok && i<nfs; i++) {
+        FilesystemConfig fs;
+        fs.name = in.getstring();
+        fs.database = in.getstring();
+        fs.deleted = in.getstring();
+        fs.spaces = in.getlist();
+        fs.keeptime = in.getint();
+        fs.deletethreads = in.getint();
+        in.get(&fs.deleteopsrate, sizeof(fs.deleteopsrate));
+        in.get(&fs.deletebytesrate, sizeof(fs.deletebytesrate));
+        fs.movethreads = in.getint();
+        fs.probetimeout = in.getint();
+        fs.placement = in.getstring();
+        fs.maxfill = in.getint();
+        fs.placementttl = in.getint();
+        fs.duration = in.getint();
+        fs.maxextensions = in.getint();
+        fs.user_acl = in.getlist();
+        fs.group_acl = in.getlist();
+        fs.userdefault = in.getlist();
+        fs.groupdefault = in.getlist();
+        fs.allocatable = in.getint();
+        fs.extendable = in.getint();
+        fs.restorable = in.getint();
+        fs.prefix_callout = in.getstring();
+        c.filesystems.push_back(fs);
+    }
+    if (!in.ok) return false;
+
+    *this = c;
+    return true;
+}
+
+/*
+ * write cache, only as root and into a directory owned by root
+ */
+void WsConfig::writecache(const ConfigKey &key, const string cachefile) {
+    if (geteuid() != 0) return;
+
+    string dir = cachefile.substr(0, cachefile.rfind('/'));
+    struct stat st;
+    if (dir.empty() || lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != 0 ||
+        (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        return;
+    }
+
+    CacheWriter out;
+    out.put(cache_magic, sizeof(cache_magic));
+    out.putint(cache_version);
+    out.put(&key, sizeof(key));
+    out.putstring(clustername);
+    out.putstring(smtphost);
+    out.putstring(mail_from);
+    out.putstring(defaultfs);
+    out.putint(duration);
+    out.putint(durationdefault);
+    out.putint(reminderdefault);
+    out.putint(maxextensions);
+    out.putint(dbuid);
+    out.putint(dbgid);
+    out.putint(groupcachettl);
+    out.putint(dbsync ? 1 : 0);
+    out.putlist(admins);
+    out.putint(filesystems.size());
+    for (const FilesystemConfig &fs: filesystems) {
+        out.putstring(fs.name);
+        out.putstring(fs.database);
+        out.putstring(fs.deleted);
+        out.putlist(fs.spaces);
+        out.putint(fs.keeptime);
+        out.putint(fs.deletethreads);
+        out.put(&fs.deleteopsrate, sizeof(fs.deleteopsrate));
+        out.put(&fs.deletebytesrate, sizeof(fs.deletebytesrate));
+        out.putint(fs.movethreads);
+        out.putint(fs.probetimeout);
+        out.putstring(fs.placement);
+        out.putint(fs.maxfill);
+        out.putint(fs.placementttl);
+        out.putint(fs.duration);
+        out.putint(fs.maxextensions);
+        out.putlist(fs.user_acl);
+        out.putlist(fs.group_acl);
+        out.putlist(fs.userdefault);
+        out.putlist(fs.groupdefault);
+        out.putint(fs.allocatable);
+        out.putint(fs.extendable);
+        out.putint(fs.restorable);
+        out.putstring(fs.prefix_callout);
+    }
+
+    // write to temporary file and rename, so readers never see a partial cache
+    // mkstemp, a file left by a crashed process with the same pid would block a fixed name
+    string tmpname = cachefile + ".XXXXXX";
+    int fd = mkstemp(&tmpname[0]);
+    if (fd < 0) return;
+    bool ok = write(fd, out.buf.data(), out.buf.size()) == (ssize_t)out.buf.size();
+    ok = (fchmod(fd, 0644) == 0) && ok;
+    close(fd);
+    if (!ok || rename(tmpname.c_str(), cachefile.c_str()) != 0) {
+        unlink(tmpname.c_str());
+    }
+}
+
+
+void WsConfig::load(const string filename, const string cachefile) {
+    // the key is taken from the file that is parsed, before it is read, so an
+    // edit in between gives a key the cache will not match next time
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        string error = strerror(errno);
+        if (fd >= 0) close(fd);
+        throw WsError(-1, "Could not read config file!\nbad file: " + filename + ": " + error);
+    }
+    ConfigKey key;
+    getkey(st, key);
+
+    if (!readcache(key, cachefile)) {
+        string content;
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) content.append(buf, n);
+        if (n < 0) {
+            string error = strerror(errno);
+            close(fd);
+            throw WsError(-1, "Could not read config file!\nbad file: " + filename + ": " + error);
+        }
+        close(fd);
+        parse(filename, content);
+        writecache(key, cachefile);
+    } else {
+        close(fd);
+    }
+    buildindex();
+}
+
+const FilesystemConfig* WsConfig::getfs(const string name) const {
+    auto it = fsindex.find(name);
+    if (it == fsindex.end()) return NULL;
+    return &filesystems[it->second];
+}
+
+const FilesystemConfig& WsConfig::fs(const string name) const {
+    const FilesystemConfig *f = getfs(name);
+    if (f == NULL) {
+        throw WsError(-1, "no such filesystem " + name + "!");
+    }
+    return *f;
+}
+
+const WsConfig& WsConfig::get() {
+    static WsConfig config;
+    static bool loaded = false;
+    if (!loaded) {
+        config.load(WS_CONFIGFILE, WS_CONFIGCACHE);
+        loaded = true;
+    }
+    return config;
+}
@@ -0,0 +1,125 @@
+#ifndef WSCONFIG_H
+#define WSCONFIG_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+#ifndef WS_CONFIGFILE
+#define WS_CONFIGFILE "/etc/ws.conf"
+#endif
+
+// the cache is only used if its directory exists and is owned by root
+#ifndef WS_CONFIGCACHE
+#define WS_CONFIGCACHE "/var/cache/workspace/ws.conf.cache"
+#endif
+
+/*
+ * config of one workspace filesystem, entry of "workspaces" in ws.conf
+ */
+struct FilesystemConfig {
+    string name;
+    string database;
+    string deleted;
+    vector<string> spaces;
+    int keeptime;
+    int deletethreads;              // threads used by ws_expirer to delete a workspace
+    double deleteopsrate;           // metadata operations per second for deletion, 0 is unlimited
+    double deletebytesrate;         // bytes per second for deletion, 0 is unlimited
+    int movethreads;                // threads used to copy a workspace if it can not be renamed
+    int probetimeout;               // ms to wait for the DB of this filesystem in ws_allocate, 0 waits forever
+    string placement;               // policy to choose a space for new workspaces, see WsPlacement
+    int maxfill;                    // percent, fuller spaces get no new workspaces, 100 disables
+    int placementttl;               // seconds the free space of a space is cached
+    int duration;                   // -1 if not set, global value applies
+    int maxextensions;              // -1 if not set, global value applies
+    vector<string> user_acl;
+    vector<string> group_acl;
+    vector<string> userdefault;
+    vector<string> groupdefault;
+    bool allocatable;
+    bool extendable;
+    bool restorable;
+    string prefix_callout;
+};
+
+/*
+ * compiled version of ws.conf, parsed once per process
+ *
+ * the binary cache holds the same data, it is keyed by device, inode, size and
+ * times of the config file, and written by root only, so setuid tools
+ * can skip YAML parsing as long as the config file is unchanged.
+ */
+struct ConfigKey;
+
+class WsConfig {
+
+private:
+    map<string, size_t> fsindex;
+
+    void parse(const string filename, const string &content);
+    bool readcache(const ConfigKey &key, const string cachefile);
+    void writecache(const ConfigKey &key, const string cachefile);
+    void buildindex();
+
+public:
+    string clustername;
+    string smtphost;
+    string mail_from;
+    string defaultfs;               // empty if no default
+    int duration;                   // -1 if not set
+    int durationdefault;
+    int reminderdefault;
+    int maxextensions;              // -1 if not set
+    int dbuid;
+    int dbgid;
+    int groupcachettl;              // seconds, 0 disables the group cache
+    bool dbsync;                    // fsync DB entries and their directory on each write
+    vector<string> admins;
+    vector<FilesystemConfig> filesystems;   // in order of config file
+
+    WsConfig();
+
+    // filesystem by name, NULL if not configured
+    const FilesystemConfig* getfs(const string name) const;
+
+    // filesystem by name, exits with error if not configured
+    const FilesystemConfig& fs(const string name) const;
+
+    // load config from filename, using cachefile if possible, exits on error
+    void load(const string filename, const string cachefile);
+
+    // config of this process, loaded on first call
+    static const WsConfig& get();
+};
+
+#endif
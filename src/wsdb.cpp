@@ -34,6 +34,9 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <set>
 
 // Posix
 #include <sys/types.h>
@@ -42,6 +45,9 @@
 #include <grp.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 
 // YAML
 #include <yaml-cpp/yaml.h>
@@ -59,7 +65,14 @@ const int CAP_CHOWN = 1;
 #endif
 
 #include "wsdb.h"
+#include "wsdirs.h"
+#include "wsindex.h"
+#include "wsexpiry.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wsconfig.h"
 #include "ws.h"
+#include "wserror.h"
 
 using namespace std;
 
@@ -72,7 +85,8 @@ WsDB::WsDB(const string _filename, const string _wsdir, const long int _expirati
            const int _dbgid, const int _reminder, const string _mailaddress, const string _group, const string _comment)
     :
     dbfilename(_filename), wsdir(_wsdir), expiration(_expiration), extensions(_extensions),
-    acctcode(_acctcode), dbuid(_dbuid), dbgid(_dbgid), reminder(_reminder), mailaddress(_mailaddress), group(_group), comment(_comment), released(0)
+    acctcode(_acctcode), dbuid(_dbuid), dbgid(_dbgid), reminder(_reminder), mailaddress(_mailaddress), group(_group), comment(_comment), released(0),
+    isnew(true)
 {
     write_dbfile();
 }
@@ -80,7 +94,8 @@ WsDB::WsDB(const string _filename, const string _wsdir, const long int _expirati
 /*
  *  open db entry for reading
  */
-WsDB::WsDB(const string _filename, const int _dbuid, const int _dbgid) : dbfilename(_filename), dbuid(_dbuid), dbgid(_dbgid), released(0)
+WsDB::WsDB(const string _filename, const int _dbuid, const int _dbgid) : dbfilename(_filename), dbuid(_dbuid), dbgid(_dbgid), released(0),
+    isnew(false)
 {
     read_dbfile();
 }
@@ -96,8 +111,7 @@ void WsDB::use_extension(const long _expiration, const string _mailaddress, cons
     // if root does this, we do not use an extension
     if((getuid()!=0) && (_expiration!=-1) && (_expiration > expiration)) extensions--;
     if((extensions<0) && (getuid()!=0)) {
-        cerr << "Error: no more extensions." << endl;
-        exit(-1);
+        throw WsError(-1, "no more extensions.");
     }
     if (_expiration!=-1) {
         expiration = _expiration;
@@ -108,6 +122,106 @@ void WsDB::use_extension(const long _expiration, const string _mailaddress, cons
 
 
 
+// entries written since begin_batch(), made visible by commit_batch()
+struct PendingEntry {
+    string tmpname;         // in the directory of target
+    string target;          // file of the entry, in its shard if the directory is sharded
+    WsDB entry;
+};
+
+static bool batching = false;
+static vector<PendingEntry> pending;
+
+
+static string dirname(const string filename) {
+    size_t pos = filename.rfind('/');
+    if (pos == string::npos) return ".";
+    if (pos == 0) return "/";
+    return filename.substr(0, pos);
+}
+
+// fsync a directory, so renames in it are durable
+static bool syncdir(const string dir) {
+    int dirfd = WsDirs::get(dir);
+    int fd = dirfd < 0 ? -1 : openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    // some filesystems can not fsync directories, and do not need to
+    bool ok = fsync(fd) == 0 || errno == EINVAL;
+    close(fd);
+    return ok;
+}
+
+// entry written to its shard, remove the copy a migration did not move yet
+static void unlinkflat(const string target, const string filename) {
+    if (target != filename) {
+        string name;
+        int dirfd = WsDirs::parent(filename, name);
+        if (dirfd >= 0) unlinkat(dirfd, name.c_str(), 0);
+    }
+}
+
+// the copy a migration did not move yet counts as existing entry
+static bool flatexists(const string target, const string filename) {
+    return target != filename && WsDirs::exists(filename);
+}
+
+/*
+ * put temporary file tmpname in place as name for a new entry, failing with EEXIST
+ * if name exists. link() is atomic on all filesystems, where links are not
+ * supported a rename without replace is used
+ */
+static int linkentry(const int dirfd, const string tmpname, const string name) {
+    if (linkat(dirfd, tmpname.c_str(), dirfd, name.c_str(), 0) == 0) {
+        unlinkat(dirfd, tmpname.c_str(), 0);
+        return 0;
+    }
+    if (errno != EPERM && errno != EOPNOTSUPP && errno != EMLINK) {
+        return -1;
+    }
+    return WsDirs::renamenoreplace(dirfd, tmpname, dirfd, name);
+}
+
+/*
+ * write data to a new temporary file in dirfd next to name, the caller renames it into place,
+ * so readers see either the old or the new entry, never a truncated one
+ */
+static bool write_tmpfile(const int dirfd, const string name, const string data, const int perm, const bool sync,
+                          const int dbuid, const int dbgid, string &tmpname) {
+    // unique like mkstemp, leftovers of a crashed process with the same pid are skipped
+    static unsigned int counter = 0;
+    int fd = -1;
+    for (int tries = 0; fd < 0 && tries < 100; tries++) {
+        tmpname = "." + name + "." + to_string(getpid()) + "." + to_string(counter++);
+        fd = openat(dirfd, tmpname.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        tmpname.clear();
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (ok && written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno != EINTR) ok = false;
+        if (n > 0) written += n;
+    }
+    if (ok && fchmod(fd, perm) != 0) {
+        cerr << "Error: could not change permissions of database entry" << endl;
+    }
+#ifndef SETUID
+    // CAP_CHOWN was raised with CAP_DAC_OVERRIDE by the caller
+    if (ok && fchown(fd, dbuid, dbgid)) {
+        cerr << "Error: could not change owner of database entry" << endl;
+    }
+#endif
+    if (ok && sync) ok = fsync(fd) == 0;
+    if (close(fd) != 0) ok = false;
+    return ok;
+}
+
+
 // write data to file
 void WsDB::write_dbfile()
 {
@@ -126,48 +240,296 @@ void WsDB::write_dbfile()
         entry["released"] = released;
     }
     entry["comment"] = comment;
-    Workspace::raise_cap(CAP_DAC_OVERRIDE);
-#ifdef SETUID
-    // for filesystem with root_squash, we need to be DB user here
-    if (setegid(dbgid)|| seteuid(dbuid)) {
-			cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
-			exit(-1);
-	}
-#endif
-    ofstream fout(dbfilename.c_str());
-    fout << entry;
-    fout.close();
+    ostringstream data;
+    data << entry;
     if (group.length()>0) {
         // for group workspaces, we set the x-bit
         perm = 0744;
     } else {
         perm = 0644;
     }
-    if (chmod(dbfilename.c_str(), perm) != 0) {
-        cerr << "Error: could not change permissions of database entry" << endl;
+    // in a batch, commit_batch() syncs all entries at once
+    bool sync = WsConfig::get().dbsync && !batching;
+
+    WsPrivileges priv({CAP_DAC_OVERRIDE, CAP_CHOWN});
+    // for filesystem with root_squash, we need to be DB user here
+    priv.asdb(dbuid, dbgid);
+    string name, tmpname;
+    string target = WsShards::canonical(dbfilename);
+    int dirfd = WsDirs::parent(target, name);
+    bool ok = dirfd >= 0 && write_tmpfile(dirfd, name, data.str(), perm, sync, dbuid, dbgid, tmpname);
+    bool exists = false;
+    if (ok && isnew && flatexists(target, dbfilename)) {
+        ok = false;
+        exists = true;
+    } else if (ok && batching) {
+        PendingEntry p = { tmpname, target, *this };
+        pending.push_back(p);
+    } else if (ok) {
+        if (isnew) {
+            ok = linkentry(dirfd, tmpname, name) == 0;
+            exists = !ok && errno == EEXIST;
+        } else {
+            ok = renameat(dirfd, tmpname.c_str(), dirfd, name.c_str()) == 0;
+        }
+        // keep binary index, expiration queue and user manifests in sync, if there are
+        if (ok) {
+            unlinkflat(target, dbfilename);
+            WsIndex::update(dbfilename, *this);
+            WsExpiry::schedule(dbfilename, expiration, reminder, dbuid, dbgid);
+            WsUsers::add(dbfilename, dbuid, dbgid);
+            // the entry is in place, a crash may only lose it
+            if (sync && !syncdir(dirname(target))) {
+                cerr << "Warning: could not sync database directory of " << dbfilename << endl;
+            }
+        }
     }
-#ifdef SETUID
-    if(seteuid(0)|| setegid(0)) {
-			cerr << "Error: can not seteuid or setgid. Bad installation?" << endl;
-			exit(-1);
-	}
-#endif
-    Workspace::lower_cap(CAP_DAC_OVERRIDE, dbuid);
+    if (!ok && !tmpname.empty()) {
+        unlinkat(dirfd, tmpname.c_str(), 0);
+    }
+    priv.lower();
 
-#ifndef SETUID
-    Workspace::raise_cap(CAP_CHOWN);
-    if (chown(dbfilename.c_str(), dbuid, dbgid)) {
-        Workspace::lower_cap(CAP_CHOWN, dbuid);
-        cerr << "Error: could not change owner of database entry" << endl;
+    if (exists) {
+        throw WsError(-1, "database entry " + dbfilename + " exists already, created by another process?");
     }
-    Workspace::lower_cap(CAP_CHOWN, dbuid);
-#endif
+    if (!ok) {
+        throw WsError(-1, "could not write database entry " + dbfilename);
+    }
+    isnew = false;
+}
+
+/*
+ * group commit, entries written until commit_batch() are kept in temporary files
+ */
+void WsDB::begin_batch()
+{
+    batching = true;
+}
+
+// sync a temporary file of a batch, or only start writing it back if not wait
+static bool synctmpfile(const int dirfd, const string tmpname, const bool wait) {
+    int fd = dirfd < 0 ? -1 : openat(dirfd, tmpname.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = true;
+    if (wait) {
+        ok = fsync(fd) == 0;
+    } else {
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+    close(fd);
+    return ok;
+}
+
+/*
+ * with dbsync, make the entries of the batch durable, writeback of all of them
+ * is started before waiting for the first, then rename them into place and
+ * sync their directories once each
+ */
+bool WsDB::commit_batch(vector<string> *failed)
+{
+    batching = false;
+    if (pending.empty()) return true;
+
+    int dbuid = pending[0].entry.dbuid;
+    int dbgid = pending[0].entry.dbgid;
+    bool sync = WsConfig::get().dbsync;
+    set<string> dirs;
+    for (const PendingEntry &p: pending) {
+        dirs.insert(dirname(p.target));
+    }
+
+    WsPrivileges priv({CAP_DAC_OVERRIDE});
+    priv.asdb(dbuid, dbgid);
+    vector<bool> synced(pending.size(), true);
+    if (sync) {
+        string name;
+        for (size_t i=0; i<pending.size(); i++) {
+            synctmpfile(WsDirs::parent(pending[i].target, name), pending[i].tmpname, false);
+        }
+        for (size_t i=0; i<pending.size(); i++) {
+            synced[i] = synctmpfile(WsDirs::parent(pending[i].target, name), pending[i].tmpname, true);
+        }
+    }
+    bool ok = true;
+    for (size_t i=0; i<pending.size(); i++) {
+        PendingEntry &p = pending[i];
+        string name;
+        int dirfd = WsDirs::parent(p.target, name);
+        bool moved = false;
+        // new entries do not replace one another process created meanwhile
+        if (synced[i] && p.entry.isnew) {
+            moved = !flatexists(p.target, p.entry.dbfilename) && linkentry(dirfd, p.tmpname, name) == 0;
+        } else if (synced[i]) {
+            moved = renameat(dirfd, p.tmpname.c_str(), dirfd, name.c_str()) == 0;
+        }
+        if (moved) {
+            unlinkflat(p.target, p.entry.dbfilename);
+            WsIndex::update(p.entry.dbfilename, p.entry);
+            WsExpiry::schedule(p.entry.dbfilename, p.entry.expiration, p.entry.reminder, dbuid, dbgid);
+            WsUsers::add(p.entry.dbfilename, dbuid, dbgid);
+        } else {
+            unlinkat(dirfd, p.tmpname.c_str(), 0);
+            if (failed) {
+                failed->push_back(p.entry.dbfilename);
+            } else {
+                cerr << "Error: could not write database entry " << p.entry.dbfilename << endl;
+            }
+            ok = false;
+        }
+    }
+    // the entries are in place, a crash may only lose them
+    for (const string &dir: dirs) {
+        if (sync && !syncdir(dir)) {
+            cerr << "Warning: could not sync database directory " << dir << endl;
+        }
+    }
+    priv.lower();
+
+    pending.clear();
+    return ok;
+}
+
+bool WsDB::fastparse = true;
+
+// read whole file into buf with one read, buf is reused between calls
+static bool readfile(const string filename, vector<char> &buf) {
+    string name;
+    int dirfd = WsDirs::parent(filename, name);
+    int fd = dirfd < 0 ? -1 : openat(dirfd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    // one byte more, to see if the file grew
+    buf.resize(st.st_size + 1);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fd, buf.data() + len, buf.size() - len)) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || (len += n) == buf.size()) {
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    buf.resize(len);
+    return true;
+}
+
+// decimal number as emitted by yaml-cpp, value has to fit completely
+static bool parsenum(const char *p, const char *end, long &value) {
+    bool neg = false;
+    if (p < end && *p == '-') {
+        neg = true;
+        p++;
+    }
+    if (p == end || end - p > 18) return false;
+    long v = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return false;
+        v = v*10 + (*p - '0');
+    }
+    value = neg ? -v : v;
+    return true;
+}
+
+/*
+ * plain scalar as emitted by yaml-cpp, or "" for the empty string. Anything the
+ * emitter would quote, or what YAML would read differently, is not accepted
+ */
+static bool parsestr(const char *p, const char *end, string &value) {
+    if (end - p == 2 && p[0] == '"' && p[1] == '"') {
+        value.clear();
+        return true;
+    }
+    if (p == end || *p == ' ' || end[-1] == ' ' || end[-1] == ':') return false;
+    if (strchr("-?:,[]{}#&*!|>'\"%@`~", *p)) return false;
+    for (const char *c = p; c < end; c++) {
+        if ((unsigned char)*c < ' ' || *c == 0x7f) return false;
+        if (c + 1 < end && ((*c == ':' && c[1] == ' ') || (*c == ' ' && c[1] == '#'))) return false;
+    }
+    size_t len = end - p;
+    if ((len == 4 && (!strncmp(p, "null", 4) || !strncmp(p, "Null", 4) || !strncmp(p, "NULL", 4)))) {
+        return false;
+    }
+    value.assign(p, len);
+    return true;
+}
+
+/*
+ * streaming parser for entries as written by write_dbfile, one "key: value" per line.
+ * returns false for anything else, the caller falls back to yaml-cpp then
+ */
+bool WsDB::read_fast(const string &filename)
+{
+    static thread_local vector<char> buf;
+    if (!readfile(filename, buf)) return false;
+
+    enum { WORKSPACE=1, EXPIRATION=2, EXTENSIONS=4, ACCTCODE=8, REMINDER=16,
+           MAILADDRESS=32, GROUP=64, COMMENT=128, RELEASED=256 };
+    const int required = WORKSPACE | EXPIRATION | EXTENSIONS | ACCTCODE | REMINDER | MAILADDRESS;
+    int seen = 0;
+    long num = 0;
+    // optional fields, the other ones are always set if this succeeds
+    group.clear();
+    comment.clear();
+    released = 0;
+
+    const char *p = buf.data();
+    const char *end = p + buf.size();
+    while (p < end) {
+        const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char *colon = static_cast<const char*>(memchr(p, ':', eol - p));
+        if (!colon || colon + 1 >= eol || colon[1] != ' ') return false;
+        const char *v = colon + 2;
+        size_t klen = colon - p;
+
+        int key;
+        bool ok;
+#define KEY(name) (klen == sizeof(name)-1 && !memcmp(p, name, klen))
+        if (KEY("workspace")) {
+            key = WORKSPACE; ok = parsestr(v, eol, wsdir);
+        } else if (KEY("expiration")) {
+            key = EXPIRATION; ok = parsenum(v, eol, expiration);
+        } else if (KEY("extensions")) {
+            key = EXTENSIONS; ok = parsenum(v, eol, num) && num == (int)num; extensions = num;
+        } else if (KEY("acctcode")) {
+            key = ACCTCODE; ok = parsestr(v, eol, acctcode);
+        } else if (KEY("reminder")) {
+            key = REMINDER; ok = parsenum(v, eol, num) && num == (int)num; reminder = num;
+        } else if (KEY("mailaddress")) {
+            key = MAILADDRESS; ok = parsestr(v, eol, mailaddress);
+        } else if (KEY("group")) {
+            key = GROUP; ok = parsestr(v, eol, group);
+        } else if (KEY("comment")) {
+            key = COMMENT; ok = parsestr(v, eol, comment);
+        } else if (KEY("released")) {
+            key = RELEASED; ok = parsenum(v, eol, released);
+        } else {
+            return false;
+        }
+#undef KEY
+        if (!ok || (seen & key)) return false;
+        seen |= key;
+        p = eol + 1;
+    }
+    return (seen & required) == required;
 }
 
 // read data from file
 void WsDB::read_dbfile()
 {
-    YAML::Node entry = YAML::LoadFile(dbfilename);
+    // in its shard, or still in the flat directory
+    string filename = WsShards::locate(dbfilename);
+    if (fastparse && read_fast(filename)) return;
+    group.clear();
+    comment.clear();
+    released = 0;
+
+    YAML::Node entry = YAML::LoadFile(filename);
     try {
         wsdir = entry["workspace"].as<string>();
         expiration = entry["expiration"].as<long>();
@@ -181,9 +543,10 @@ void WsDB::read_dbfile()
 		// FIXME group missing here?
 		group = entry["group"].as<string>("");
 		// FIXME empty group or current group if no group in DB?
+        released = entry["released"].as<long>(0);
     } catch (const YAML::BadSubscript&) {
         // fallback to old db format, python version
-        ifstream entry (dbfilename.c_str());
+        ifstream entry (filename.c_str());
         entry >> expiration;
         entry >> wsdir;
         // get acctcode and extensions, need some splitting
@@ -192,9 +555,15 @@ void WsDB::read_dbfile()
         getline(entry, line); // newline
         getline(entry, line); // acctcode
         boost::split(sp, line, boost::is_any_of(":"));
+        if (!entry || sp.size() < 2) {
+            throw WsError(-1, "invalid database entry " + filename);
+        }
         acctcode = sp[1];
         getline(entry, line); // extension
         boost::split(sp, line, boost::is_any_of(":"));
+        if (!entry || sp.size() < 2) {
+            throw WsError(-1, "invalid database entry " + filename);
+        }
         extensions = boost::lexical_cast<int>(sp[1]);
         entry.close();
         mailaddress = "";
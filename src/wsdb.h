@@ -35,6 +35,7 @@
 
 
 #include <string>
+#include <vector>
 
 
 using namespace std;
@@ -64,11 +65,17 @@ private:
     string group;
     string comment;
     long released;
+    bool isnew;             // not written yet, must not replace an existing entry
 
     void read_dbfile();
+    bool read_fast(const string &filename);
 
 
 public:
+    // use the streaming parser for entries in the format of write_dbfile, default true,
+    // false parses all entries with yaml-cpp
+    static bool fastparse;
+
     // constructor to query a DB entry, this reads the database entry
     WsDB(const string filename, const int dbuid, const int dbgid);
 
@@ -103,7 +110,37 @@ public:
         return wsdir;
     }
 
+    string getacctcode() {
+        return acctcode;
+    }
+
+    int getreminder() {
+        return reminder;
+    }
+
+    string getgroup() {
+        return group;
+    }
+
+    string getcomment() {
+        return comment;
+    }
+
+    long int getreleased() {
+        return released;
+    }
+
+    // atomic write, temporary file renamed over the entry, throws on error. The first
+    // write of a new entry fails instead if the entry exists, as another process
+    // created it in between
     void write_dbfile();
+
+    // group commit for bulk changes, entries written after begin_batch() become
+    // visible and durable together with commit_batch(), false if one failed.
+    // failed gets the entries which could not be written, without it they are
+    // reported on stderr
+    static void begin_batch();
+    static bool commit_batch(vector<string> *failed = NULL);
 };
 
 #endif
@@ -0,0 +1,127 @@
+/*
+ *  workspace++
+ *
+ *  wsdb_bench
+ *
+ *  microbenchmark for reading DB entries, compares the streaming parser
+ *  of WsDB with parsing by yaml-cpp. Not installed.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include "wsdb.h"
+#include "wserror.h"
+
+using namespace std;
+
+
+// entries in the format written by WsDB::write_dbfile
+static vector<string> makeentries(const string dir, const int count) {
+    vector<string> files;
+    for (int i=0; i<count; i++) {
+        ostringstream name, ws;
+        name << dir << "/user" << i%100 << "-ws" << i;
+        ws << "/lustre/ws/user" << i%100 << "-ws" << i;
+        YAML::Node entry;
+        entry["workspace"] = ws.str();
+        entry["expiration"] = 1600000000L + i;
+        entry["extensions"] = 3;
+        entry["acctcode"] = "project";
+        entry["reminder"] = i%2 ? 1599000000L : 0L;
+        entry["mailaddress"] = "user@example.com";
+        if (i%3 == 0) {
+            entry["group"] = "group";
+        }
+        if (i%5 == 0) {
+            entry["released"] = 1600000000L;
+        }
+        entry["comment"] = i%7 ? "" : "needs quoting: yes";
+        ofstream out(name.str().c_str());
+        out << entry;
+        files.push_back(name.str());
+    }
+    return files;
+}
+
+// read all entries rounds times, returns entries per second
+static double readentries(const vector<string> &files, const int rounds, long &checksum) {
+    auto start = chrono::steady_clock::now();
+    for (int r=0; r<rounds; r++) {
+        for (const string &f: files) {
+            WsDB entry(f, 0, 0);
+            checksum += entry.getexpiration() + entry.getwsdir().size() + entry.getcomment().size()
+                        + entry.getgroup().size() + entry.getreleased();
+        }
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return files.size() * rounds / elapsed.count();
+}
+
+
+static int run(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    char tmpl[] = "/tmp/wsdb_bench.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        cerr << "Error: could not create temporary directory" << endl;
+        return 1;
+    }
+    string dir = tmpl;
+    vector<string> files = makeentries(dir, count);
+
+    long yamlsum = 0, fastsum = 0;
+    WsDB::fastparse = false;
+    readentries(files, 1, yamlsum);     // warm page cache
+    yamlsum = 0;
+    double yamlrate = readentries(files, rounds, yamlsum);
+    WsDB::fastparse = true;
+    double fastrate = readentries(files, rounds, fastsum);
+
+    for (const string &f: files) {
+        unlink(f.c_str());
+    }
+    rmdir(dir.c_str());
+
+    cout << count << " entries, " << rounds << " rounds" << endl;
+    cout << "yaml-cpp:  " << (long)yamlrate << " entries/s" << endl;
+    cout << "streaming: " << (long)fastrate << " entries/s" << endl;
+    cout << "speedup:   " << fastrate / yamlrate << endl;
+    if (yamlsum != fastsum) {
+        cerr << "Error: parsers disagree" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    return wsmain(run, argc, argv);
+}
@@ -0,0 +1,441 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "wsdelete.h"
+#include "wsqueue.h"
+
+using namespace std;
+
+// files of a directory are handed out in batches of this size, so large flat
+// directories are unlinked by several threads
+static const size_t batchsize = 512;
+
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+TokenBucket::TokenBucket(double _rate)
+    : rate(_rate), tokens(_rate), last(now())
+{
+}
+
+void TokenBucket::take(double n) {
+    if (rate <= 0) return;
+    double wait;
+    {
+        lock_guard<mutex> l(lock);
+        double t = now();
+        tokens += (t - last) * rate;
+        if (tokens > rate) tokens = rate;
+        last = t;
+        tokens -= n;
+        wait = tokens < 0 ? -tokens / rate : 0;
+    }
+    if (wait > 0) {
+        this_thread::sleep_for(chrono::microseconds((long)(wait * 1e6)));
+    }
+}
+
+
+class TreeDeleter {
+
+private:
+    // a directory, removed when the last task referring to it is done
+    struct Node {
+        Node *parent;
+        string name;
+        int fd;
+        bool isdir;
+        atomic<long> pending;       // tasks still working on this directory
+
+        Node(Node *_parent, const string _name) : parent(_parent), name(_name), fd(-1), isdir(true), pending(1) {}
+    };
+
+    // read a directory if files is empty, unlink files in node otherwise
+    struct Task {
+        Node *node;
+        vector<string> files;
+    };
+
+    int rootparentfd;
+    DeleteLimit *limit;
+    WorkQueues<Task> queues;
+    atomic<bool> done;
+    atomic<uint64_t> files, dirs, bytes, errors;
+    // every directory waiting for its subdirectories keeps its fd, deeper trees
+    // than the fds the process can have are removed sequentially below maxfds
+    atomic<long> openfds;
+    long maxfds;
+    mutex errorlock;
+    string firsterror;
+
+    void seterror(const string what, int err) {
+        errors++;
+        lock_guard<mutex> l(errorlock);
+        if (firsterror.empty()) {
+            firsterror = what + ": " + strerror(err);
+        }
+    }
+
+    // account metadata operations and bytes against the budget
+    void throttle(double ops, double size = 0) {
+        if (limit == NULL) return;
+        limit->ops.take(ops);
+        if (size > 0) limit->bytes.take(size);
+    }
+
+    int parentfd(Node *node) {
+        return node->parent ? node->parent->fd : rootparentfd;
+    }
+
+    // one task less for node, remove directories which are done, walking upwards
+    void finish(Node *node) {
+        while (node) {
+            if (--node->pending > 0) return;
+            if (node->fd >= 0) {
+                close(node->fd);
+                openfds--;
+            }
+            if (node->isdir) {
+                throttle(1);
+                if (unlinkat(parentfd(node), node->name.c_str(), AT_REMOVEDIR) == 0) {
+                    dirs++;
+                } else {
+                    seterror(node->name, errno);
+                }
+            }
+            Node *parent = node->parent;
+            if (parent == NULL) done = true;
+            delete node;
+            node = parent;
+        }
+    }
+
+    bool unlinkfile(const int dirfd, const string &name) {
+        struct stat st;
+        off_t size = 0;
+        throttle(1);
+        if (fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            size = st.st_size;
+        }
+        throttle(1, size);
+        if (unlinkat(dirfd, name.c_str(), 0) == 0) {
+            files++;
+            bytes += size;
+            return true;
+        }
+        seterror(name, errno);
+        return false;
+    }
+
+    void unlinkfiles(Node *node, const vector<string> &names) {
+        for (const string &name: names) {
+            unlinkfile(node->fd, name);
+        }
+    }
+
+    /*
+     * remove directory name in dirfd and everything below with a constant number
+     * of fds, one directory at a time. Goes down with openat() and up with "..",
+     * which has to be the directory it came from, so a directory moved away
+     * meanwhile stops the walk instead of leading out of the tree
+     */
+    void removesequential(const int dirfd, const string name) {
+        struct Level {
+            string name;
+            dev_t dev;
+            ino_t ino;
+            set<string> failed;     // entries which could not be removed, not tried again
+        };
+        vector<Level> stack;
+        struct stat st;
+
+        throttle(1);
+        int cur = openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (cur < 0 || fstat(cur, &st) != 0) {
+            seterror(name, errno);
+            if (cur >= 0) close(cur);
+            return;
+        }
+        stack.push_back(Level{name, st.st_dev, st.st_ino, set<string>()});
+
+        while (true) {
+            // unlink the files of cur and go into its first subdirectory
+            string sub;
+            int dfd = dup(cur);
+            DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+            if (d == NULL) {
+                seterror(stack.back().name, errno);
+                if (dfd >= 0) close(dfd);
+                close(cur);
+                return;
+            }
+            struct dirent *de;
+            while ((de = readdir(d)) != NULL) {
+                if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+                if (stack.back().failed.count(de->d_name)) continue;
+                bool isdir = de->d_type == DT_DIR;
+                if (de->d_type == DT_UNKNOWN) {
+                    throttle(1);
+                    isdir = fstatat(cur, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                }
+                if (isdir) {
+                    if (sub.empty()) sub = de->d_name;
+                } else {
+                    if (!unlinkfile(cur, de->d_name)) {
+                        stack.back().failed.insert(de->d_name);
+                    }
+                }
+            }
+            closedir(d);
+
+            if (!sub.empty()) {
+                throttle(1);
+                int next = openat(cur, sub.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (next < 0 || fstat(next, &st) != 0) {
+                    seterror(sub, errno);
+                    if (next >= 0) close(next);
+                    stack.back().failed.insert(sub);
+                    continue;
+                }
+                close(cur);
+                cur = next;
+                stack.push_back(Level{sub, st.st_dev, st.st_ino, set<string>()});
+                continue;
+            }
+
+            // cur is done, remove it from its parent
+            string done = stack.back().name;
+            stack.pop_back();
+            if (stack.empty()) {
+                close(cur);
+                throttle(1);
+                if (unlinkat(dirfd, done.c_str(), AT_REMOVEDIR) == 0) {
+                    dirs++;
+                } else {
+                    seterror(done, errno);
+                }
+                return;
+            }
+            int up = openat(cur, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            close(cur);
+            if (up < 0 || fstat(up, &st) != 0 || st.st_dev != stack.back().dev || st.st_ino != stack.back().ino) {
+                seterror(done + "/..", up < 0 ? errno : ESTALE);
+                if (up >= 0) close(up);
+                return;
+            }
+            cur = up;
+            throttle(1);
+            if (unlinkat(cur, done.c_str(), AT_REMOVEDIR) == 0) {
+                dirs++;
+            } else {
+                seterror(done, errno);
+                stack.back().failed.insert(done);
+            }
+        }
+    }
+
+    void scan(size_t q, Node *node) {
+        if (openfds >= maxfds) {
+            removesequential(parentfd(node), node->name);
+            node->isdir = false;
+            finish(node);
+            return;
+        }
+        throttle(1);
+        node->fd = openat(parentfd(node), node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (node->fd >= 0) {
+            openfds++;
+        } else if (errno == EMFILE || errno == ENFILE) {
+            removesequential(parentfd(node), node->name);
+            node->isdir = false;
+            finish(node);
+            return;
+        }
+        if (node->fd < 0) {
+            if (errno == ENOTDIR || errno == ELOOP) {
+                // not a directory (any more), just remove it
+                node->isdir = false;
+                throttle(1);
+                if (unlinkat(parentfd(node), node->name.c_str(), 0) == 0) {
+                    files++;
+                } else {
+                    seterror(node->name, errno);
+                }
+            } else {
+                node->isdir = false;
+                seterror(node->name, errno);
+            }
+            finish(node);
+            return;
+        }
+
+        int dfd = dup(node->fd);
+        DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+        if (d == NULL) {
+            seterror(node->name, errno);
+            if (dfd >= 0) close(dfd);
+            finish(node);
+            return;
+        }
+
+        vector<string> batch;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            bool isdir = de->d_type == DT_DIR;
+            if (de->d_type == DT_UNKNOWN) {
+                struct stat st;
+                throttle(1);
+                isdir = fstatat(node->fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (isdir) {
+                node->pending++;
+                Task t;
+                t.node = new Node(node, de->d_name);
+                queues.push(q, move(t));
+            } else {
+                batch.push_back(de->d_name);
+                if (batch.size() >= batchsize) {
+                    node->pending++;
+                    Task t;
+                    t.node = node;
+                    t.files.swap(batch);
+                    queues.push(q, move(t));
+                }
+            }
+        }
+        closedir(d);
+
+        unlinkfiles(node, batch);
+        finish(node);
+    }
+
+    void worker(size_t q) {
+        Task task;
+        int idle = 0;
+        while (!done) {
+            if (queues.pop(q, task) || queues.steal(q, task)) {
+                idle = 0;
+                if (task.files.empty()) {
+                    scan(q, task.node);
+                } else {
+                    unlinkfiles(task.node, task.files);
+                    finish(task.node);
+                }
+            } else if (++idle < 100) {
+                this_thread::yield();
+            } else {
+                this_thread::sleep_for(chrono::microseconds(500));
+            }
+        }
+    }
+
+public:
+    TreeDeleter(int threads, DeleteLimit *_limit) : rootparentfd(-1), limit(_limit), queues(threads), done(false),
+                               files(0), dirs(0), bytes(0), errors(0), openfds(0) {
+        // half of the fds for the tree, the rest for the caller and the other threads
+        struct rlimit rl;
+        maxfds = 512;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+            maxfds = rl.rlim_cur / 2;
+        }
+    }
+
+    bool run(const string path, DeleteStats &stats, string &error) {
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+
+        // split path into parent directory and name, the tree is removed relative to the parent
+        string p = path;
+        while (p.size() > 1 && p[p.size()-1] == '/') p.erase(p.size()-1);
+        size_t pos = p.rfind('/');
+        string dir = pos == string::npos ? "." : (pos == 0 ? "/" : p.substr(0, pos));
+        string name = pos == string::npos ? p : p.substr(pos+1);
+
+        rootparentfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rootparentfd < 0 || name.empty() || name == "." || name == "..") {
+            error = dir + ": " + strerror(rootparentfd < 0 ? errno : EINVAL);
+            if (rootparentfd >= 0) close(rootparentfd);
+            stats.errors++;
+            return false;
+        }
+
+        Task t;
+        t.node = new Node(NULL, name);
+        queues.push(0, move(t));
+
+        vector<thread> pool;
+        for (size_t i=1; i<queues.size(); i++) {
+            pool.push_back(thread(&TreeDeleter::worker, this, i));
+        }
+        worker(0);
+        for (thread &th: pool) {
+            th.join();
+        }
+        close(rootparentfd);
+
+        gettimeofday(&end, NULL);
+        stats.files = files;
+        stats.dirs = dirs;
+        stats.bytes = bytes;
+        stats.errors = errors;
+        stats.seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        error = firsterror;
+        return errors == 0;
+    }
+};
+
+
+bool deletetree(const string path, int threads, DeleteStats &stats, string &error, DeleteLimit *limit) {
+    TreeDeleter deleter(threads, limit);
+    return deleter.run(path, stats, error);
+}
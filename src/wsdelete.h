@@ -0,0 +1,95 @@
+#ifndef WSDELETE_H
+#define WSDELETE_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <mutex>
+#include <stdint.h>
+
+using namespace std;
+
+struct DeleteStats {
+    uint64_t files;         // non directories removed
+    uint64_t dirs;          // directories removed
+    uint64_t bytes;         // sum of sizes of removed files
+    uint64_t errors;
+    double seconds;
+
+    DeleteStats() : files(0), dirs(0), bytes(0), errors(0), seconds(0.0) {}
+};
+
+/*
+ * token bucket, refilled with rate tokens per second, holding at most one second worth.
+ *
+ * take() may overdraw the bucket, the caller then sleeps until the debt is paid,
+ * so requests larger than the bucket (big files) are still possible.
+ * A rate of 0 means unlimited.
+ */
+class TokenBucket {
+
+private:
+    double rate;
+    double tokens;
+    double last;
+    mutex lock;
+
+public:
+    TokenBucket(double _rate);
+
+    // take n tokens, blocks until they are available
+    void take(double n);
+};
+
+/*
+ * budget for deletions, shared by all threads deleting in one filesystem
+ */
+struct DeleteLimit {
+    TokenBucket ops;        // metadata operations (open, stat, unlink, rmdir) per second
+    TokenBucket bytes;      // bytes of removed files per second
+
+    DeleteLimit(double opsrate, double bytesrate) : ops(opsrate), bytes(bytesrate) {}
+};
+
+/*
+ * recursive delete of path with a pool of threads, does not follow symlinks.
+ *
+ * each thread has a deque of work, directories to read and batches of files
+ * to unlink, it takes work from the back of its own deque and steals from the
+ * front of other deques when idle. All operations are relative to directory
+ * fds (openat/unlinkat), so many metadata operations are in flight at once.
+ * Trees nested deeper than half the fds the process may open are removed one
+ * directory at a time below that depth.
+ *
+ * if limit is given, all threads together stay within its budget.
+ *
+ * returns false if anything could not be removed, error holds the first problem.
+ */
+bool deletetree(const string path, int threads, DeleteStats &stats, string &error, DeleteLimit *limit = NULL);
+
+#endif
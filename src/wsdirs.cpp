@@ -0,0 +1,118 @@
+/*
+ *  workspace++
+ *
+ *  wsdirs
+ *
+ *  directory descriptors for *at() operations
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "wsdirs.h"
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+using namespace std;
+
+static mutex dirslock;
+static unordered_map<string, int> dirs;
+
+
+int WsDirs::get(const string &dir) {
+    string key = dir;
+    while (key.size() > 1 && key[key.size()-1] == '/') key.erase(key.size()-1);
+    if (key.empty()) key = ".";
+
+    lock_guard<mutex> guard(dirslock);
+    auto it = dirs.find(key);
+    if (it != dirs.end()) {
+        return it->second;
+    }
+    // failures are not kept, the next caller may have the privileges to open it
+    int fd = open(key.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        dirs[key] = fd;
+    }
+    return fd;
+}
+
+void WsDirs::clear() {
+    lock_guard<mutex> guard(dirslock);
+    for (auto &d: dirs) {
+        close(d.second);
+    }
+    dirs.clear();
+}
+
+int WsDirs::parent(const string &path, string &name) {
+    size_t pos = path.rfind('/');
+    if (pos == string::npos) {
+        name = path;
+        return get(".");
+    }
+    name = path.substr(pos+1);
+    return get(pos == 0 ? "/" : path.substr(0, pos));
+}
+
+bool WsDirs::exists(const string &path) {
+    string name;
+    int dirfd = parent(path, name);
+    struct stat st;
+    return dirfd >= 0 && fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+int WsDirs::renamenoreplace(const int olddir, const string &oldname, const int newdir, const string &newname) {
+#ifdef SYS_renameat2
+    int r = syscall(SYS_renameat2, olddir, oldname.c_str(), newdir, newname.c_str(), RENAME_NOREPLACE);
+    if (r == 0 || (errno != EINVAL && errno != ENOSYS)) {
+        return r;
+    }
+#endif
+    struct stat st;
+    if (fstatat(newdir, newname.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return renameat(olddir, oldname.c_str(), newdir, newname.c_str());
+}
+
+int WsDirs::renamenoreplace(const string &oldpath, const string &newpath) {
+    string oldname, newname;
+    int olddir = parent(oldpath, oldname);
+    int newdir = parent(newpath, newname);
+    if (olddir < 0 || newdir < 0) {
+        return -1;
+    }
+    return renamenoreplace(olddir, oldname, newdir, newname);
+}
@@ -0,0 +1,69 @@
+#ifndef WSDIRS_H
+#define WSDIRS_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+
+using namespace std;
+
+/*
+ * descriptors of the directories the tools work in (DB, deleted and space
+ * directories), opened once per process with O_PATH and kept. Files in them
+ * are handled with the *at() calls relative to these descriptors, so deep
+ * paths are not looked up again for each operation, and a directory renamed
+ * or replaced by a symlink in between is not followed.
+ *
+ * The descriptors give no access by themselves, each *at() call is checked
+ * against the credentials at the time of the call. Safe for threads, apart
+ * from clear() while descriptors are in use.
+ */
+class WsDirs {
+
+public:
+    // descriptor of directory dir, opened on first use, -1 with errno on error
+    static int get(const string &dir);
+
+    // close all kept descriptors, for processes that outlive a directory being
+    // replaced, like callers of libworkspace
+    static void clear();
+
+    // descriptor of the directory containing path, name gets the last component
+    static int parent(const string &path, string &name);
+
+    // lstat of path relative to its directory, true if it exists
+    static bool exists(const string &path);
+
+    // rename that fails with EEXIST instead of replacing an existing target.
+    // Falls back to a check before renameat() where the kernel or filesystem
+    // does not support RENAME_NOREPLACE
+    static int renamenoreplace(const int olddir, const string &oldname, const int newdir, const string &newname);
+    static int renamenoreplace(const string &oldpath, const string &newpath);
+};
+
+#endif
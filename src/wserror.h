@@ -0,0 +1,60 @@
+#ifndef WSERROR_H
+#define WSERROR_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+/*
+ * error of Workspace, WsDB and WsConfig, instead of exit() so the code can be
+ * used by libworkspace. code is the exit status of the tools, the message is
+ * printed by the tools after "Error: ".
+ */
+class WsError : public runtime_error {
+
+public:
+    int code;
+
+    WsError(const int _code, const string &message) : runtime_error(message), code(_code) {}
+};
+
+// run main of a tool, errors end it with message and exit status like before
+inline int wsmain(int (*toolmain)(int, char **), int argc, char **argv) {
+    try {
+        return toolmain(argc, argv);
+    } catch (const WsError &e) {
+        cerr << "Error: " << e.what() << endl;
+        return e.code;
+    }
+}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ *  workspace++
+ *
+ *  wsexpiry
+ *
+ *  expiration queue of a DB directory
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <errno.h>
+
+#include "wsdb.h"
+#include "wsdirs.h"
+#include "wsshards.h"
+#include "wsexpiry.h"
+
+using namespace std;
+
+static const long DAY = 24*3600;
+
+
+static string queuedir(const string dbdir) {
+    return dbdir + "/.ws_expiry";
+}
+
+// day of a bucket file name, false for anything else
+static bool bucketday(const char *name, long &day) {
+    char *end;
+    errno = 0;
+    day = strtol(name, &end, 10);
+    return *name >= '0' && *name <= '9' && *end == '\0' && errno == 0;
+}
+
+static bool append(const int qfd, const long day, const string &data, const int dbuid, const int dbgid) {
+    string bucket = to_string(day);
+    int fd = openat(qfd, bucket.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    // buckets created by root (expirer, rebuild) have to be appendable by the DB user
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (st.st_uid != (uid_t)dbuid || st.st_gid != (gid_t)dbgid)) {
+        if (fchown(fd, dbuid, dbgid)) {}
+    }
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    if (close(fd) != 0) ok = false;
+    return ok;
+}
+
+
+bool WsExpiry::exists(const string dbdir) {
+    struct stat st;
+    return stat(queuedir(dbdir).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool WsExpiry::add(const string dbdir, const string name, const long due, const int dbuid, const int dbgid) {
+    int qfd = WsDirs::get(queuedir(dbdir));
+    if (qfd < 0) return false;
+    long now = time(NULL);
+    return append(qfd, max(due, now) / DAY, name + "\n", dbuid, dbgid);
+}
+
+void WsExpiry::schedule(const string filename, const long expiration, const int reminder,
+                        const int dbuid, const int dbgid) {
+    string name;
+    size_t pos = filename.rfind('/');
+    string dbdir = pos == string::npos ? "." : filename.substr(0, pos);
+    name = filename.substr(pos == string::npos ? 0 : pos+1);
+
+    int qfd = WsDirs::get(queuedir(dbdir));
+    if (qfd < 0) return;
+
+    long now = time(NULL);
+    long expday = max(expiration, now) / DAY;
+    bool ok = append(qfd, expday, name + "\n", dbuid, dbgid);
+    if (reminder > 0) {
+        long remday = max(expiration - reminder*DAY, now) / DAY;
+        if (remday != expday) {
+            ok = append(qfd, remday, name + "\n", dbuid, dbgid) && ok;
+        }
+    }
+    if (!ok) {
+        cerr << "Warning: could not queue " << name << " in " << queuedir(dbdir) << ", run ws_index --rebuild-queue." << endl;
+    }
+}
+
+vector<string> WsExpiry::due(const string dbdir, const long now, vector<string> &buckets) {
+    vector<string> names;
+    buckets.clear();
+    int qfd = WsDirs::get(queuedir(dbdir));
+    int fd = qfd < 0 ? -1 : openat(qfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        return names;
+    }
+
+    // oldest bucket first
+    long today = now / DAY;
+    map<long, string> found;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        long day;
+        if (bucketday(de->d_name, day) && day <= today) {
+            found[day] = de->d_name;
+        }
+    }
+    closedir(dir);
+
+    set<string> seen;
+    for (const auto &b: found) {
+        int bfd = openat(qfd, b.second.c_str(), O_RDONLY | O_CLOEXEC);
+        if (bfd < 0) continue;
+        string content;
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(bfd, buf, sizeof(buf))) > 0) content.append(buf, n);
+        close(bfd);
+
+        // a line without newline is an append in progress, it is read the next time
+        size_t start = 0, eol;
+        while ((eol = content.find('\n', start)) != string::npos) {
+            string name = content.substr(start, eol - start);
+            start = eol + 1;
+            if (name.empty() || name.find('/') != string::npos || name[0] == '.') continue;
+            if (seen.insert(name).second) {
+                names.push_back(name);
+            }
+        }
+        if (b.first < today && start == content.size()) {
+            buckets.push_back(b.second);
+        }
+    }
+    return names;
+}
+
+void WsExpiry::consume(const string dbdir, const vector<string> &buckets) {
+    int qfd = WsDirs::get(queuedir(dbdir));
+    if (qfd < 0) return;
+    for (const string &b: buckets) {
+        unlinkat(qfd, b.c_str(), 0);
+    }
+}
+
+/*
+ * write a new queue from the YAML entries of dbdir, the old buckets are removed
+ */
+bool WsExpiry::rebuild(const string dbdir, const int dbuid, const int dbgid) {
+    string qdir = queuedir(dbdir);
+    if (mkdir(qdir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Error: could not create " << qdir << endl;
+        return false;
+    }
+    if (chown(qdir.c_str(), dbuid, dbgid)) {
+        cerr << "Warning: could not change owner of " << qdir << endl;
+    }
+    int qfd = WsDirs::get(qdir);
+    int fd = qfd < 0 ? -1 : openat(qfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        cerr << "Error: could not read " << qdir << endl;
+        return false;
+    }
+    struct dirent *de;
+    vector<string> old;
+    while ((de = readdir(dir)) != NULL) {
+        long day;
+        if (bucketday(de->d_name, day)) old.push_back(de->d_name);
+    }
+    closedir(dir);
+    consume(dbdir, old);
+
+    // collect per bucket, one append per bucket
+    long now = time(NULL);
+    map<long, string> bucketdata;
+    long count = 0;
+    // the directory and its shards, see WsShards
+    vector<string> dirs = WsShards::dirs(dbdir);
+    set<string> seen;
+    for (const string &d: dirs) {
+        dir = opendir(d.c_str());
+        if (dir == NULL) {
+            cerr << "Error: could not read DB directory " << d << endl;
+            return false;
+        }
+        while ((de = readdir(dir)) != NULL) {
+            string name = de->d_name;
+            // entries are <user>-<name>, no dotfiles
+            if (name[0] == '.' || name.find('-') == string::npos) continue;
+            if (dirs.size() > 1 && !seen.insert(name).second) continue;
+            string filename = d + "/" + name;
+            struct stat st;
+            if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            try {
+                WsDB entry(filename, dbuid, dbgid);
+                long expiration = entry.getexpiration();
+                long expday = max(expiration, now) / DAY;
+                bucketdata[expday] += name + "\n";
+                if (entry.getreminder() > 0) {
+                    long remday = max(expiration - entry.getreminder()*DAY, now) / DAY;
+                    if (remday != expday) bucketdata[remday] += name + "\n";
+                }
+                count++;
+            } catch (...) {
+                cerr << "Warning: skipping unreadable DB entry " << filename << endl;
+            }
+        }
+        closedir(dir);
+    }
+
+    bool ok = true;
+    for (const auto &b: bucketdata) {
+        ok = append(qfd, b.first, b.second, dbuid, dbgid) && ok;
+    }
+    if (!ok) {
+        cerr << "Error: could not write queue for " << dbdir << endl;
+    } else {
+        cerr << "Info: queued " << count << " entries in " << qdir << endl;
+    }
+    return ok;
+}
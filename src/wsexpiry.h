@@ -0,0 +1,76 @@
+#ifndef WSEXPIRY_H
+#define WSEXPIRY_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * expiration queue of a DB directory, so the expirer reads only the entries
+ * which have something due instead of all of them
+ *
+ *   <dbdir>/.ws_expiry/<day>    names of entries due on that day, one per line,
+ *                               day is the time divided by 86400
+ *
+ * whenever a DB entry is written, its name is appended to the bucket of its
+ * expiration and to the bucket of its first reminder. Buckets are never rewritten,
+ * an entry which was extended or released leaves a stale line behind, which costs
+ * the expirer a lookup of the entry and nothing else. The expirer reads the
+ * buckets up to today, and removes the buckets before today once it handled them.
+ *
+ * Like the index, the queue is only maintained if the directory exists,
+ * ws_index --rebuild-queue creates it or recovers it from the YAML files.
+ */
+class WsExpiry {
+
+public:
+    static bool exists(const string dbdir);
+
+    // writer side, queue DB entry filename for its expiration and reminder,
+    // does nothing if there is no queue in the directory of filename
+    static void schedule(const string filename, const long expiration, const int reminder,
+                         const int dbuid, const int dbgid);
+
+    // queue entry name of dbdir at time due, or now if that passed already
+    static bool add(const string dbdir, const string name, const long due, const int dbuid, const int dbgid);
+
+    // names in the buckets up to the day of now, each once, buckets gets the
+    // buckets before that day, which can be consumed after handling the names
+    static vector<string> due(const string dbdir, const long now, vector<string> &buckets);
+
+    // remove handled buckets
+    static void consume(const string dbdir, const vector<string> &buckets);
+
+    // create or recreate the queue from the YAML files
+    static bool rebuild(const string dbdir, const int dbuid, const int dbgid);
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <grp.h>
+#include <pwd.h>
+#include <time.h>
+#include <errno.h>
+
+#ifndef SETUID
+#include <sys/capability.h>
+#else
+typedef int cap_value_t;
+const int CAP_DAC_OVERRIDE = 0;
+const int CAP_CHOWN = 1;
+#endif
+
+#include "ws.h"
+#include "wsconfig.h"
+#include "wsgroups.h"
+#include "wserror.h"
+
+using namespace std;
+
+
+// memoized results of this process
+static map<gid_t, string> groupnames;
+static map<gid_t, bool> nogroup;
+static map<pair<string, gid_t>, vector<string> > usergroups;
+static map<uid_t, pair<string, string> > users;
+
+
+/*
+ * gids of user, buffer grows until the list fits
+ */
+static vector<gid_t> getgids(const string &username, const gid_t gid) {
+    int ngroups = 128;
+    vector<gid_t> gids(ngroups);
+    while (true) {
+        int n = ngroups;
+        if (getgrouplist(username.c_str(), gid, gids.data(), &n) >= 0) {
+            gids.resize(n);
+            return gids;
+        }
+        // n holds the needed size now, glibc does not change it on other errors
+        ngroups = n > ngroups ? n : ngroups * 2;
+        if (ngroups > 1024*1024) {
+            cerr << "Error: could not get groups of user " << username << "!" << endl;
+            return vector<gid_t>(1, gid);
+        }
+        gids.resize(ngroups);
+    }
+}
+
+bool WsGroups::getgroupname(const gid_t gid, string &name) {
+    auto it = groupnames.find(gid);
+    if (it != groupnames.end()) {
+        name = it->second;
+        return true;
+    }
+    if (nogroup.count(gid)) return false;
+
+    struct group grp, *result = NULL;
+    vector<char> buf(1024);
+    int ret;
+    while ((ret = getgrgid_r(gid, &grp, buf.data(), buf.size(), &result)) == ERANGE) {
+        buf.resize(buf.size() * 2);
+    }
+    if (ret != 0 || result == NULL) {
+        nogroup[gid] = true;
+        return false;
+    }
+    name = grp.gr_name;
+    groupnames[gid] = name;
+    return true;
+}
+
+bool WsGroups::getuser(const uid_t uid, string &name, string &home) {
+    auto it = users.find(uid);
+    if (it != users.end()) {
+        name = it->second.first;
+        home = it->second.second;
+        return true;
+    }
+
+    struct passwd pw, *result = NULL;
+    vector<char> buf(1024);
+    int ret;
+    while ((ret = getpwuid_r(uid, &pw, buf.data(), buf.size(), &result)) == ERANGE) {
+        buf.resize(buf.size() * 2);
+    }
+    if (ret != 0 || result == NULL) {
+        return false;
+    }
+    name = pw.pw_name;
+    home = pw.pw_dir;
+    users[uid] = make_pair(name, home);
+    return true;
+}
+
+void WsGroups::clear() {
+    groupnames.clear();
+    nogroup.clear();
+    usergroups.clear();
+    users.clear();
+}
+
+
+/*
+ * cache file is <WS_GROUPCACHE>/<user>:
+ *   line 1: gid time
+ *   then one group name per line
+ */
+static string cachefilename(const string &username) {
+    if (username.empty() || username.find('/') != string::npos || username[0] == '.') return "";
+    return string(WS_GROUPCACHE) + "/" + username;
+}
+
+static bool readcache(const string &username, const gid_t gid, const WsConfig &config, vector<string> &names) {
+    string filename = cachefilename(username);
+    if (filename.empty()) return false;
+
+    int fd = open(filename.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+        (st.st_uid != 0 && st.st_uid != (uid_t)config.dbuid) || st.st_size > 1024*1024) {
+        close(fd);
+        return false;
+    }
+    string buf(st.st_size, '\0');
+    ssize_t r = read(fd, &buf[0], st.st_size);
+    close(fd);
+    if (r != st.st_size) return false;
+
+    istringstream in(buf);
+    long cachedgid, cachedtime;
+    if (!(in >> cachedgid >> cachedtime)) return false;
+    long now = time(NULL);
+    if ((gid_t)cachedgid != gid || cachedtime > now || cachedtime + config.groupcachettl <= now) return false;
+
+    string line;
+    getline(in, line);
+    names.clear();
+    while (getline(in, line)) {
+        if (!line.empty()) names.push_back(line);
+    }
+    return true;
+}
+
+/*
+ * true if this process can raise its privileges to write the cache, tools
+ * installed without setuid or capabilities (ws_list) only read it
+ */
+static bool canraise() {
+#ifdef SETUID
+    uid_t ruid, euid, suid;
+    if (getresuid(&ruid, &euid, &suid) != 0) return false;
+    return ruid == 0 || euid == 0 || suid == 0;
+#else
+    cap_t caps = cap_get_proc();
+    if (caps == NULL) return false;
+    cap_flag_value_t dac = CAP_CLEAR, chown = CAP_CLEAR;
+    cap_get_flag(caps, CAP_DAC_OVERRIDE, CAP_PERMITTED, &dac);
+    cap_get_flag(caps, CAP_CHOWN, CAP_PERMITTED, &chown);
+    cap_free(caps);
+    return dac == CAP_SET && chown == CAP_SET;
+#endif
+}
+
+static void writecache(const string &username, const gid_t gid, const WsConfig &config, const vector<string> &names) {
+    string filename = cachefilename(username);
+    if (filename.empty()) return;
+
+    struct stat st;
+    if (lstat(WS_GROUPCACHE, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        (st.st_uid != 0 && st.st_uid != (uid_t)config.dbuid) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        return;
+    }
+    if (!canraise()) return;
+
+    ostringstream out;
+    out << gid << " " << time(NULL) << endl;
+    for (const string &n: names) {
+        out << n << endl;
+    }
+    string data = out.str();
+
+    // write as DB user into a temporary file and rename, like DB entries. The
+    // name is unique, so a file left by a killed process does not block the cache
+    string tmpname = filename + ".XXXXXX";
+    try {
+        WsPrivileges priv({CAP_DAC_OVERRIDE, CAP_CHOWN});
+        priv.asdb(config.dbuid, config.dbgid);
+        int fd = mkstemp(&tmpname[0]);
+        if (fd >= 0) {
+            bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+            ok = (fchmod(fd, 0644) == 0) && ok;
+#ifndef SETUID
+            ok = (fchown(fd, config.dbuid, config.dbgid) == 0) && ok;
+#endif
+            close(fd);
+            if (!ok || rename(tmpname.c_str(), filename.c_str()) != 0) {
+                unlink(tmpname.c_str());
+            }
+        }
+    } catch (const WsError &e) {
+        // the cache is an optimization, the names are resolved already
+    }
+}
+
+
+const vector<string>& WsGroups::getgroupnames(const string &username, const gid_t gid) {
+    pair<string, gid_t> key(username, gid);
+    auto it = usergroups.find(key);
+    if (it != usergroups.end()) {
+        return it->second;
+    }
+
+    const WsConfig &config = WsConfig::get();
+    vector<string> &names = usergroups[key];
+    if (config.groupcachettl > 0 && readcache(username, gid, config, names)) {
+        return names;
+    }
+
+    // resolve all gids in one pass, names are memoized by gid
+    string name;
+    for (gid_t g: getgids(username, gid)) {
+        if (getgroupname(g, name)) {
+            names.push_back(name);
+        }
+    }
+
+    if (config.groupcachettl > 0) {
+        writecache(username, gid, config, names);
+    }
+    return names;
+}
@@ -0,0 +1,67 @@
+#ifndef WSGROUPS_H
+#define WSGROUPS_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+using namespace std;
+
+// per user cache files, only used if groupcachettl is set in ws.conf
+// and the directory exists and is owned by dbuid or root
+#ifndef WS_GROUPCACHE
+#define WS_GROUPCACHE "/var/cache/workspace/groups"
+#endif
+
+/*
+ * resolution of group lists and group names
+ *
+ * lookups go to NSS, which may mean a directory service round trip per group,
+ * so results are kept for the lifetime of the process (ws_brokerd clears them
+ * periodically), and the group names of a
+ * user can be kept in a cache file for groupcachettl seconds.
+ */
+class WsGroups {
+
+public:
+    // names of all groups of user, like getgrouplist() with gid added, without size limit
+    static const vector<string>& getgroupnames(const string &username, const gid_t gid);
+
+    // name of group gid, false if gid has no group entry
+    static bool getgroupname(const gid_t gid, string &name);
+
+    // name and home directory of uid, false if uid has no passwd entry
+    static bool getuser(const uid_t uid, string &name, string &home);
+
+    // forget all memoized results, for long running processes
+    static void clear();
+};
+
+#endif
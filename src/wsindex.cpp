@@ -0,0 +1,431 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <set>
+#include <cstring>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "wsdb.h"
+#include "wsindex.h"
+#include "wsshards.h"
+
+using namespace std;
+
+static const char index_magic[8] = { 'W','S','I','N','D','E','X','\0' };
+static const char strings_magic[8] = { 'W','S','I','S','T','R','\0','\0' };
+
+static_assert(sizeof(WsIndexRecord) == 96, "index record layout changed, bump WSINDEX_VERSION");
+
+
+static string indexname(const string dbdir) {
+    return dbdir + "/.ws_index";
+}
+
+static string stringsname(const string dbdir) {
+    return dbdir + "/.ws_index.str";
+}
+
+static string lockname(const string dbdir) {
+    return dbdir + "/.ws_index.lock";
+}
+
+static void split_filename(const string filename, string &dbdir, string &name) {
+    size_t pos = filename.rfind('/');
+    if (pos == string::npos) {
+        dbdir = ".";
+        name = filename;
+    } else {
+        dbdir = filename.substr(0, pos);
+        name = filename.substr(pos+1);
+    }
+}
+
+// write complete buffer at offset
+static bool pwrite_all(int fd, const char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t w = pwrite(fd, buf, len, offset);
+        if (w <= 0) return false;
+        buf += w;
+        len -= w;
+        offset += w;
+    }
+    return true;
+}
+
+static bool read_header(int fd, const char *magic, WsIndexHeader &hdr) {
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) return false;
+    if (memcmp(hdr.magic, magic, sizeof(hdr.magic)) != 0) return false;
+    if (hdr.version != WSINDEX_VERSION || hdr.recordsize != sizeof(WsIndexRecord)) return false;
+    return true;
+}
+
+static void make_header(WsIndexHeader &hdr, const char *magic, uint64_t generation) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, magic, sizeof(hdr.magic));
+    hdr.version = WSINDEX_VERSION;
+    hdr.recordsize = sizeof(WsIndexRecord);
+    hdr.generation = generation;
+}
+
+// add a string to a string table blob which starts at base in the file
+static WsIndexString add_string(string &blob, uint64_t base, const string s) {
+    WsIndexString r;
+    r.offset = base + blob.size();
+    r.length = s.size();
+    blob += s;
+    return r;
+}
+
+// fill record and the strings it needs, strings go at file offset base,
+// without entry this is a record marking name as removed
+static void make_record(WsIndexRecord &r, string &blob, uint64_t base, const string name,
+                        WsDB *entry, long creation) {
+    memset(&r, 0, sizeof(r));
+    r.hash = WsIndex::hash(name);
+    size_t dash = name.find('-');
+    r.ownerlength = (dash == string::npos) ? 0 : dash;
+    r.name = add_string(blob, base, name);
+    if (entry == NULL) {
+        r.flags = WSINDEX_REMOVED;
+        r.workspace = r.acctcode = r.mailaddress = r.group = r.comment = add_string(blob, base, "");
+        return;
+    }
+    r.expiration = entry->getexpiration();
+    r.released = entry->getreleased();
+    r.creation = creation;
+    r.extensions = entry->getextension();
+    r.reminder = entry->getreminder();
+    r.workspace = add_string(blob, base, entry->getwsdir());
+    r.acctcode = add_string(blob, base, entry->getacctcode());
+    r.mailaddress = add_string(blob, base, entry->getmailaddress());
+    r.group = add_string(blob, base, entry->getgroup());
+    r.comment = add_string(blob, base, entry->getcomment());
+}
+
+
+/*
+ * FNV-1a, stable over versions and platforms as it is stored in the index
+ */
+uint64_t WsIndex::hash(const string &s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool WsIndex::exists(const string dbdir) {
+    return access(indexname(dbdir).c_str(), F_OK) == 0;
+}
+
+
+/*
+ * map index of a directory for reading
+ */
+WsIndex::WsIndex(const string _dbdir)
+    : dbdir(_dbdir), records(NULL), recordsmapsize(0), strings(NULL), stringsmapsize(0), nrrecords(0), ok(false)
+{
+    // index first, strings are always written before the records pointing to them
+    int ifd = open(indexname(dbdir).c_str(), O_RDONLY);
+    if (ifd < 0) return;
+    int sfd = open(stringsname(dbdir).c_str(), O_RDONLY);
+    if (sfd < 0) {
+        close(ifd);
+        return;
+    }
+
+    WsIndexHeader ihdr, shdr;
+    struct stat ist, sst;
+    if (read_header(ifd, index_magic, ihdr) && read_header(sfd, strings_magic, shdr) &&
+        ihdr.generation == shdr.generation &&
+        fstat(ifd, &ist) == 0 && fstat(sfd, &sst) == 0) {
+
+        recordsmapsize = ist.st_size;
+        stringsmapsize = sst.st_size;
+        void *p = mmap(NULL, recordsmapsize, PROT_READ, MAP_SHARED, ifd, 0);
+        void *q = mmap(NULL, stringsmapsize, PROT_READ, MAP_SHARED, sfd, 0);
+        if (p != MAP_FAILED && q != MAP_FAILED) {
+            records = (const char *)p;
+            strings = (const char *)q;
+            // a partial record at the end is a crashed writer, ignore it
+            nrrecords = (recordsmapsize - sizeof(WsIndexHeader)) / sizeof(WsIndexRecord);
+            ok = true;
+        } else {
+            if (p != MAP_FAILED) munmap(p, recordsmapsize);
+            if (q != MAP_FAILED) munmap(q, stringsmapsize);
+        }
+    }
+    close(ifd);
+    close(sfd);
+}
+
+WsIndex::~WsIndex() {
+    unmap();
+}
+
+void WsIndex::unmap() {
+    if (records) munmap((void *)records, recordsmapsize);
+    if (strings) munmap((void *)strings, stringsmapsize);
+    records = strings = NULL;
+    ok = false;
+}
+
+string WsIndex::getstring(const WsIndexString &s) {
+    if ((uint64_t)s.offset + s.length > stringsmapsize) return "";
+    return string(strings + s.offset, s.length);
+}
+
+string WsIndex::getowner(const WsIndexRecord *r) {
+    return getstring(r->name).substr(0, r->ownerlength);
+}
+
+/*
+ * get latest record of each entry, in order of first appearance
+ */
+vector<const WsIndexRecord*> WsIndex::entries() {
+    vector<const WsIndexRecord*> result;
+    if (!ok) return result;
+
+    const WsIndexRecord *recs = (const WsIndexRecord *)(records + sizeof(WsIndexHeader));
+    // position of entry in result for each name
+    unordered_map<string, size_t> pos;
+    pos.reserve(nrrecords);
+    for (size_t i=0; i<nrrecords; i++) {
+        const WsIndexRecord *r = &recs[i];
+        // skip records pointing behind string table, from writer appending after we mapped
+        if ((uint64_t)r->comment.offset + r->comment.length > stringsmapsize) continue;
+        string name(strings + r->name.offset, r->name.length);
+        auto it = pos.find(name);
+        if (it == pos.end()) {
+            pos[name] = result.size();
+            result.push_back(r);
+        } else {
+            result[it->second] = r;
+        }
+    }
+
+    // drop removed entries
+    vector<const WsIndexRecord*> current;
+    current.reserve(result.size());
+    for (const WsIndexRecord *r: result) {
+        if (!(r->flags & WSINDEX_REMOVED)) current.push_back(r);
+    }
+    return current;
+}
+
+/*
+ * find latest record of an entry, search backwards as the latest record wins
+ */
+const WsIndexRecord* WsIndex::find(const string name) {
+    if (!ok) return NULL;
+    uint64_t h = hash(name);
+    const WsIndexRecord *recs = (const WsIndexRecord *)(records + sizeof(WsIndexHeader));
+    for (size_t i=nrrecords; i>0; i--) {
+        const WsIndexRecord *r = &recs[i-1];
+        if (r->hash != h) continue;
+        if ((uint64_t)r->comment.offset + r->comment.length > stringsmapsize) continue;
+        if (r->name.length != name.size() || memcmp(strings + r->name.offset, name.data(), name.size()) != 0) continue;
+        if (r->flags & WSINDEX_REMOVED) return NULL;
+        return r;
+    }
+    return NULL;
+}
+
+
+/*
+ * append a record for DB entry filename to the index, if there is one
+ */
+static void append(const string filename, WsDB *entry) {
+    string dbdir, name;
+    split_filename(filename, dbdir, name);
+
+    if (!WsIndex::exists(dbdir)) return;
+
+    int lfd = open(lockname(dbdir).c_str(), O_RDWR | O_CREAT, 0644);
+    if (lfd < 0) {
+        cerr << "Warning: could not lock DB index in " << dbdir << ", index is outdated now." << endl;
+        return;
+    }
+    flock(lfd, LOCK_EX);
+
+    int ifd = open(indexname(dbdir).c_str(), O_RDWR);
+    int sfd = open(stringsname(dbdir).c_str(), O_RDWR);
+    WsIndexHeader ihdr, shdr;
+    struct stat ist, sst;
+    bool done = false;
+    if (ifd >= 0 && sfd >= 0 &&
+        read_header(ifd, index_magic, ihdr) && read_header(sfd, strings_magic, shdr) &&
+        ihdr.generation == shdr.generation &&
+        fstat(ifd, &ist) == 0 && fstat(sfd, &sst) == 0) {
+
+        long creation = 0;
+        struct stat est;
+        if (entry != NULL && stat(filename.c_str(), &est) == 0) {
+            creation = est.st_ctime;
+        }
+
+        WsIndexRecord r;
+        string blob;
+        make_record(r, blob, sst.st_size, name, entry, creation);
+
+        // strings first, so readers never see a record without its strings,
+        // a record is placed after the last complete one
+        off_t recpos = sizeof(WsIndexHeader) +
+                       ((ist.st_size - sizeof(WsIndexHeader)) / sizeof(WsIndexRecord)) * sizeof(WsIndexRecord);
+        done = pwrite_all(sfd, blob.data(), blob.size(), sst.st_size) &&
+               pwrite_all(ifd, (const char *)&r, sizeof(r), recpos);
+    }
+    if (!done) {
+        cerr << "Warning: could not update DB index in " << dbdir << ", run ws_index --rebuild." << endl;
+    }
+    if (ifd >= 0) close(ifd);
+    if (sfd >= 0) close(sfd);
+
+    flock(lfd, LOCK_UN);
+    close(lfd);
+}
+
+void WsIndex::update(const string filename, WsDB &entry) {
+    append(filename, &entry);
+}
+
+void WsIndex::remove(const string filename) {
+    append(filename, NULL);
+}
+
+
+/*
+ * write a new index from the YAML entries of dbdir and replace the old one
+ */
+bool WsIndex::rebuild(const string dbdir, const int dbuid, const int dbgid) {
+    int lfd = open(lockname(dbdir).c_str(), O_RDWR | O_CREAT, 0644);
+    if (lfd < 0) {
+        cerr << "Error: could not create lock file in " << dbdir << endl;
+        return false;
+    }
+    if (fchown(lfd, dbuid, dbgid)) {
+        cerr << "Warning: could not change owner of " << lockname(dbdir) << endl;
+    }
+    flock(lfd, LOCK_EX);
+
+    string newindex = indexname(dbdir) + ".new";
+    string newstrings = stringsname(dbdir) + ".new";
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t generation = ((uint64_t)now.tv_sec << 20) ^ now.tv_nsec ^ getpid();
+
+    WsIndexHeader ihdr, shdr;
+    make_header(ihdr, index_magic, generation);
+    make_header(shdr, strings_magic, generation);
+
+    string recs((const char *)&ihdr, sizeof(ihdr));
+    string blob;
+
+    // the directory and its shards, see WsShards
+    vector<string> dirs = WsShards::dirs(dbdir);
+    set<string> seen;
+    long count = 0;
+    for (const string &d: dirs) {
+        DIR *dir = opendir(d.c_str());
+        if (dir == NULL) {
+            cerr << "Error: could not read DB directory " << d << endl;
+            flock(lfd, LOCK_UN);
+            close(lfd);
+            return false;
+        }
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            string name = de->d_name;
+            // entries are <user>-<name>, no dotfiles
+            if (name[0] == '.' || name.find('-') == string::npos) continue;
+            if (dirs.size() > 1 && !seen.insert(name).second) continue;
+            string filename = d + "/" + name;
+            struct stat st;
+            if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            try {
+                WsDB entry(filename, dbuid, dbgid);
+                WsIndexRecord r;
+                make_record(r, blob, sizeof(shdr), name, &entry, st.st_ctime);
+                recs.append((const char *)&r, sizeof(r));
+                count++;
+            } catch (...) {
+                cerr << "Warning: skipping unreadable DB entry " << filename << endl;
+            }
+        }
+        closedir(dir);
+    }
+
+    bool ok = true;
+    int ifd = open(newindex.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int sfd = open(newstrings.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ifd < 0 || sfd < 0) {
+        ok = false;
+    } else {
+        ok = pwrite_all(sfd, (const char *)&shdr, sizeof(shdr), 0) &&
+             pwrite_all(sfd, blob.data(), blob.size(), sizeof(shdr)) &&
+             pwrite_all(ifd, recs.data(), recs.size(), 0) &&
+             fsync(sfd) == 0 && fsync(ifd) == 0;
+        if (fchown(ifd, dbuid, dbgid) || fchown(sfd, dbuid, dbgid)) {
+            cerr << "Warning: could not change owner of index in " << dbdir << endl;
+        }
+    }
+    if (ifd >= 0) close(ifd);
+    if (sfd >= 0) close(sfd);
+
+    // strings before index, readers detect the generation mismatch in between
+    if (ok) {
+        ok = rename(newstrings.c_str(), stringsname(dbdir).c_str()) == 0 &&
+             rename(newindex.c_str(), indexname(dbdir).c_str()) == 0;
+    }
+    if (!ok) {
+        cerr << "Error: could not write index for " << dbdir << endl;
+        unlink(newindex.c_str());
+        unlink(newstrings.c_str());
+    } else {
+        cerr << "Info: indexed " << count << " entries in " << dbdir << endl;
+    }
+
+    flock(lfd, LOCK_UN);
+    close(lfd);
+    return ok;
+}
@@ -0,0 +1,136 @@
+#ifndef WSINDEX_H
+#define WSINDEX_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+class WsDB;
+
+/*
+ * binary index of a DB directory
+ *
+ * the YAML files stay the source of truth, the index is a compact copy of them
+ * which allows to list and query a DB directory without opening each entry.
+ *
+ *   <dbdir>/.ws_index       header followed by fixed size records
+ *   <dbdir>/.ws_index.str   string table the records point into
+ *   <dbdir>/.ws_index.lock  serializes writers
+ *
+ * records are only appended, a later record for an entry name supersedes an
+ * earlier one, a record with WSINDEX_REMOVED marks the entry as gone.
+ * ws_index --rebuild compacts the index, creates it, or recovers it from the YAML files.
+ * The index is only maintained by the tools if it exists, so creating it is the
+ * way to enable it for a DB directory.
+ */
+
+#define WSINDEX_VERSION 1
+
+#define WSINDEX_REMOVED 1
+
+struct WsIndexString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct WsIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordsize;
+    uint64_t generation;    // has to match between index and string table
+};
+
+struct WsIndexRecord {
+    uint64_t hash;          // hash of entry name
+    int64_t expiration;
+    int64_t released;
+    int64_t creation;       // ctime of the DB entry
+    int32_t extensions;
+    int32_t reminder;
+    uint32_t flags;
+    uint32_t ownerlength;   // entry name is <owner>-<workspace name>
+    WsIndexString name;
+    WsIndexString workspace;
+    WsIndexString acctcode;
+    WsIndexString mailaddress;
+    WsIndexString group;
+    WsIndexString comment;
+};
+
+
+class WsIndex {
+
+private:
+    string dbdir;
+    const char *records;
+    size_t recordsmapsize;
+    const char *strings;
+    size_t stringsmapsize;
+    size_t nrrecords;
+    bool ok;
+
+    void unmap();
+
+public:
+    // open and map the index of a DB directory, check valid() before use
+    WsIndex(const string dbdir);
+    ~WsIndex();
+
+    // true if index exists and is consistent
+    bool valid() {
+        return ok;
+    }
+
+    // current entries in index order, each entry name only once
+    vector<const WsIndexRecord*> entries();
+
+    // latest record for entry name, NULL if not in index or removed
+    const WsIndexRecord* find(const string name);
+
+    // get a string from string table
+    string getstring(const WsIndexString &s);
+
+    // owner part of entry name
+    string getowner(const WsIndexRecord *r);
+
+    // writer side, all do nothing if there is no index in directory of filename
+    static void update(const string filename, WsDB &entry);
+    static void remove(const string filename);
+
+    // create or recreate the index from the YAML files
+    static bool rebuild(const string dbdir, const int dbuid, const int dbgid);
+
+    static bool exists(const string dbdir);
+    static uint64_t hash(const string &s);
+};
+
+#endif
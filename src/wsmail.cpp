@@ -0,0 +1,265 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "wsmail.h"
+
+using namespace std;
+
+
+/*
+ * line based connection to smtp server
+ */
+class SmtpConnection {
+private:
+    int fd;
+    string inbuf;
+
+public:
+    SmtpConnection() : fd(-1) {}
+    ~SmtpConnection() { if (fd >= 0) close(fd); }
+
+    bool connect(const string smtphost) {
+        string host = smtphost, port = "25";
+        size_t colon = smtphost.rfind(':');
+        if (colon != string::npos && smtphost.find(':') == colon) {
+            host = smtphost.substr(0, colon);
+            port = smtphost.substr(colon+1);
+        }
+        if (host.empty()) host = "localhost";
+
+        struct addrinfo hints, *res, *rp;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+        for (rp = res; rp != NULL; rp = rp->ai_next) {
+            fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (fd < 0) continue;
+            // do not hang forever on a dead server
+            struct timeval tv = { 60, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        return fd >= 0;
+    }
+
+    bool send(const string &data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // read a (multiline) reply, returns code or -1 on error
+    int reply() {
+        while (true) {
+            size_t eol;
+            while ((eol = inbuf.find("\r\n")) == string::npos) {
+                char buf[1024];
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n <= 0) return -1;
+                inbuf.append(buf, n);
+            }
+            string line = inbuf.substr(0, eol);
+            inbuf.erase(0, eol+2);
+            if (line.size() < 3) return -1;
+            // "250-..." is continued, "250 ..." is last line
+            if (line.size() > 3 && line[3] == '-') continue;
+            return atoi(line.substr(0, 3).c_str());
+        }
+    }
+
+    int command(const string &cmd) {
+        if (!send(cmd + "\r\n")) return -1;
+        return reply();
+    }
+};
+
+
+// build message like the python version, multipart with one html part
+static string buildmessage(const string from, const string to, const string subject, const string text) {
+    ostringstream boundary;
+    boundary << "===============" << time(NULL) << getpid() << "==";
+
+    ostringstream msg;
+    msg << "Content-Type: multipart/mixed; boundary=\"" << boundary.str() << "\"\r\n";
+    msg << "MIME-Version: 1.0\r\n";
+    msg << "From: " << from << "\r\n";
+    msg << "To: " << to << "\r\n";
+    msg << "Subject: " << subject << "\r\n";
+    msg << "\r\n";
+    msg << text << "\r\n";
+    msg << "--" << boundary.str() << "\r\n";
+    msg << "Content-Type: text/html; charset=\"us-ascii\"\r\n";
+    msg << "MIME-Version: 1.0\r\n";
+    msg << "Content-Transfer-Encoding: 7bit\r\n";
+    msg << "\r\n";
+    msg << text << "\r\n";
+    msg << "--" << boundary.str() << "--\r\n";
+
+    // normalize line ends and escape lines starting with a dot
+    string in = msg.str(), out;
+    bool linestart = true;
+    for (size_t i=0; i<in.size(); i++) {
+        char c = in[i];
+        if (c == '\n' && (i == 0 || in[i-1] != '\r')) {
+            out += "\r\n";
+            linestart = true;
+            continue;
+        }
+        if (linestart && c == '.') out += '.';
+        out += c;
+        linestart = (c == '\n');
+    }
+    return out;
+}
+
+
+SmtpSession::SmtpSession(const string _smtphost) : smtphost(_smtphost), conn(NULL), clean(true) {}
+
+SmtpSession::~SmtpSession() {
+    if (conn) conn->command("QUIT");
+    drop();
+}
+
+void SmtpSession::drop() {
+    delete conn;
+    conn = NULL;
+    clean = true;
+}
+
+MailResult SmtpSession::open(int &code) {
+    conn = new SmtpConnection();
+    if (!conn->connect(smtphost)) {
+        drop();
+        return MAIL_SOCKETERROR;
+    }
+
+    code = conn->reply();
+    if (code != 220) {
+        drop();
+        return code < 0 ? MAIL_SOCKETERROR : MAIL_ERROR;
+    }
+
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) != 0) strcpy(hostname, "localhost");
+    hostname[sizeof(hostname)-1] = '\0';
+
+    code = conn->command(string("EHLO ") + hostname);
+    if (code != 250 && code >= 0) {
+        code = conn->command(string("HELO ") + hostname);
+    }
+    if (code != 250) {
+        drop();
+        return code < 0 ? MAIL_SOCKETERROR : MAIL_ERROR;
+    }
+    return MAIL_OK;
+}
+
+// addresses go into SMTP commands and headers, a line break or bracket in one
+// could add recipients or headers
+static bool validaddress(const string &address) {
+    return !address.empty() && address.find_first_of("\r\n<>") == string::npos;
+}
+
+MailResult SmtpSession::send(const string from, const string to, const string subject, const string text, int &code) {
+    code = -1;
+    if (!validaddress(from)) return MAIL_SENDERREFUSED;
+    if (!validaddress(to)) return MAIL_RECIPIENTREFUSED;
+    // a connection kept from an earlier mail can have been closed by the server,
+    // that is only seen on the first command, so it is opened again once
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = conn != NULL;
+        if (!conn) {
+            MailResult r = open(code);
+            if (r != MAIL_OK) return r;
+        }
+        if (!clean) {
+            code = conn->command("RSET");
+            clean = code == 250;
+        }
+        if (clean) {
+            code = conn->command("MAIL FROM:<" + from + ">");
+        }
+        if (code < 0 || (reused && code == 421) || !clean) {
+            drop();
+            if (reused) continue;
+            return MAIL_SOCKETERROR;
+        }
+        break;
+    }
+    if (!conn) return MAIL_SOCKETERROR;
+
+    clean = false;
+    if (code != 250) return MAIL_SENDERREFUSED;
+
+    code = conn->command("RCPT TO:<" + to + ">");
+    if (code < 0) { drop(); return MAIL_SOCKETERROR; }
+    if (code != 250 && code != 251) return MAIL_RECIPIENTREFUSED;
+
+    code = conn->command("DATA");
+    if (code < 0) { drop(); return MAIL_SOCKETERROR; }
+    if (code != 354) return MAIL_ERROR;
+
+    string msg = buildmessage(from, to, subject, text);
+    if (!conn->send(msg)) { drop(); return MAIL_SOCKETERROR; }
+    code = conn->command(".");
+    if (code < 0) { drop(); return MAIL_SOCKETERROR; }
+    // the transaction is over after the reply to the data, also if it was refused
+    clean = true;
+    if (code != 250) return MAIL_ERROR;
+    return MAIL_OK;
+}
+
+
+MailResult sendmail(const string smtphost, const string from, const string to,
+                    const string subject, const string text) {
+    SmtpSession session(smtphost);
+    int code;
+    return session.send(from, to, subject, text, code);
+}
@@ -0,0 +1,78 @@
+#ifndef WSMAIL_H
+#define WSMAIL_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+
+using namespace std;
+
+enum MailResult {
+    MAIL_OK = 0,
+    MAIL_SOCKETERROR,           // could not connect or talk to smtp host
+    MAIL_SENDERREFUSED,
+    MAIL_RECIPIENTREFUSED,
+    MAIL_ERROR                  // any other protocol error
+};
+
+class SmtpConnection;
+
+/*
+ * minimal SMTP client, one connection for many mails
+ *
+ * smtphost is "host" or "host:port", port defaults to 25
+ */
+class SmtpSession {
+private:
+    string smtphost;
+    SmtpConnection *conn;
+    bool clean;                 // no transaction left open by a failed mail
+
+    SmtpSession(const SmtpSession&);
+    SmtpSession& operator=(const SmtpSession&);
+
+    MailResult open(int &code);
+    void drop();
+
+public:
+    SmtpSession(const string smtphost);
+    ~SmtpSession();
+
+    // send one mail, connects on first use and again if the server closed the
+    // connection. code is the last reply of the server, -1 if there was none,
+    // a 4xx code or MAIL_SOCKETERROR mean the mail can be tried again later
+    MailResult send(const string from, const string to, const string subject, const string text, int &code);
+};
+
+/*
+ * send one mail with its own connection
+ */
+MailResult sendmail(const string smtphost, const string from, const string to,
+                    const string subject, const string text);
+
+#endif
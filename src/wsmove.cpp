@@ -0,0 +1,978 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "wsmove.h"
+#include "wsdelete.h"
+#include "wsqueue.h"
+
+using namespace std;
+
+// files of a directory are handed out in batches of this size
+static const size_t batchsize = 64;
+
+// bytes per copy_file_range/sendfile call
+static const size_t chunksize = 1<<30;
+
+// the journal is synced after this many entries or seconds
+static const size_t checkpointentries = 4096;
+static const double checkpointseconds = 10.0;
+
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string stripslash(string p) {
+    while (p.size() > 1 && p[p.size()-1] == '/') p.erase(p.size()-1);
+    return p;
+}
+
+// split path into parent directory and name
+static void splitpath(const string path, string &dir, string &name) {
+    size_t pos = path.rfind('/');
+    dir = pos == string::npos ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+    name = pos == string::npos ? path : path.substr(pos+1);
+}
+
+static string joinpath(const string dir, const string name) {
+    if (dir.empty()) return name;
+    return dir + "/" + name;
+}
+
+// journal of source is a hidden file next to it, in a directory only root can write
+static string journalname(const string source) {
+    string dir, name;
+    splitpath(stripslash(source), dir, name);
+    return joinpath(dir, "." + name + ".wsmove");
+}
+
+
+/*
+ * checkpoint journal of a move
+ *
+ * the journal starts with a header naming source and destination, followed by
+ * one line per finished entry, "F path" for files and "D path" for directories
+ * with their complete contents, and "C" once everything is copied.
+ * Paths are relative to the top of the tree, with newlines and backslashes escaped.
+ *
+ * entries are buffered and written at checkpoints, after a syncfs() of the
+ * destination, so every entry in the journal is on disk in the destination.
+ */
+class MoveJournal {
+
+private:
+    string filename;
+    int fd;
+    int syncfd;
+    mutex lock;
+    string buffer;
+    size_t buffered;
+    double lastcheckpoint;
+    unordered_set<string> done;
+
+    static string escape(const string s) {
+        string r;
+        for (char c: s) {
+            if (c == '\\') r += "\\\\";
+            else if (c == '\n') r += "\\n";
+            else r += c;
+        }
+        return r;
+    }
+
+    static string unescape(const string s) {
+        string r;
+        for (size_t i=0; i<s.size(); i++) {
+            if (s[i] == '\\' && i+1 < s.size()) {
+                i++;
+                r += s[i] == 'n' ? '\n' : s[i];
+            } else {
+                r += s[i];
+            }
+        }
+        return r;
+    }
+
+    bool writeall(const string data) {
+        size_t pos = 0;
+        while (pos < data.size()) {
+            ssize_t n = write(fd, data.data() + pos, data.size() - pos);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            pos += n;
+        }
+        return true;
+    }
+
+    bool checkpoint() {
+        if (syncfd >= 0 && buffered > 0) syncfs(syncfd);
+        bool ok = writeall(buffer) && fdatasync(fd) == 0;
+        buffer.clear();
+        buffered = 0;
+        lastcheckpoint = now();
+        return ok;
+    }
+
+public:
+    string source;
+    string dest;
+    bool complete;
+
+    MoveJournal(const string _filename) : filename(_filename), fd(-1), syncfd(-1), buffered(0), lastcheckpoint(now()), complete(false) {}
+
+    ~MoveJournal() {
+        if (fd >= 0) close(fd);
+    }
+
+    // read an existing journal, false if there is none or it is not ours
+    bool read() {
+        int rfd = open(filename.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (rfd < 0) return false;
+        struct stat st;
+        if (fstat(rfd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+            close(rfd);
+            return false;
+        }
+        string data;
+        char buf[65536];
+        ssize_t n;
+        while ((n = ::read(rfd, buf, sizeof(buf))) > 0) {
+            data.append(buf, n);
+        }
+        close(rfd);
+
+        // a torn last line of an interrupted write is ignored
+        vector<string> lines;
+        size_t pos = 0, nl;
+        while ((nl = data.find('\n', pos)) != string::npos) {
+            lines.push_back(data.substr(pos, nl - pos));
+            pos = nl + 1;
+        }
+        if (lines.size() < 3 || lines[0] != "wsmove 1") return false;
+        source = unescape(lines[1]);
+        dest = unescape(lines[2]);
+        for (size_t i=3; i<lines.size(); i++) {
+            const string &l = lines[i];
+            if (l == "C") {
+                complete = true;
+            } else if (l.size() > 2 && (l[0] == 'F' || l[0] == 'D') && l[1] == ' ') {
+                done.insert(l.substr(0, 2) + unescape(l.substr(2)));
+            }
+        }
+        return true;
+    }
+
+    // start a new journal for source and dest
+    bool create(const string _source, const string _dest) {
+        source = _source;
+        dest = _dest;
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        return writeall("wsmove 1\n" + escape(source) + "\n" + escape(dest) + "\n") && fdatasync(fd) == 0;
+    }
+
+    // continue an existing journal
+    bool append() {
+        fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+        return fd >= 0;
+    }
+
+    // checkpoints sync the filesystem of this fd before writing the journal
+    void setsyncfd(int _syncfd) {
+        syncfd = _syncfd;
+    }
+
+    // was entry finished by an earlier run, kind is 'F' or 'D'
+    bool isdone(char kind, const string path) const {
+        if (done.empty()) return false;
+        return done.count(string(1, kind) + " " + path) > 0;
+    }
+
+    void record(char kind, const string path) {
+        lock_guard<mutex> l(lock);
+        buffer += string(1, kind) + " " + escape(path) + "\n";
+        buffered++;
+        if (buffered >= checkpointentries || now() - lastcheckpoint >= checkpointseconds) {
+            checkpoint();
+        }
+    }
+
+    // everything is copied, only removal of source is left
+    bool setcomplete() {
+        lock_guard<mutex> l(lock);
+        buffer += "C\n";
+        buffered++;
+        complete = true;
+        return checkpoint();
+    }
+
+    void remove() {
+        if (fd >= 0) close(fd);
+        fd = -1;
+        unlink(filename.c_str());
+    }
+};
+
+
+class TreeMover {
+
+private:
+    // a directory, its metadata is set when the last task referring to it is done
+    struct Node {
+        Node *parent;
+        string srcname;
+        string dstname;
+        string path;                // relative to the top of the tree
+        int srcfd;
+        int dstfd;
+        struct stat st;
+        atomic<long> pending;       // tasks still working on this directory
+        atomic<bool> failed;        // something below could not be copied
+
+        Node(Node *_parent, const string _srcname, const string _dstname, const string _path)
+            : parent(_parent), srcname(_srcname), dstname(_dstname), path(_path),
+              srcfd(-1), dstfd(-1), pending(1), failed(false) {}
+    };
+
+    // read a directory if files is empty, copy files in node otherwise
+    struct Task {
+        Node *node;
+        vector<string> files;
+    };
+
+    // first copy of a file with more than one link, the others become links to it
+    struct Link {
+        string path;                // relative to the top of the tree
+        bool copied;
+        dev_t dev;
+        ino_t ino;                  // of the copy
+    };
+
+    string source;
+    string dstname;
+    int srcparentfd;
+    int dstparentfd;
+    MoveJournal &journal;
+    WorkQueues<Task> queues;
+    atomic<bool> done;
+    atomic<uint64_t> files, dirs, bytes, errors;
+    // every directory waiting for its subdirectories keeps two fds, deeper trees
+    // than the fds the process can have are copied sequentially below maxfds
+    atomic<long> openfds;
+    long maxfds;
+    map<pair<dev_t, ino_t>, Link> links;
+    mutex linklock;
+    condition_variable linkdone;
+    mutex errorlock;
+    string firsterror;
+
+    void seterror(const string path, int err) {
+        errors++;
+        lock_guard<mutex> l(errorlock);
+        if (firsterror.empty()) {
+            firsterror = joinpath(source, path) + ": " + strerror(err);
+        }
+    }
+
+    // copy file contents from the current offsets to end of file
+    bool copydata(int in, int out, uint64_t &copied) {
+        ssize_t n;
+#ifdef SYS_copy_file_range
+        // in kernel copy, server side or reflink where the filesystem can do it
+        while ((n = syscall(SYS_copy_file_range, in, NULL, out, NULL, chunksize, 0)) != 0) {
+            if (n > 0) {
+                copied += n;
+            } else if (errno != EINTR) {
+                if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) break;
+                return false;
+            }
+        }
+        if (n == 0) return true;
+#endif
+        while ((n = sendfile(out, in, NULL, chunksize)) != 0) {
+            if (n > 0) {
+                copied += n;
+            } else if (errno != EINTR) {
+                if (errno == EINVAL || errno == ENOSYS) break;
+                return false;
+            }
+        }
+        if (n == 0) return true;
+
+        vector<char> buf(1<<20);
+        while ((n = read(in, buf.data(), buf.size())) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            ssize_t pos = 0;
+            while (pos < n) {
+                ssize_t w = write(out, buf.data() + pos, n - pos);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                pos += w;
+            }
+            copied += n;
+        }
+        return true;
+    }
+
+    // copy extended attributes, attributes the destination does not support
+    // or we may not set (trusted.*, security.* without privileges) are skipped
+    bool copyxattrs(int srcfd, int dstfd) {
+        ssize_t len;
+        vector<char> names;
+        while ((len = flistxattr(srcfd, NULL, 0)) > 0) {
+            names.resize(len);
+            len = flistxattr(srcfd, names.data(), names.size());
+            if (len >= 0 || errno != ERANGE) break;
+        }
+        if (len < 0) return errno == ENOTSUP;
+
+        vector<char> value;
+        for (ssize_t pos = 0; pos < len; pos += strlen(&names[pos]) + 1) {
+            const char *name = &names[pos];
+            ssize_t size;
+            while ((size = fgetxattr(srcfd, name, NULL, 0)) >= 0) {
+                value.resize(size);
+                size = fgetxattr(srcfd, name, value.data(), value.size());
+                if (size >= 0 || errno != ERANGE) break;
+            }
+            if (size < 0) {
+                if (errno == ENODATA) continue;
+                return false;
+            }
+            if (fsetxattr(dstfd, name, value.data(), size, 0)) {
+                if (errno == ENOTSUP || errno == EPERM) continue;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // owner first, chown clears setuid bits, times last, everything else changes them.
+    // owner can only be set with privileges, without we keep the file our own like cp(1)
+    bool setmeta(int srcfd, int dstfd, const struct stat &st) {
+        if (fchown(dstfd, st.st_uid, st.st_gid) && errno != EPERM) return false;
+        if (fchmod(dstfd, st.st_mode & 07777)) return false;
+        if (!copyxattrs(srcfd, dstfd)) return false;
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        return futimens(dstfd, times) == 0;
+    }
+
+    // the first copy of a linked file is done, fd is the copy or -1 if it failed
+    void copiedlink(Link *link, int fd) {
+        if (link == NULL) return;
+        struct stat st;
+        lock_guard<mutex> l(linklock);
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            link->dev = st.st_dev;
+            link->ino = st.st_ino;
+        }
+        link->copied = true;
+        linkdone.notify_all();
+    }
+
+    /*
+     * link dstname in dstdir to the copy of first. The destination is walked
+     * without following symlinks, and the new link has to be the copy, so a
+     * tree changed meanwhile does not get links to files outside of it
+     */
+    bool linkto(const Link &first, int dstdir, const string dstname) {
+        string path = joinpath(this->dstname, first.path);
+        int dir = dup(dstparentfd);
+        size_t pos;
+        while (dir >= 0 && (pos = path.find('/')) != string::npos) {
+            int next = openat(dir, path.substr(0, pos).c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            close(dir);
+            dir = next;
+            path.erase(0, pos + 1);
+        }
+        if (dir < 0) return false;
+        bool ok = linkat(dir, path.c_str(), dstdir, dstname.c_str(), 0) == 0;
+        close(dir);
+        if (!ok) return false;
+
+        struct stat st;
+        if (fstatat(dstdir, dstname.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && st.st_dev == first.dev && st.st_ino == first.ino) {
+            return true;
+        }
+        unlinkat(dstdir, dstname.c_str(), 0);
+        return false;
+    }
+
+    // copy a non directory entry, an entry left over by an interrupted run is replaced
+    bool copyentry(int srcdir, const string srcname, int dstdir, const string dstname, const string path) {
+        struct stat st;
+        if (fstatat(srcdir, srcname.c_str(), &st, AT_SYMLINK_NOFOLLOW)) {
+            seterror(path, errno);
+            return false;
+        }
+        if (unlinkat(dstdir, dstname.c_str(), 0) && errno != ENOENT) {
+            seterror(path, errno);
+            return false;
+        }
+
+        // links of files copied by an earlier run of an interrupted move become copies
+        Link *link = NULL;
+        if (S_ISREG(st.st_mode) && st.st_nlink > 1) {
+            unique_lock<mutex> l(linklock);
+            auto it = links.find(make_pair(st.st_dev, st.st_ino));
+            if (it == links.end()) {
+                link = &links[make_pair(st.st_dev, st.st_ino)];
+                *link = Link{path, false, 0, 0};
+            } else {
+                linkdone.wait(l, [&it] { return it->second.copied; });
+                Link first = it->second;
+                l.unlock();
+                if (first.ino != 0 && linkto(first, dstdir, dstname)) return true;
+            }
+        }
+
+        if (S_ISREG(st.st_mode)) {
+            int in = openat(srcdir, srcname.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (in < 0) {
+                seterror(path, errno);
+                copiedlink(link, -1);
+                return false;
+            }
+            int out = openat(dstdir, dstname.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+            if (out < 0) {
+                seterror(path, errno);
+                close(in);
+                copiedlink(link, -1);
+                return false;
+            }
+            uint64_t copied = 0;
+            bool ok = copydata(in, out, copied) && setmeta(in, out, st);
+            if (!ok) seterror(path, errno);
+            copiedlink(link, ok ? out : -1);
+            if (close(out) && ok) {
+                seterror(path, errno);
+                ok = false;
+            }
+            close(in);
+            bytes += copied;
+            return ok;
+        }
+
+        if (S_ISLNK(st.st_mode)) {
+            vector<char> target(st.st_size + 1);
+            ssize_t n = readlinkat(srcdir, srcname.c_str(), target.data(), target.size());
+            if (n < 0 || n > st.st_size) {
+                seterror(path, n < 0 ? errno : EAGAIN);
+                return false;
+            }
+            target[n] = 0;
+            if (symlinkat(target.data(), dstdir, dstname.c_str())) {
+                seterror(path, errno);
+                return false;
+            }
+        } else {
+            // fifos, sockets and devices
+            if (mknodat(dstdir, dstname.c_str(), st.st_mode & (S_IFMT | 0777), st.st_rdev)) {
+                seterror(path, errno);
+                return false;
+            }
+        }
+
+        // fchmodat() can not be told to keep off symlinks everywhere, the mode given to mknodat() has to do
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        if ((fchownat(dstdir, dstname.c_str(), st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) && errno != EPERM)
+            || utimensat(dstdir, dstname.c_str(), times, AT_SYMLINK_NOFOLLOW)) {
+            seterror(path, errno);
+            return false;
+        }
+        return true;
+    }
+
+    int srcparent(Node *node) {
+        return node->parent ? node->parent->srcfd : srcparentfd;
+    }
+
+    int dstparent(Node *node) {
+        return node->parent ? node->parent->dstfd : dstparentfd;
+    }
+
+    // one task less for node, finish directories which are done, walking upwards
+    void finish(Node *node) {
+        while (node) {
+            if (--node->pending > 0) return;
+            if (node->dstfd >= 0) {
+                if (!setmeta(node->srcfd, node->dstfd, node->st)) {
+                    seterror(node->path, errno);
+                    node->failed = true;
+                }
+                // a directory with errors below has to be walked again by the next run
+                if (!node->failed) {
+                    journal.record('D', node->path);
+                    dirs++;
+                }
+                close(node->dstfd);
+                openfds--;
+            }
+            if (node->srcfd >= 0) {
+                close(node->srcfd);
+                openfds--;
+            }
+            Node *parent = node->parent;
+            if (parent == NULL) done = true;
+            else if (node->failed) parent->failed = true;
+            delete node;
+            node = parent;
+        }
+    }
+
+    void copyfiles(Node *node, const vector<string> &names) {
+        for (const string &name: names) {
+            string path = joinpath(node->path, name);
+            if (copyentry(node->srcfd, name, node->dstfd, name, path)) {
+                journal.record('F', path);
+                files++;
+            } else {
+                node->failed = true;
+            }
+        }
+    }
+
+    /*
+     * open directory srcname in srcdir and create and open dstname in dstdir,
+     * private until its contents are complete, the final mode is set at the end.
+     * On errors nothing is left open and errno is set
+     */
+    bool opendirs(int srcdir, const string srcname, int dstdir, const string dstname,
+                  int &srcfd, int &dstfd, struct stat &st) {
+        dstfd = -1;
+        srcfd = openat(srcdir, srcname.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (srcfd < 0) return false;
+        if (fstat(srcfd, &st) == 0 && (mkdirat(dstdir, dstname.c_str(), 0700) == 0 || errno == EEXIST)) {
+            dstfd = openat(dstdir, dstname.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dstfd >= 0) return true;
+        }
+        int err = errno;
+        close(srcfd);
+        srcfd = -1;
+        errno = err;
+        return false;
+    }
+
+    /*
+     * copy directory node and everything below with a constant number of fds,
+     * one directory at a time, like the deleter does for deep trees. Goes down
+     * with openat() and up with "..", which has to be the directory it came from
+     * in source and destination, so a directory moved away meanwhile stops the copy
+     */
+    void copysequential(Node *node) {
+        struct Level {
+            string path;
+            struct stat st;             // of the source, for its metadata
+            dev_t dstdev;
+            ino_t dstino;
+            vector<string> subdirs;     // still to copy
+            bool failed;
+        };
+        vector<Level> stack;
+        int src, dst;
+        struct stat st, dstst;
+
+        if (!opendirs(srcparent(node), node->srcname, dstparent(node), node->dstname, src, dst, st)) {
+            seterror(node->path, errno);
+            node->failed = true;
+            return;
+        }
+        string path = node->path;
+        while (true) {
+            // copy the files of the new level and note its subdirectories
+            if (fstat(dst, &dstst)) dstst.st_ino = 0;
+            stack.push_back(Level{path, st, dstst.st_dev, dstst.st_ino, vector<string>(), false});
+            Level &level = stack.back();
+            int dfd = dup(src);
+            DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+            if (d == NULL) {
+                seterror(path, errno);
+                level.failed = true;
+                if (dfd >= 0) close(dfd);
+            } else {
+                struct dirent *de;
+                while ((de = readdir(d)) != NULL) {
+                    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+                    string sub = joinpath(path, de->d_name);
+                    bool isdir = de->d_type == DT_DIR;
+                    if (de->d_type == DT_UNKNOWN) {
+                        isdir = fstatat(src, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                    }
+                    if (isdir) {
+                        if (!journal.isdone('D', sub)) level.subdirs.push_back(de->d_name);
+                    } else if (!journal.isdone('F', sub)) {
+                        if (copyentry(src, de->d_name, dst, de->d_name, sub)) {
+                            journal.record('F', sub);
+                            files++;
+                        } else {
+                            level.failed = true;
+                        }
+                    }
+                }
+                closedir(d);
+            }
+
+            // go into the next subdirectory, or up as far as levels are complete
+            while (true) {
+                Level &cur = stack.back();
+                if (!cur.subdirs.empty()) {
+                    string name = cur.subdirs.back();
+                    cur.subdirs.pop_back();
+                    path = joinpath(cur.path, name);
+                    int nsrc, ndst;
+                    if (!opendirs(src, name, dst, name, nsrc, ndst, st)) {
+                        seterror(path, errno);
+                        cur.failed = true;
+                        continue;
+                    }
+                    close(src);
+                    close(dst);
+                    src = nsrc;
+                    dst = ndst;
+                    break;
+                }
+
+                // ".." is opened first, the final mode may not allow to search dst
+                int srcup = -1, dstup = -1;
+                if (stack.size() > 1) {
+                    const Level &parent = stack[stack.size() - 2];
+                    srcup = openat(src, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    dstup = openat(dst, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    struct stat sst, dst2;
+                    if (srcup < 0 || dstup < 0 || fstat(srcup, &sst) || fstat(dstup, &dst2) ||
+                        sst.st_dev != parent.st.st_dev || sst.st_ino != parent.st.st_ino ||
+                        dst2.st_dev != parent.dstdev || dst2.st_ino != parent.dstino) {
+                        seterror(cur.path + "/..", (srcup < 0 || dstup < 0) ? errno : ESTALE);
+                        if (srcup >= 0) close(srcup);
+                        if (dstup >= 0) close(dstup);
+                        close(src);
+                        close(dst);
+                        node->failed = true;
+                        return;
+                    }
+                }
+                if (!setmeta(src, dst, cur.st)) {
+                    seterror(cur.path, errno);
+                    cur.failed = true;
+                }
+                // a directory with errors below has to be walked again by the next run
+                if (!cur.failed) {
+                    journal.record('D', cur.path);
+                    dirs++;
+                }
+                close(src);
+                close(dst);
+                bool failed = cur.failed;
+                stack.pop_back();
+                if (stack.empty()) {
+                    if (failed) node->failed = true;
+                    return;
+                }
+                if (failed) stack.back().failed = true;
+                src = srcup;
+                dst = dstup;
+            }
+        }
+    }
+
+    void scan(size_t q, Node *node) {
+        if (openfds >= maxfds) {
+            copysequential(node);
+            finish(node);
+            return;
+        }
+        if (!opendirs(srcparent(node), node->srcname, dstparent(node), node->dstname,
+                      node->srcfd, node->dstfd, node->st)) {
+            if (errno == EMFILE || errno == ENFILE) {
+                copysequential(node);
+            } else {
+                seterror(node->path, errno);
+                node->failed = true;
+            }
+            finish(node);
+            return;
+        }
+        openfds += 2;
+
+        int dfd = dup(node->srcfd);
+        DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+        if (d == NULL) {
+            seterror(node->path, errno);
+            node->failed = true;
+            if (dfd >= 0) close(dfd);
+            finish(node);
+            return;
+        }
+
+        vector<string> batch;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            string path = joinpath(node->path, de->d_name);
+            bool isdir = de->d_type == DT_DIR;
+            if (de->d_type == DT_UNKNOWN) {
+                struct stat st;
+                isdir = fstatat(node->srcfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (isdir) {
+                if (journal.isdone('D', path)) continue;
+                node->pending++;
+                Task t;
+                t.node = new Node(node, de->d_name, de->d_name, path);
+                queues.push(q, move(t));
+            } else {
+                if (journal.isdone('F', path)) continue;
+                batch.push_back(de->d_name);
+                if (batch.size() >= batchsize) {
+                    node->pending++;
+                    Task t;
+                    t.node = node;
+                    t.files.swap(batch);
+                    queues.push(q, move(t));
+                }
+            }
+        }
+        closedir(d);
+
+        copyfiles(node, batch);
+        finish(node);
+    }
+
+    void worker(size_t q) {
+        Task task;
+        int idle = 0;
+        while (!done) {
+            if (queues.pop(q, task) || queues.steal(q, task)) {
+                idle = 0;
+                if (task.files.empty()) {
+                    scan(q, task.node);
+                } else {
+                    copyfiles(task.node, task.files);
+                    finish(task.node);
+                }
+            } else if (++idle < 100) {
+                this_thread::yield();
+            } else {
+                this_thread::sleep_for(chrono::microseconds(500));
+            }
+        }
+    }
+
+public:
+    TreeMover(int threads, MoveJournal &_journal) : srcparentfd(-1), dstparentfd(-1), journal(_journal), queues(threads), done(false),
+                               files(0), dirs(0), bytes(0), errors(0), openfds(0) {
+        // half of the fds for the tree, the rest for the files being copied and the caller
+        struct rlimit rl;
+        maxfds = 512;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+            maxfds = rl.rlim_cur / 2;
+        }
+    }
+
+    bool run(const string _source, const string dest, MoveStats &stats, string &error) {
+        source = _source;
+
+        string srcdir, srcname, dstdir;
+        splitpath(source, srcdir, srcname);
+        splitpath(dest, dstdir, dstname);
+
+        srcparentfd = open(srcdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (srcparentfd < 0) {
+            error = srcdir + ": " + strerror(errno);
+            stats.errors++;
+            return false;
+        }
+        dstparentfd = open(dstdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dstparentfd < 0) {
+            error = dstdir + ": " + strerror(errno);
+            close(srcparentfd);
+            stats.errors++;
+            return false;
+        }
+        journal.setsyncfd(dstparentfd);
+
+        struct stat st;
+        if (fstatat(srcparentfd, srcname.c_str(), &st, AT_SYMLINK_NOFOLLOW)) {
+            seterror("", errno);
+        } else if (!S_ISDIR(st.st_mode)) {
+            if (copyentry(srcparentfd, srcname, dstparentfd, dstname, "")) files++;
+        } else {
+            Task t;
+            t.node = new Node(NULL, srcname, dstname, "");
+            queues.push(0, move(t));
+
+            vector<thread> pool;
+            for (size_t i=1; i<queues.size(); i++) {
+                pool.push_back(thread(&TreeMover::worker, this, i));
+            }
+            worker(0);
+            for (thread &th: pool) {
+                th.join();
+            }
+        }
+
+        stats.files += files;
+        stats.dirs += dirs;
+        stats.bytes += bytes;
+        stats.errors += errors;
+        error = firsterror;
+        bool ok = errors == 0;
+        if (ok && !journal.setcomplete()) {
+            error = "can not write move journal: " + string(strerror(errno));
+            ok = false;
+        }
+        close(srcparentfd);
+        close(dstparentfd);
+        return ok;
+    }
+};
+
+
+bool movetree(const string _source, const string target, int threads, MoveStats &stats, string &error) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    string source = stripslash(_source);
+    string srcdir, srcname;
+    splitpath(source, srcdir, srcname);
+    if (srcname.empty() || srcname == "." || srcname == "..") {
+        error = source + ": " + strerror(EINVAL);
+        return false;
+    }
+
+    // like mv, an existing directory as target means into that directory,
+    // when resuming, the partial copy may be that directory
+    string dest = stripslash(target);
+    MoveJournal journal(journalname(source));
+    bool resume = journal.read();
+    struct stat st;
+    if (resume) {
+        if (journal.source != source || (journal.dest != dest && journal.dest != joinpath(dest, srcname))) {
+            error = source + ": interrupted move to " + journal.dest + " pending, journal " + journalname(source);
+            return false;
+        }
+        dest = journal.dest;
+    } else if (stat(dest.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        dest = joinpath(dest, srcname);
+    }
+
+    if (!resume) {
+        // rename() checks for EXDEV before it looks at source
+        if (lstat(source.c_str(), &st)) {
+            error = source + ": " + strerror(errno);
+            return false;
+        }
+        if (rename(source.c_str(), dest.c_str()) == 0) {
+            stats.renamed = true;
+            return true;
+        }
+        if (errno != EXDEV) {
+            error = source + ": " + strerror(errno);
+            return false;
+        }
+        // never merge into data which is not ours
+        if (lstat(dest.c_str(), &st) == 0) {
+            error = dest + ": " + strerror(EEXIST);
+            return false;
+        }
+        if (!journal.create(source, dest)) {
+            error = journalname(source) + ": " + strerror(errno);
+            return false;
+        }
+    } else if (!journal.append()) {
+        error = journalname(source) + ": " + strerror(errno);
+        return false;
+    }
+
+    if (!journal.complete) {
+        TreeMover mover(threads, journal);
+        if (!mover.run(source, dest, stats, error)) {
+            return false;
+        }
+    }
+
+    // a run interrupted while removing source may have removed it already
+    if (lstat(source.c_str(), &st) == 0) {
+        DeleteStats dstats;
+        if (!deletetree(source, threads, dstats, error)) {
+            stats.errors += dstats.errors;
+            return false;
+        }
+    }
+    journal.remove();
+
+    gettimeofday(&end, NULL);
+    stats.seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    return true;
+}
+
+
+string movejournal(const string source) {
+    return journalname(source);
+}
+
+string movetarget(const string source) {
+    MoveJournal journal(journalname(source));
+    if (journal.read() && journal.source == stripslash(source)) {
+        return journal.dest;
+    }
+    return "";
+}
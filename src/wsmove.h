@@ -0,0 +1,71 @@
+#ifndef WSMOVE_H
+#define WSMOVE_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+struct MoveStats {
+    bool renamed;           // moved with a single rename(), nothing was copied
+    uint64_t files;         // non directories copied
+    uint64_t dirs;          // directories copied
+    uint64_t bytes;         // sum of sizes of copied files
+    uint64_t errors;
+    double seconds;
+
+    MoveStats() : renamed(false), files(0), dirs(0), bytes(0), errors(0), seconds(0.0) {}
+};
+
+/*
+ * move source to target like mv(1): if target is an existing directory,
+ * source is moved into it, otherwise it is moved to target.
+ *
+ * rename() is tried first, if source and target are on different devices
+ * (EXDEV), the tree is copied with a pool of threads and removed afterwards.
+ * Copies keep owner, mode, times and extended attributes (so POSIX ACLs),
+ * symlinks are copied as symlinks, hard links become separate files.
+ * File data is copied with copy_file_range(), falling back to sendfile()
+ * and read()/write() where the kernel or filesystem can not do it.
+ *
+ * progress is checkpointed into a journal next to source, an interrupted
+ * move of the same source to the same target continues where it stopped.
+ *
+ * returns false on error, error holds the first problem, source is kept then.
+ */
+bool movetree(const string source, const string target, int threads, MoveStats &stats, string &error);
+
+// target of an interrupted move of source, empty if there is none
+string movetarget(const string source);
+
+// journal of a move of source, exists while the move is not finished
+string movejournal(const string source);
+
+#endif
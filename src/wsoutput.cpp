@@ -0,0 +1,134 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdio.h>
+
+#include "wsoutput.h"
+
+using namespace std;
+
+
+static void jsonstring(ostream &out, const string &s) {
+    out << '"';
+    for (unsigned char c: s) {
+        switch (c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out << buf;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+static void csvstring(ostream &out, const string &s) {
+    if (s.find_first_of(",\"\r\n") == string::npos) {
+        out << s;
+        return;
+    }
+    out << '"';
+    for (char c: s) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+
+WsOutput::WsOutput(ostream &_out, const Format _format, const vector<string> _fields)
+    : out(_out), format(_format), fields(_fields), nextfield(0)
+{
+    if (format == CSV) {
+        for (size_t i=0; i<fields.size(); i++) {
+            if (i > 0) out << ',';
+            csvstring(out, fields[i]);
+        }
+        out << '\n';
+    }
+}
+
+// start of record or separator before next value
+void WsOutput::separator() {
+    if (format == JSONL) {
+        out << (nextfield == 0 ? "{" : ",");
+        jsonstring(out, fields[nextfield]);
+        out << ':';
+    } else if (nextfield > 0) {
+        out << ',';
+    }
+    nextfield++;
+}
+
+WsOutput& WsOutput::value(const string &v) {
+    separator();
+    if (format == JSONL) {
+        jsonstring(out, v);
+    } else {
+        csvstring(out, v);
+    }
+    return *this;
+}
+
+WsOutput& WsOutput::value(const long v) {
+    separator();
+    out << v;
+    return *this;
+}
+
+void WsOutput::end() {
+    if (format == JSONL) {
+        out << (nextfield == 0 ? "{}" : "}");
+    }
+    out << '\n';
+    nextfield = 0;
+}
+
+bool WsOutput::parseformat(const string name, Format &format) {
+    if (name == "human") {
+        format = HUMAN;
+    } else if (name == "jsonl") {
+        format = JSONL;
+    } else if (name == "csv") {
+        format = CSV;
+    } else {
+        return false;
+    }
+    return true;
+}
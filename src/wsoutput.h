@@ -0,0 +1,73 @@
+#ifndef WSOUTPUT_H
+#define WSOUTPUT_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+using namespace std;
+
+/*
+ * machine readable output of records, one record per line
+ *
+ *   jsonl   one JSON object per line
+ *   csv     header line with the field names, then one line per record (RFC 4180 quoting)
+ *
+ * records go to the stream as soon as they are complete, nothing is kept,
+ * so memory use does not depend on the number of records.
+ * Times are written as seconds since epoch.
+ */
+class WsOutput {
+
+public:
+    enum Format { HUMAN, JSONL, CSV };
+
+private:
+    ostream &out;
+    Format format;
+    vector<string> fields;
+    size_t nextfield;
+
+    void separator();
+
+public:
+    // writes the CSV header
+    WsOutput(ostream &out, const Format format, const vector<string> fields);
+
+    // values in order of fields, a record is written by end()
+    WsOutput& value(const string &v);
+    WsOutput& value(const long v);
+    void end();
+
+    // "human", "jsonl" or "csv", false for anything else
+    static bool parseformat(const string name, Format &format);
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <random>
+#include <memory>
+#include <stdint.h>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifndef SETUID
+#include <sys/capability.h>
+#else
+typedef int cap_value_t;
+const int CAP_DAC_OVERRIDE = 0;
+const int CAP_CHOWN = 1;
+#endif
+
+#include "wsplacement.h"
+#include "wsindex.h"
+#include "ws.h"
+#include "wserror.h"
+
+using namespace std;
+
+
+// what is known about a space, one line of .ws_spaces
+struct SpaceState {
+    string path;
+    double freebytes;       // available to users
+    double fill;            // fraction used, the higher of blocks and inodes
+    long checked;           // time of last statvfs, 0 if never
+    long lastused;          // time of last placement in ms, 0 if never
+};
+
+static string statename(const FilesystemConfig &fs) {
+    return fs.database + "/.ws_spaces";
+}
+
+// state of all spaces of fs, in order of config, from file content
+static vector<SpaceState> parsestate(const FilesystemConfig &fs, const string &content) {
+    vector<SpaceState> state;
+    for (const string &space: fs.spaces) {
+        SpaceState s = { space, 0, 0, 0, 0 };
+        state.push_back(s);
+    }
+    istringstream in(content);
+    string line;
+    while (getline(in, line)) {
+        istringstream l(line);
+        SpaceState s;
+        if (!(l >> s.freebytes >> s.fill >> s.checked >> s.lastused)) continue;
+        l.get();
+        getline(l, s.path);
+        for (SpaceState &known: state) {
+            if (known.path == s.path) known = s;
+        }
+    }
+    return state;
+}
+
+static string formatstate(const vector<SpaceState> &state) {
+    ostringstream out;
+    out.precision(17);
+    for (const SpaceState &s: state) {
+        out << s.freebytes << " " << s.fill << " " << s.checked << " " << s.lastused << " " << s.path << "\n";
+    }
+    return out.str();
+}
+
+// whole content of the state file
+static string readstate(const int fd) {
+    string content;
+    char buf[4096];
+    ssize_t n;
+    off_t offset = 0;
+    while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+        content.append(buf, n);
+        offset += n;
+    }
+    return content;
+}
+
+static void refresh(SpaceState &s, const long now, const int ttl) {
+    if (s.checked != 0 && now - s.checked < ttl) return;
+    struct statvfs st;
+    s.checked = now;
+    if (statvfs(s.path.c_str(), &st) != 0 || st.f_blocks == 0) {
+        // unusable until checked again
+        s.freebytes = 0;
+        s.fill = 1;
+        return;
+    }
+    s.freebytes = (double)st.f_bavail * st.f_frsize;
+    s.fill = 1.0 - (double)st.f_bavail / st.f_blocks;
+    if (st.f_files > 0) {
+        s.fill = max(s.fill, 1.0 - (double)st.f_favail / st.f_files);
+    }
+}
+
+// hash with good mixing, for rendezvous hashing
+static uint64_t mix(const string &s) {
+    uint64_t h = WsIndex::hash(s);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static size_t pick(const FilesystemConfig &fs, const vector<SpaceState> &state, const vector<size_t> &candidates,
+                   const string &owner) {
+    static mt19937_64 rng((random_device())() ^ ((uint64_t)time(NULL) << 20) ^ getpid());
+
+    if (fs.placement == "capacity") {
+        double total = 0;
+        for (size_t i: candidates) total += state[i].freebytes;
+        if (total > 0) {
+            double r = uniform_real_distribution<double>(0, total)(rng);
+            for (size_t i: candidates) {
+                r -= state[i].freebytes;
+                if (r < 0) return i;
+            }
+            return candidates.back();
+        }
+    } else if (fs.placement == "lru") {
+        size_t best = candidates[0];
+        for (size_t i: candidates) {
+            if (state[i].lastused < state[best].lastused) best = i;
+        }
+        return best;
+    } else if (fs.placement == "userhash") {
+        size_t best = candidates[0];
+        uint64_t besthash = 0;
+        for (size_t i: candidates) {
+            uint64_t h = mix(owner + "/" + state[i].path);
+            if (h >= besthash) {
+                best = i;
+                besthash = h;
+            }
+        }
+        return best;
+    }
+    return candidates[uniform_int_distribution<size_t>(0, candidates.size()-1)(rng)];
+}
+
+string WsPlacement::choose(const FilesystemConfig &fs, const string &owner, const int dbuid, const int dbgid,
+                           const bool debug) {
+    bool usestate = fs.placement == "capacity" || fs.placement == "lru" || fs.maxfill < 100;
+    long now = time(NULL);
+    vector<SpaceState> state = parsestate(fs, "");
+
+    // state file is read and written under lock, with privileges like DB entries
+    int fd = -1;
+    unique_ptr<WsPrivileges> priv;
+    if (usestate) {
+        priv.reset(new WsPrivileges({CAP_DAC_OVERRIDE}));
+        priv->asdb(dbuid, dbgid);
+        fd = open(statename(fs).c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0 && flock(fd, LOCK_SH) == 0) {
+            state = parsestate(fs, readstate(fd));
+            flock(fd, LOCK_UN);
+        } else {
+            if (fd >= 0) close(fd);
+            fd = -1;
+            if (debug) cerr << "debug: can not use " << statename(fs) << ", placement without state" << endl;
+        }
+    }
+
+    // statvfs of a hanging space must not block placements by other processes,
+    // so it runs without the lock
+    if (usestate) {
+        for (SpaceState &s: state) refresh(s, now, fs.placementttl);
+    }
+
+    // lock again for the choice, with what other processes wrote meanwhile
+    if (fd >= 0) {
+        if (flock(fd, LOCK_EX) == 0) {
+            vector<SpaceState> current = parsestate(fs, readstate(fd));
+            for (size_t i=0; i<state.size(); i++) {
+                if (current[i].checked > state[i].checked) {
+                    current[i].lastused = max(current[i].lastused, state[i].lastused);
+                    state[i] = current[i];
+                } else {
+                    state[i].lastused = max(state[i].lastused, current[i].lastused);
+                }
+            }
+        } else {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // spaces not too full, all if all are too full
+    vector<size_t> candidates;
+    for (size_t i=0; i<state.size(); i++) {
+        if (fs.maxfill >= 100 || state[i].fill*100 < fs.maxfill) {
+            candidates.push_back(i);
+        }
+    }
+    if (candidates.empty()) {
+        cerr << "Warning: all spaces of " << fs.name << " are filled more than " << fs.maxfill << "%." << endl;
+        for (size_t i=0; i<state.size(); i++) candidates.push_back(i);
+    }
+
+    size_t chosen = pick(fs, state, candidates, owner);
+    if (debug) {
+        cerr << "debug: placement " << fs.placement << " chose " << state[chosen].path << " out of "
+             << candidates.size() << " spaces" << endl;
+    }
+
+    if (fd >= 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        state[chosen].lastused = ts.tv_sec*1000 + ts.tv_nsec/1000000;
+        string content = formatstate(state);
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, content.data(), content.size(), 0) != (ssize_t)content.size()) {
+            if (debug) cerr << "debug: could not write " << statename(fs) << endl;
+        }
+        close(fd);
+    }
+    if (priv) {
+        priv->lower();
+    }
+
+    return state[chosen].path;
+}
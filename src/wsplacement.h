@@ -0,0 +1,62 @@
+#ifndef WSPLACEMENT_H
+#define WSPLACEMENT_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+
+#include "wsconfig.h"
+
+using namespace std;
+
+/*
+ * choice of the space for a new workspace, by the placement option of the filesystem
+ *
+ *   random     uniform over the spaces (default)
+ *   capacity   random, weighted by free bytes of each space
+ *   lru        the space used least recently for a new workspace
+ *   userhash   rendezvous hash of user and space, workspaces of a user stay on one
+ *              space as long as it is usable, and only they move if it is not
+ *
+ * spaces filled more than maxfill percent (blocks or inodes) are skipped with all
+ * policies, unless all spaces are that full.
+ *
+ * free space from statvfs and the time of last use are kept in <database>/.ws_spaces,
+ * so statvfs is called at most once per placementttl seconds per space, and never
+ * while the file is locked. The file is only used by lru, capacity and maxfill,
+ * it is created on first use.
+ */
+class WsPlacement {
+
+public:
+    // space for a new workspace of owner on filesystem fs
+    static string choose(const FilesystemConfig &fs, const string &owner, const int dbuid, const int dbgid,
+                         const bool debug);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WSPYPRINT_H
+#define WSPYPRINT_H
+
+/*
+ *  workspace++
+ *
+ *  wspyprint
+ *
+ *  output helpers of the tools replacing python versions, so their output
+ *  stays the same for scripts reading it
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <time.h>
+
+using namespace std;
+
+/*
+ * mimic print() of python, arguments separated by blanks
+ */
+static inline void pyargs(ostream &out) {
+    out << endl;
+}
+
+template<typename T, typename... Args>
+static void pyargs(ostream &out, const T &first, const Args&... rest) {
+    out << " " << first;
+    pyargs(out, rest...);
+}
+
+template<typename T, typename... Args>
+static void pyprint(ostream &out, const T &first, const Args&... rest) {
+    out << first;
+    pyargs(out, rest...);
+}
+
+// like time.ctime()
+static inline string pyctime(double t) {
+    time_t tt = (time_t)t;
+    char buf[64];
+    if (ctime_r(&tt, buf) == NULL) return "";
+    string s(buf);
+    if (!s.empty() && s[s.size()-1] == '\n') s.erase(s.size()-1);
+    return s;
+}
+
+#endif
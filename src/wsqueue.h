@@ -0,0 +1,89 @@
+#ifndef WSQUEUE_H
+#define WSQUEUE_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vector>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+/*
+ * one deque of tasks per thread, used by the parallel tree walks.
+ *
+ * a thread takes work from the back of its own deque, newest first, which keeps
+ * the walk depth first and the number of open fds low, and steals from the front
+ * of other deques when idle, these tend to be the largest subtrees.
+ */
+template <class Task>
+class WorkQueues {
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<Queue> queues;
+
+public:
+    WorkQueues(int threads) : queues(threads > 0 ? threads : 1) {}
+
+    size_t size() const {
+        return queues.size();
+    }
+
+    void push(size_t q, Task &&task) {
+        lock_guard<mutex> l(queues[q].lock);
+        queues[q].tasks.push_back(move(task));
+    }
+
+    bool pop(size_t q, Task &task) {
+        lock_guard<mutex> l(queues[q].lock);
+        if (queues[q].tasks.empty()) return false;
+        task = move(queues[q].tasks.back());
+        queues[q].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t q, Task &task) {
+        for (size_t i=1; i<queues.size(); i++) {
+            Queue &victim = queues[(q+i) % queues.size()];
+            lock_guard<mutex> l(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ *  workspace++
+ *
+ *  wsreminders
+ *
+ *  spool of reminder mails of a DB directory
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "wsdb.h"
+#include "wsdirs.h"
+#include "wsmail.h"
+#include "wsshards.h"
+#include "wspyprint.h"
+#include "wsreminders.h"
+
+using namespace std;
+
+
+static string spooldir(const string dbdir) {
+    return dbdir + "/.ws_reminders";
+}
+
+// values end at the line end, nothing in them may start a new line
+static string oneline(const string s) {
+    string r = s;
+    for (char &c: r) {
+        if (c == '\n' || c == '\r') c = ' ';
+    }
+    return r;
+}
+
+static bool parse(const string &content, WsReminder &r) {
+    istringstream in(content);
+    string line;
+    int seen = 0;
+    r.expiration = 0;
+    r.attempts = 0;
+    r.next = 0;
+    while (getline(in, line)) {
+        size_t colon = line.find(": ");
+        if (colon == string::npos) continue;
+        string key = line.substr(0, colon);
+        string value = line.substr(colon + 2);
+        if (key == "workspace") {
+            r.workspace = value;
+            seen |= 1;
+        } else if (key == "expiration") {
+            r.expiration = atol(value.c_str());
+            seen |= 2;
+        } else if (key == "mailaddress") {
+            r.mailaddress = value;
+            seen |= 4;
+        } else if (key == "attempts") {
+            r.attempts = atoi(value.c_str());
+        } else if (key == "next") {
+            r.next = atol(value.c_str());
+        }
+    }
+    return seen == 7 && r.mailaddress != "";
+}
+
+
+bool WsReminders::exists(const string dbdir) {
+    struct stat st;
+    return stat(spooldir(dbdir).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool WsReminders::queue(const string dbdir, const WsReminder &r) {
+    int sfd = WsDirs::get(spooldir(dbdir));
+    if (sfd < 0 || r.name.empty() || r.name[0] == '.' || r.name.find('/') != string::npos) return false;
+
+    ostringstream data;
+    data << "workspace: " << oneline(r.workspace) << "\n"
+         << "expiration: " << r.expiration << "\n"
+         << "mailaddress: " << oneline(r.mailaddress) << "\n"
+         << "attempts: " << r.attempts << "\n"
+         << "next: " << r.next << "\n";
+    string content = data.str();
+
+    // complete or not at all for the sender
+    string tmp = ".tmp-" + r.name + "-" + to_string(getpid());
+    int fd = openat(sfd, tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) return false;
+    bool ok = write(fd, content.data(), content.size()) == (ssize_t)content.size();
+    if (close(fd) != 0) ok = false;
+    if (!ok || renameat(sfd, tmp.c_str(), sfd, r.name.c_str()) != 0) {
+        unlinkat(sfd, tmp.c_str(), 0);
+        return false;
+    }
+    return true;
+}
+
+// content of spool file name, empty if it is no regular file, false if it can not be opened
+static bool readspool(const int sfd, const string name, string &content, ino_t &inode) {
+    int rfd = openat(sfd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (rfd < 0) return false;
+    struct stat st;
+    content.clear();
+    inode = 0;
+    if (fstat(rfd, &st) == 0 && S_ISREG(st.st_mode)) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(rfd, buf, sizeof(buf))) > 0) content.append(buf, n);
+        inode = st.st_ino;
+    }
+    close(rfd);
+    return true;
+}
+
+bool WsReminders::get(const string dbdir, const string name, WsReminder &r) {
+    int sfd = WsDirs::get(spooldir(dbdir));
+    if (sfd < 0 || name.empty() || name[0] == '.' || name.find('/') != string::npos) return false;
+    string content;
+    ino_t inode;
+    if (!readspool(sfd, name, content, inode)) return false;
+    r.name = name;
+    r.inode = inode;
+    return parse(content, r);
+}
+
+bool WsReminders::requeue(const string dbdir, const WsReminder &r) {
+    WsReminder next = r, waiting;
+    if (get(dbdir, r.name, waiting) && waiting.mailaddress == r.mailaddress) {
+        next.attempts = waiting.attempts;
+        next.next = waiting.next;
+    }
+    return queue(dbdir, next);
+}
+
+vector<WsReminder> WsReminders::due(const string dbdir, const long now) {
+    vector<WsReminder> reminders;
+    int sfd = WsDirs::get(spooldir(dbdir));
+    int fd = sfd < 0 ? -1 : openat(sfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        return reminders;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        string content;
+        ino_t inode;
+        if (!readspool(sfd, de->d_name, content, inode)) continue;
+
+        WsReminder r;
+        r.name = de->d_name;
+        if (!parse(content, r)) {
+            // nothing that could ever be sent
+            unlinkat(sfd, de->d_name, 0);
+            continue;
+        }
+        r.inode = inode;
+        if (r.next <= now) {
+            reminders.push_back(r);
+        }
+    }
+    closedir(dir);
+    return reminders;
+}
+
+// true if the spool file of r is still the one due() read
+static bool unchanged(const int sfd, const WsReminder &r) {
+    struct stat st;
+    return fstatat(sfd, r.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && st.st_ino == r.inode;
+}
+
+void WsReminders::remove(const string dbdir, const WsReminder &r) {
+    int sfd = WsDirs::get(spooldir(dbdir));
+    if (sfd >= 0 && unchanged(sfd, r)) {
+        unlinkat(sfd, r.name.c_str(), 0);
+    }
+}
+
+bool WsReminders::reschedule(const string dbdir, const WsReminder &r) {
+    int sfd = WsDirs::get(spooldir(dbdir));
+    if (sfd < 0) return false;
+    // a reminder queued in between is newer and stays
+    if (!unchanged(sfd, r)) return true;
+    return queue(dbdir, r);
+}
+
+int WsReminders::lock(const string dbdir) {
+    int sfd = WsDirs::get(spooldir(dbdir));
+    if (sfd < 0) return -1;
+    int fd = openat(sfd, ".lock", O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// failed deliveries of a queued reminder before it is dropped
+static const int maxattempts = 10;
+
+// wait before the next delivery of a queued reminder, from 5 minutes doubling up to 6 hours
+static long backoff(const int attempts) {
+    return min(300L << min(attempts - 1, 10), 6*3600L);
+}
+
+/*
+ * deliver the queued reminders of all filesystems in one SMTP session, with one
+ * mail per recipient for all their workspaces
+ */
+void WsReminders::send(ostream &out, const WsConfig &config, const vector<string> &fslist, const bool dryrun) {
+    struct Queued {
+        string dbdir;
+        WsReminder r;
+    };
+    map<string, vector<Queued>> byrecipient;
+    vector<int> locks;
+    long t = time(NULL);
+    size_t count = 0;
+    for (const string &fs: fslist) {
+        if (!config.getfs(fs)) continue;
+        string dbdir = config.fs(fs).database;
+        if (!WsReminders::exists(dbdir)) continue;
+        // a sender run from cron can overlap with the one of a cleaner run
+        int lock = WsReminders::lock(dbdir);
+        if (lock < 0) {
+            pyprint(out, "  reminders of", fs, "are sent by another ws_expirer");
+            continue;
+        }
+        locks.push_back(lock);
+        for (const WsReminder &r: WsReminders::due(dbdir, t)) {
+            byrecipient[r.mailaddress].push_back(Queued{dbdir, r});
+            count++;
+        }
+    }
+
+    if (count > 0) {
+        pyprint(out, "PHASE: sending", count, "queued reminders to", byrecipient.size(), "recipients");
+    }
+    string sender = config.mail_from != "" ? config.mail_from : "wsadmin";
+    SmtpSession session(config.smtphost);
+    bool serverdown = false;
+    for (auto &recipient: byrecipient) {
+        const string &mailaddress = recipient.first;
+        vector<Queued> pending;
+        for (Queued &q: recipient.second) {
+            // the workspace can have been released or extended since the reminder was queued
+            string filename = q.dbdir + "/" + q.r.name;
+            string reason;
+            if (!WsShards::exists(filename)) {
+                reason = "(released)";
+            } else {
+                try {
+                    WsDB e(filename, config.dbuid, config.dbgid);
+                    q.r.expiration = e.getexpiration();
+                    if (t <= e.getexpiration() - e.getreminder()*(24*3600)) reason = "(extended)";
+                } catch (...) {
+                    // an unreadable entry keeps the expiration of the reminder
+                }
+                if (q.r.expiration < t) reason = "(expired)";
+            }
+            if (reason != "") {
+                pyprint(out, "  DROP_REMINDER", q.r.workspace, q.r.expiration, mailaddress, reason);
+                if (!dryrun) WsReminders::remove(q.dbdir, q.r);
+            } else {
+                pending.push_back(q);
+            }
+        }
+        if (pending.empty()) continue;
+        sort(pending.begin(), pending.end(),
+             [](const Queued &a, const Queued &b) {
+                 return a.r.expiration != b.r.expiration ? a.r.expiration < b.r.expiration : a.r.workspace < b.r.workspace;
+             });
+
+        if (dryrun) {
+            for (const Queued &q: pending) {
+                pyprint(out, "  MAIL", q.r.workspace, q.r.expiration, mailaddress);
+            }
+            continue;
+        }
+
+        // a single workspace gets the mail send_reminder() would send
+        string subject, text;
+        if (pending.size() == 1) {
+            const WsReminder &r = pending[0].r;
+            text = " \n        Your workspace " + r.workspace + " on system " + config.clustername +
+                   " will expire at " + pyctime(r.expiration) + ".\n    ";
+            subject = "Workspace " + r.workspace + " will expire at " + pyctime(r.expiration);
+        } else {
+            text = " \n        Your workspaces on system " + config.clustername + " will expire:\n\n";
+            for (const Queued &q: pending) {
+                text += "        " + q.r.workspace + " at " + pyctime(q.r.expiration) + "\n";
+            }
+            text += "    ";
+            subject = to_string(pending.size()) + " workspaces on " + config.clustername +
+                      " will expire from " + pyctime(pending[0].r.expiration);
+        }
+
+        // after the server could not be reached, the rest is tried again later
+        MailResult result = MAIL_SOCKETERROR;
+        int code = -1;
+        if (!serverdown) {
+            result = session.send(sender, mailaddress, subject, text, code);
+        }
+        if (result == MAIL_OK) {
+            for (const Queued &q: pending) {
+                WsReminders::remove(q.dbdir, q.r);
+                pyprint(out, "  SEND_REMINDER", q.r.workspace, q.r.expiration, mailaddress);
+            }
+            continue;
+        }
+
+        bool temporary = result == MAIL_SOCKETERROR || (code >= 400 && code < 500);
+        if (result == MAIL_SOCKETERROR) {
+            if (!serverdown) pyprint(out, "Socket error");
+            serverdown = true;
+        } else if (result == MAIL_RECIPIENTREFUSED) {
+            pyprint(out, "Recipient refused: {}", "['" + mailaddress + "']");
+        } else if (result == MAIL_SENDERREFUSED) {
+            pyprint(out, "Sender refused: {}", sender);
+        } else {
+            pyprint(out, "Could not send reminder email. Other reason.", "['" + mailaddress + "']");
+        }
+        for (Queued &q: pending) {
+            q.r.attempts++;
+            if (temporary && q.r.attempts < maxattempts) {
+                q.r.next = t + backoff(q.r.attempts);
+                WsReminders::reschedule(q.dbdir, q.r);
+                pyprint(out, "  RETRY_REMINDER", q.r.workspace, q.r.expiration, mailaddress, "at", pyctime(q.r.next));
+            } else {
+                WsReminders::remove(q.dbdir, q.r);
+                pyprint(out, "  DROP_REMINDER", q.r.workspace, q.r.expiration, mailaddress);
+            }
+        }
+    }
+
+    for (int lock: locks) {
+        close(lock);
+    }
+}
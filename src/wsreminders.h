@@ -0,0 +1,93 @@
+#ifndef WSREMINDERS_H
+#define WSREMINDERS_H
+
+/*
+ *  workspace++
+ *
+ *  wsreminders
+ *
+ *  spool of reminder mails of a DB directory
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "wsconfig.h"
+
+using namespace std;
+
+struct WsReminder {
+    string name;            // DB entry name, <user>-<workspace name>
+    string workspace;       // workspace name as the user knows it
+    long expiration;
+    string mailaddress;
+    int attempts;           // failed deliveries so far
+    long next;              // not to be sent before this time
+    ino_t inode;            // of the spool file the reminder was read from
+};
+
+/*
+ * reminder mails waiting for delivery, so the expirer does not wait for the mail
+ * server, and the mails can be sent in one SMTP session and retried
+ *
+ *   <dbdir>/.ws_reminders/<entry name>    one reminder, "key: value" lines
+ *
+ * a new reminder of an entry replaces a waiting one, so a reminder that could
+ * not be delivered for days is sent once, with the latest expiration. Like the
+ * expiration queue, the spool is only used if the directory exists.
+ */
+class WsReminders {
+
+public:
+    static bool exists(const string dbdir);
+
+    // queue reminder r, replacing a queued reminder of the same entry
+    static bool queue(const string dbdir, const WsReminder &r);
+
+    // queue reminder r of an entry again, a waiting reminder to the same address keeps
+    // its failed deliveries and backoff, so a daily reminder does not reset them
+    static bool requeue(const string dbdir, const WsReminder &r);
+
+    // the queued reminder of entry name, false if there is none
+    static bool get(const string dbdir, const string name, WsReminder &r);
+
+    // queued reminders which can be sent at time now
+    static vector<WsReminder> due(const string dbdir, const long now);
+
+    // remove a sent reminder, unless it was replaced since due() read it
+    static void remove(const string dbdir, const WsReminder &r);
+
+    // write back a reminder that could not be sent, with new attempts and next,
+    // unless it was replaced since due() read it
+    static bool reschedule(const string dbdir, const WsReminder &r);
+
+    // exclusive lock for one sender at a time, -1 if another one has it
+    static int lock(const string dbdir);
+
+    // deliver the due reminders of the filesystems in fslist in one SMTP session,
+    // one mail per recipient for all their workspaces, the log goes to out. Failed
+    // deliveries are retried with backoff, and dropped after maxattempts
+    static void send(ostream &out, const WsConfig &config, const vector<string> &fslist, const bool dryrun);
+};
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ *  workspace++
+ *
+ *  wsshards
+ *
+ *  sharded layout of DB directories
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+
+#include "wsdirs.h"
+#include "wsindex.h"
+#include "wsshards.h"
+
+using namespace std;
+
+static const int maxfanout = 256;
+// seconds a directory is taken as flat without looking again, migrate() waits longer
+// than this before moving entries, so no process writes flat entries from then on
+static const long flatttl = 10;
+
+struct Fanout {
+    int fanout;
+    long checked;
+};
+
+static mutex shardslock;
+static unordered_map<string, Fanout> fanouts;
+
+static long monotonic() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+
+static string trimdir(const string dir) {
+    string key = dir;
+    while (key.size() > 1 && key[key.size()-1] == '/') key.erase(key.size()-1);
+    return key;
+}
+
+static void split(const string filename, string &dir, string &name) {
+    size_t pos = filename.rfind('/');
+    dir = pos == string::npos ? "." : filename.substr(0, pos);
+    name = filename.substr(pos == string::npos ? 0 : pos+1);
+}
+
+// shard of an entry, by the user part of its name, so all entries of a user are together
+static string shardname(const int shard) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "%02x", shard);
+    return buf;
+}
+
+static string shardof(const string name, const int fanout) {
+    return shardname(WsIndex::hash(name.substr(0, name.find('-'))) % fanout);
+}
+
+
+int WsShards::fanout(const string dir) {
+    string key = trimdir(dir);
+    lock_guard<mutex> guard(shardslock);
+    long now = monotonic();
+    auto it = fanouts.find(key);
+    if (it != fanouts.end() && (it->second.fanout > 0 || now - it->second.checked < flatttl)) {
+        return it->second.fanout;
+    }
+    int fd = open((key + "/.ws_shards").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fanouts[key] = { 0, now };
+        return 0;
+    }
+    char buf[16];
+    ssize_t n = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    int value = atoi(buf);
+    if (value < 1 || value > maxfanout) {
+        cerr << "Error: invalid fan-out in " << key << "/.ws_shards, treating directory as flat." << endl;
+        return 0;
+    }
+    fanouts[key] = { value, now };
+    return value;
+}
+
+string WsShards::canonical(const string filename) {
+    string dir, name;
+    split(filename, dir, name);
+    int n = fanout(dir);
+    if (n == 0) {
+        return filename;
+    }
+    return dir + "/" + shardof(name, n) + "/" + name;
+}
+
+string WsShards::locate(const string filename) {
+    string path = canonical(filename);
+    if (path == filename || WsDirs::exists(path) || !WsDirs::exists(filename)) {
+        return path;
+    }
+    // not yet moved by a migration
+    return filename;
+}
+
+bool WsShards::exists(const string filename) {
+    string path = canonical(filename);
+    return WsDirs::exists(path) || (path != filename && WsDirs::exists(filename));
+}
+
+vector<string> WsShards::dirs(const string dir, const string user) {
+    vector<string> result;
+    string key = trimdir(dir);
+    result.push_back(key);
+    int n = fanout(key);
+    if (n > 0 && user != "") {
+        result.push_back(key + "/" + shardof(user, n));
+        return result;
+    }
+    for (int i=0; i<n; i++) {
+        result.push_back(key + "/" + shardname(i));
+    }
+    return result;
+}
+
+bool WsShards::migrate(const string dir, const int n, const int dbuid, const int dbgid) {
+    string key = trimdir(dir);
+    if (n < 1 || n > maxfanout) {
+        cerr << "Error: fan-out has to be between 1 and " << maxfanout << "." << endl;
+        return false;
+    }
+    int old = fanout(key);
+    if (old != 0 && old != n) {
+        cerr << "Error: " << key << " is sharded with fan-out " << old << ", changing it is not supported." << endl;
+        return false;
+    }
+
+    // shards first, writers use them as soon as .ws_shards exists
+    struct stat st;
+    if (stat(key.c_str(), &st) != 0) {
+        cerr << "Error: could not access DB directory " << key << endl;
+        return false;
+    }
+    for (int i=0; i<n; i++) {
+        string shard = key + "/" + shardname(i);
+        if (mkdir(shard.c_str(), st.st_mode & 07777) != 0 && errno != EEXIST) {
+            cerr << "Error: could not create " << shard << endl;
+            return false;
+        }
+        if (chown(shard.c_str(), dbuid, dbgid)) {
+            cerr << "Warning: could not change owner of " << shard << endl;
+        }
+    }
+
+    if (old == 0) {
+        string marker = key + "/.ws_shards";
+        string tmp = marker + ".new";
+        string content = to_string(n) + "\n";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write(fd, content.data(), content.size()) == (ssize_t)content.size() &&
+                  fsync(fd) == 0;
+        if (fd >= 0) {
+            if (fchown(fd, dbuid, dbgid)) {
+                cerr << "Warning: could not change owner of " << marker << endl;
+            }
+            if (close(fd) != 0) ok = false;
+        }
+        if (!ok || rename(tmp.c_str(), marker.c_str()) != 0) {
+            unlink(tmp.c_str());
+            cerr << "Error: could not write " << marker << endl;
+            return false;
+        }
+        // processes which saw the directory flat before see the shards now
+        cerr << "Info: waiting " << flatttl + 1 << " seconds for running processes to see the shards." << endl;
+        sleep(flatttl + 1);
+        lock_guard<mutex> guard(shardslock);
+        fanouts.erase(key);
+    }
+
+    DIR *d = opendir(key.c_str());
+    if (d == NULL) {
+        cerr << "Error: could not read DB directory " << key << endl;
+        return false;
+    }
+    int dfd = dirfd(d);
+    long moved = 0, failed = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        string name = de->d_name;
+        // entries are <user>-<name>, no dotfiles
+        if (name[0] == '.' || name.find('-') == string::npos) continue;
+        if (fstatat(dfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+        string flat = key + "/" + name;
+        string target = canonical(flat);
+        if (WsDirs::renamenoreplace(flat, target) == 0) {
+            moved++;
+        } else if (errno == EEXIST) {
+            // written to the shard since the migration started, the flat file is outdated
+            unlinkat(dfd, name.c_str(), 0);
+            moved++;
+        } else {
+            cerr << "Error: could not move " << flat << " to " << target << endl;
+            failed++;
+        }
+    }
+    closedir(d);
+
+    cerr << "Info: moved " << moved << " entries of " << key << " into " << n << " shards." << endl;
+    return failed == 0;
+}
@@ -0,0 +1,76 @@
+#ifndef WSSHARDS_H
+#define WSSHARDS_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * optional sharded layout of a DB directory (database or its deleted subdirectory)
+ *
+ *   <dir>/.ws_shards           fan-out n, 1 to 256
+ *   <dir>/<xx>/<user>-<name>   xx is the hash of the entry name up to the first '-',
+ *                              modulo n, as two hex digits
+ *
+ * Everything outside this class keeps using the flat names <dir>/<user>-<name>,
+ * these are translated to the file in the shard when a DB file is opened, written,
+ * moved or listed. A directory is flat without the .ws_shards file.
+ *
+ * migrate() turns a flat directory into a sharded one while the tools are in use:
+ * it creates the shard directories, then the .ws_shards file, then moves the
+ * entries. In between, an entry can be in its shard or still in the flat
+ * directory; lookups try the shard first, writers always write to the shard
+ * and remove the flat file.
+ */
+class WsShards {
+
+public:
+    // fan-out of dir, 0 for a flat directory
+    static int fanout(const string dir);
+
+    // file an entry filename (flat name) is written to
+    static string canonical(const string filename);
+
+    // file an entry is found in now, canonical() if it does not exist
+    static string locate(const string filename);
+
+    // true if the entry exists, in its shard or flat
+    static bool exists(const string filename);
+
+    // directories to list for the entries of dir: dir itself and its shards,
+    // or only the shard of user
+    static vector<string> dirs(const string dir, const string user = "");
+
+    // shard dir with the given fan-out and move all entries, can be repeated
+    static bool migrate(const string dir, const int fanout, const int dbuid, const int dbgid);
+};
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ *  workspace++
+ *
+ *  wsusers
+ *
+ *  per user manifests of a DB directory
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <algorithm>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "wsdirs.h"
+#include "wsshards.h"
+#include "wsusers.h"
+
+using namespace std;
+
+
+static string usersdir(const string dbdir) {
+    return dbdir + "/.ws_users";
+}
+
+// manifest of an entry or of a user
+static string userkey(const string name) {
+    return name.substr(0, name.find('-'));
+}
+
+// open and lock a manifest, again if rebuild() removed it while waiting for the lock
+static int lockmanifest(const int ufd, const string key, const int flags, const int lock) {
+    while (true) {
+        int fd = openat(ufd, key.c_str(), flags | O_NOFOLLOW | O_CLOEXEC, 0644);
+        if (fd < 0) return -1;
+        struct stat st;
+        if (flock(fd, lock) != 0 || fstat(fd, &st) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (st.st_nlink > 0) return fd;
+        close(fd);
+    }
+}
+
+// complete lines of a manifest, a line without newline is left from a failed write
+static vector<string> readlines(const int fd) {
+    string content;
+    char buf[4096];
+    ssize_t n;
+    off_t off = 0;
+    while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+        content.append(buf, n);
+        off += n;
+    }
+    vector<string> lines;
+    size_t start = 0, eol;
+    while ((eol = content.find('\n', start)) != string::npos) {
+        if (eol > start) lines.push_back(content.substr(start, eol - start));
+        start = eol + 1;
+    }
+    return lines;
+}
+
+
+bool WsUsers::exists(const string dbdir) {
+    struct stat st;
+    return stat(usersdir(dbdir).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void WsUsers::add(const string filename, const int dbuid, const int dbgid) {
+    size_t pos = filename.rfind('/');
+    string dbdir = pos == string::npos ? "." : filename.substr(0, pos);
+    string name = filename.substr(pos == string::npos ? 0 : pos+1);
+    string key = userkey(name);
+    if (key.empty() || key[0] == '.' || !exists(dbdir)) return;
+
+    int ufd = WsDirs::get(usersdir(dbdir));
+    int fd = ufd < 0 ? -1 : lockmanifest(ufd, key, O_RDWR | O_CREAT | O_APPEND, LOCK_EX);
+    bool ok = fd >= 0;
+    if (ok) {
+        // manifests created by root (expirer, rebuild) have to be writable by the DB user
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (st.st_uid != (uid_t)dbuid || st.st_gid != (gid_t)dbgid)) {
+            if (fchown(fd, dbuid, dbgid)) {}
+        }
+        vector<string> lines = readlines(fd);
+        if (find(lines.begin(), lines.end(), name) == lines.end()) {
+            string line = name + "\n";
+            ok = write(fd, line.data(), line.size()) == (ssize_t)line.size();
+        }
+        if (close(fd) != 0) ok = false;
+    }
+    if (!ok) {
+        cerr << "Warning: could not add " << name << " to " << usersdir(dbdir) << ", run ws_index --rebuild-users." << endl;
+    }
+}
+
+vector<string> WsUsers::entries(const string dbdir, const string user) {
+    vector<string> names;
+    int ufd = WsDirs::get(usersdir(dbdir));
+    int fd = ufd < 0 ? -1 : openat(ufd, userkey(user).c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return names;
+    vector<string> lines;
+    if (flock(fd, LOCK_SH) == 0) {
+        lines = readlines(fd);
+    }
+    close(fd);
+
+    string prefix = user + "-";
+    set<string> seen;
+    for (const string &name: lines) {
+        if (name.compare(0, prefix.size(), prefix) != 0 || !seen.insert(name).second) continue;
+        // released, restored or expired since it was added
+        if (!WsShards::exists(dbdir + "/" + name)) continue;
+        names.push_back(name);
+    }
+    return names;
+}
+
+/*
+ * merge the entries of dbdir into the manifests, and drop entries which are gone
+ */
+bool WsUsers::rebuild(const string dbdir, const int dbuid, const int dbgid) {
+    string udir = usersdir(dbdir);
+    if (mkdir(udir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Error: could not create " << udir << endl;
+        return false;
+    }
+    if (chown(udir.c_str(), dbuid, dbgid)) {
+        cerr << "Warning: could not change owner of " << udir << endl;
+    }
+    int ufd = WsDirs::get(udir);
+    if (ufd < 0) {
+        cerr << "Error: could not open " << udir << endl;
+        return false;
+    }
+
+    // entries by user, from the directory and its shards
+    map<string, set<string>> users;
+    long count = 0;
+    for (const string &d: WsShards::dirs(dbdir)) {
+        DIR *dir = opendir(d.c_str());
+        if (dir == NULL) {
+            cerr << "Error: could not read DB directory " << d << endl;
+            return false;
+        }
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            string name = de->d_name;
+            // entries are <user>-<name>, no dotfiles
+            if (name[0] == '.' || name.find('-') == string::npos) continue;
+            struct stat st;
+            if (fstatat(dirfd(dir), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (users[userkey(name)].insert(name).second) count++;
+        }
+        closedir(dir);
+    }
+
+    // manifests of users without entries in the directory any more
+    int fd = openat(ufd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        cerr << "Error: could not read " << udir << endl;
+        return false;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') users[de->d_name];
+    }
+    closedir(dir);
+
+    bool ok = true;
+    for (auto &u: users) {
+        fd = lockmanifest(ufd, u.first, O_RDWR | O_CREAT, LOCK_EX);
+        if (fd < 0) {
+            cerr << "Error: could not update manifest " << udir << "/" << u.first << endl;
+            ok = false;
+            continue;
+        }
+        // entries added since the directory was read are kept
+        for (const string &name: readlines(fd)) {
+            if (!u.second.count(name) && WsShards::exists(dbdir + "/" + name)) {
+                u.second.insert(name);
+            }
+        }
+        if (u.second.empty()) {
+            unlinkat(ufd, u.first.c_str(), 0);
+        } else {
+            string content;
+            for (const string &name: u.second) content += name + "\n";
+            if (ftruncate(fd, 0) != 0 || pwrite(fd, content.data(), content.size(), 0) != (ssize_t)content.size()) {
+                cerr << "Error: could not write manifest " << udir << "/" << u.first << endl;
+                ok = false;
+            }
+            if (fchown(fd, dbuid, dbgid)) {}
+        }
+        close(fd);
+    }
+    if (ok) {
+        cerr << "Info: listed " << count << " entries in " << udir << endl;
+    }
+    return ok;
+}
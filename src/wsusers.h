@@ -0,0 +1,71 @@
+#ifndef WSUSERS_H
+#define WSUSERS_H
+
+/*
+ *  workspace++
+ *
+ *  c++ version of workspace utility
+ *  a workspace is a temporary directory created in behalf of a user with a limited lifetime.
+ *  This version is not DB and configuration compatible with the older version, the DB and
+ *  configuration was changed to YAML files.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * per user manifest of a DB directory (database or its deleted subdirectory),
+ * so the entries of one user are found without reading the whole directory
+ *
+ *   <dir>/.ws_users/<user>     names of the entries of user, one per line
+ *
+ * user is the part of the entry name before the first '-', like for the shards,
+ * so a manifest can also hold entries of users with a '-' in their name, readers
+ * filter by the full prefix.
+ *
+ * Writers add an entry when they create or move it into the directory, under
+ * flock() of the manifest. Entries which were released, restored or expired stay
+ * in the manifest, readers check that each entry still exists. rebuild() drops
+ * them, it merges the directory with the manifests, so entries added meanwhile
+ * are kept.
+ *
+ * Like the index, the manifests are only maintained if the directory exists,
+ * ws_index --rebuild-users creates it or recovers it from the YAML files.
+ */
+class WsUsers {
+
+public:
+    static bool exists(const string dbdir);
+
+    // writer side, add entry filename (flat name) to the manifest of its user,
+    // does nothing if the directory of filename has no manifests
+    static void add(const string filename, const int dbuid, const int dbgid);
+
+    // names of the existing entries of user in dbdir
+    static vector<string> entries(const string dbdir, const string user);
+
+    // create manifests or bring them up to date with the YAML files
+    static bool rebuild(const string dbdir, const int dbuid, const int dbgid);
+};
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ *  workspace++
+ *
+ *  wsverify
+ *
+ *  check that the workspace directories of the DB entries exist
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// C++
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// Posix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "wsdb.h"
+#include "wsdirs.h"
+#include "wsindex.h"
+#include "wsmove.h"
+#include "wsshards.h"
+#include "wsverify.h"
+
+using namespace std;
+
+
+// entries changed this recently can be in the middle of an allocate, release or restore
+static const long grace = 300;
+
+// entries a thread takes at once
+static const size_t batchsize = 256;
+
+enum Status { OK, GONE, UNREADABLE, NOSPACE, MISSING, NOTDIR, FAILED };
+
+struct Item {
+    string name;
+    string workspace;   // from the index, read from the entry if empty
+    string path;        // directory that has to exist
+    Status status;
+    int error;
+};
+
+
+// directory of a workspace, or where release moved it to
+static string expected(const string workspace, const string deleted, const string name) {
+    if (deleted.empty()) return workspace;
+    size_t pos = workspace.rfind('/');
+    return (pos == string::npos ? string(".") : workspace.substr(0, pos)) + "/" + deleted + "/" + name;
+}
+
+static Status check(const string path, int &error) {
+    string name;
+    int dfd = WsDirs::parent(path, name);
+    if (dfd < 0) {
+        error = errno;
+        return NOSPACE;
+    }
+    struct stat st;
+    if (fstatat(dfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        error = errno;
+        return errno == ENOENT ? MISSING : FAILED;
+    }
+    return S_ISDIR(st.st_mode) ? OK : NOTDIR;
+}
+
+static bool readworkspace(const string filename, const int dbuid, const int dbgid, string &workspace) {
+    try {
+        WsDB entry(filename, dbuid, dbgid);
+        workspace = entry.getwsdir();
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+static void verifyitem(Item &item, const string dbdir, const string deleted, const int dbuid, const int dbgid) {
+    string filename = dbdir + "/" + item.name;
+    bool fromindex = !item.workspace.empty();
+    if (!fromindex && !readworkspace(filename, dbuid, dbgid, item.workspace)) {
+        // released or expired since the directory was listed
+        item.status = WsShards::exists(filename) ? UNREADABLE : GONE;
+        return;
+    }
+    item.path = expected(item.workspace, deleted, item.name);
+    item.status = check(item.path, item.error);
+    if (item.status != MISSING || !fromindex) return;
+
+    // the index can be behind the entries, a miss is confirmed with the entry
+    string workspace;
+    if (!readworkspace(filename, dbuid, dbgid, workspace)) {
+        item.status = WsShards::exists(filename) ? UNREADABLE : GONE;
+    } else if (workspace != item.workspace) {
+        item.workspace = workspace;
+        item.path = expected(workspace, deleted, item.name);
+        item.status = check(item.path, item.error);
+    }
+}
+
+// a release or restore of the workspace is moving it, journals of all owners count
+static bool moving(const Item &item) {
+    struct stat st;
+    return lstat(movejournal(item.workspace).c_str(), &st) == 0 ||
+           (item.path != item.workspace && lstat(movejournal(item.path).c_str(), &st) == 0);
+}
+
+/*
+ * move the entry of a missing workspace to the quarantine directory, after checking
+ * again that it was not changed or renamed recently, that no release or restore is
+ * moving the workspace and that the workspace is still missing
+ */
+static string quarantineitem(const Item &item, const string dbdir, const string deleted, const int dbuid,
+                             const int dbgid, const string qdir) {
+    string filename = WsShards::locate(dbdir + "/" + item.name);
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return "gone";
+    }
+    // a rename, as done by release and restore, changes ctime but not mtime
+    if (st.st_ctime > time(NULL) - grace) {
+        return "recently changed, kept";
+    }
+    // released entries of the deleted directory are settled, in the DB directory
+    // the release is still moving the workspace
+    try {
+        WsDB entry(dbdir + "/" + item.name, dbuid, dbgid);
+        if (deleted.empty() && entry.getreleased() > 0) {
+            return "being released, kept";
+        }
+    } catch (...) {
+        return "unreadable, kept";
+    }
+    if (moving(item)) {
+        return "being moved, kept";
+    }
+    int error;
+    if (check(item.path, error) != MISSING) {
+        return "found, kept";
+    }
+    if (WsDirs::renamenoreplace(filename, qdir + "/" + item.name)) {
+        return string("not quarantined: ") + strerror(errno);
+    }
+    WsIndex::remove(dbdir + "/" + item.name);
+    return "quarantined";
+}
+
+static string describe(const Item &item) {
+    switch (item.status) {
+        case UNREADABLE:
+            return "unreadable DB entry";
+        case NOSPACE:
+            return string("directory not accessible: ") + strerror(item.error);
+        case MISSING:
+            return "missing";
+        case NOTDIR:
+            return "not a directory";
+        case FAILED:
+            return string("error: ") + strerror(item.error);
+        default:
+            return "ok";
+    }
+}
+
+
+string WsVerify::quarantinedir(const string dbdir) {
+    return dbdir + "/.ws_quarantine";
+}
+
+bool WsVerify::verify(const string dbdir, const string deleted, const int threads, const bool quarantine,
+                      const int dbuid, const int dbgid, long &dangling) {
+    auto start = chrono::steady_clock::now();
+    dangling = 0;
+
+    // names and workspaces from the index if there is one, else only the names,
+    // the threads read the entries
+    vector<Item> items;
+    WsIndex index(dbdir);
+    if (index.valid()) {
+        for (const WsIndexRecord *r: index.entries()) {
+            items.push_back(Item{index.getstring(r->name), index.getstring(r->workspace), "", OK, 0});
+        }
+    } else {
+        vector<string> dirs = WsShards::dirs(dbdir);
+        set<string> seen;
+        for (const string &d: dirs) {
+            DIR *dir = opendir(d.c_str());
+            if (dir == NULL) {
+                cerr << "Error: could not read DB directory " << d << endl;
+                return false;
+            }
+            struct dirent *de;
+            while ((de = readdir(dir)) != NULL) {
+                string name = de->d_name;
+                // entries are <user>-<name>, no dotfiles
+                if (name[0] == '.' || name.find('-') == string::npos) continue;
+                if (dirs.size() > 1 && !seen.insert(name).second) continue;
+                items.push_back(Item{name, "", "", OK, 0});
+            }
+            closedir(dir);
+        }
+    }
+
+    // the directories of the spaces are opened once and kept by WsDirs, so each
+    // check is a single fstatat() relative to it
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int t = 0; t < max(threads, 1); t++) {
+        workers.push_back(thread([&]() {
+            size_t first;
+            while ((first = next.fetch_add(batchsize)) < items.size()) {
+                size_t last = min(first + batchsize, items.size());
+                for (size_t i = first; i < last; i++) {
+                    verifyitem(items[i], dbdir, deleted, dbuid, dbgid);
+                }
+            }
+        }));
+    }
+    for (thread &t: workers) t.join();
+
+    vector<const Item*> found;
+    for (const Item &item: items) {
+        if (item.status != OK && item.status != GONE) found.push_back(&item);
+    }
+    sort(found.begin(), found.end(), [](const Item *a, const Item *b) { return a->name < b->name; });
+
+    string qdir = quarantinedir(dbdir);
+    if (quarantine) {
+        bool hasmissing = any_of(found.begin(), found.end(), [](const Item *i) { return i->status == MISSING; });
+        if (hasmissing) {
+            if (mkdir(qdir.c_str(), 0755) != 0 && errno != EEXIST) {
+                cerr << "Error: could not create " << qdir << endl;
+                return false;
+            }
+            if (chown(qdir.c_str(), dbuid, dbgid)) {
+                cerr << "Warning: could not change owner of " << qdir << endl;
+            }
+        }
+    }
+
+    long quarantined = 0;
+    for (const Item *item: found) {
+        string state = describe(*item);
+        if (item->status == MISSING) {
+            dangling++;
+            if (quarantine) {
+                string result = quarantineitem(*item, dbdir, deleted, dbuid, dbgid, qdir);
+                if (result == "quarantined") quarantined++;
+                state += ", " + result;
+            }
+        }
+        cout << item->name << " " << (item->path.empty() ? item->workspace : item->path) << " " << state << endl;
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cerr << "Info: checked " << items.size() << " entries of " << dbdir << " in " << elapsed.count()
+         << " seconds, " << dangling << " without workspace, " << found.size() - dangling << " other problems";
+    if (quarantine) {
+        cerr << ", " << quarantined << " quarantined in " << qdir;
+    }
+    cerr << endl;
+    return true;
+}
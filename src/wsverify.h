@@ -0,0 +1,50 @@
+#ifndef WSVERIFY_H
+#define WSVERIFY_H
+
+/*
+ *  workspace++
+ *
+ *  wsverify
+ *
+ *  check that the workspace directories of the DB entries exist
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+
+using namespace std;
+
+class WsVerify {
+
+public:
+    // check the workspace directory of every entry of dbdir with threads
+    // parallel checks and print the entries that have none. deleted is the name
+    // of the deleted directory if dbdir holds entries of released workspaces,
+    // empty for dbdir itself. With quarantine, entries whose workspace is missing
+    // are moved to the quarantine directory of dbdir. dangling gets the number of
+    // entries found without workspace, false if dbdir could not be read.
+    static bool verify(const string dbdir, const string deleted, const int threads, const bool quarantine,
+                       const int dbuid, const int dbgid, long &dangling);
+
+    // directory quarantined entries are moved to
+    static string quarantinedir(const string dbdir);
+};
+
+#endif
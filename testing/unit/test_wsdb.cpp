@@ -0,0 +1,382 @@
+/*
+ *  workspace++
+ *
+ *  test_wsdb
+ *
+ *  unit test of WsDB: the streaming parser has to read every entry exactly
+ *  like yaml-cpp does, or leave it to yaml-cpp, and readers never see a
+ *  partly written entry, whenever a writer dies
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include "wsdb.h"
+#include "wsdirs.h"
+#include "wsshards.h"
+#include "wserror.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+// everything read from an entry, or the error, to compare both parsers
+static string readentry(const string filename, const bool fast) {
+    WsDB::fastparse = fast;
+    ostringstream r;
+    try {
+        WsDB entry(filename, 0, 0);
+        r << "workspace=" << entry.getwsdir() << "|expiration=" << entry.getexpiration()
+          << "|extensions=" << entry.getextension() << "|acctcode=" << entry.getacctcode()
+          << "|reminder=" << entry.getreminder() << "|mailaddress=" << entry.getmailaddress()
+          << "|group=" << entry.getgroup() << "|comment=" << entry.getcomment()
+          << "|released=" << entry.getreleased();
+    } catch (...) {
+        r << "error";
+    }
+    WsDB::fastparse = true;
+    return r.str();
+}
+
+// entry as written by WsDB::write_dbfile
+static string emitentry(const string workspace, const string acctcode, const string mailaddress,
+                        const string group, const string comment, const long released) {
+    YAML::Node entry;
+    entry["workspace"] = workspace;
+    entry["expiration"] = 1600000000L;
+    entry["extensions"] = 3;
+    entry["acctcode"] = acctcode;
+    entry["reminder"] = 1599000000L;
+    entry["mailaddress"] = mailaddress;
+    if (group.length() > 0) {
+        entry["group"] = group;
+    }
+    if (released > 0) {
+        entry["released"] = released;
+    }
+    entry["comment"] = comment;
+    ostringstream data;
+    data << entry;
+    return data.str();
+}
+
+// strings yaml-cpp has to quote or escape, and some it does not
+static const vector<string> values = {
+    "plain", "", " leading space", "trailing space ", "key: value", "a #comment", "#start",
+    "-dash", "- item", "?question", "[list]", "{map}", "'single'", "\"double\"", "back\\slash",
+    "tab\there", "new\nline", "cr\rhere", "null", "Null", "~", "true", "yes", "no", "123",
+    "0x10", "1e3", "-5", "colon:", "@at", "`tick`", "%percent", "*alias", "&anchor", "!tag",
+    "|pipe", ">fold", "\xc3\xa4\xc3\xb6\xc3\xbc", "a,b", "x: y # z", "..."
+};
+
+static void testroundtrip(const string dir) {
+    string filename = dir + "/user-roundtrip";
+    for (const string &v: values) {
+        for (int field = 0; field < 5; field++) {
+            string content = emitentry(field == 0 ? "/ws/" + v : "/ws/user-roundtrip",
+                                       field == 1 ? v : "acct",
+                                       field == 2 ? v : "user@example.com",
+                                       field == 3 ? v : "",
+                                       field == 4 ? v : "",
+                                       field % 2 ? 1600000001L : 0);
+            string entryfile = writefile(filename, content);
+            string fast = readentry(entryfile, true);
+            string yaml = readentry(entryfile, false);
+            if (fast != yaml) {
+                cerr << "different for value <" << v << "> in field " << field << ":\n" << content << endl;
+            }
+            CHECK_EQUAL(fast, yaml);
+        }
+        // comments round trip through yaml-cpp, apart from what reads as null
+        WsDB entry(writefile(filename, emitentry("/ws/x", "acct", "user@example.com", "", v, 0)), 0, 0);
+        if (v != "~" && v != "null" && v != "Null") {
+            CHECK_EQUAL(entry.getcomment(), v);
+        }
+    }
+}
+
+// entries not written by write_dbfile, edited by hand or by other tools
+static const vector<string> handwritten = {
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: \"\"\ncomment: \"\"",
+    "workspace: \"/ws/a\"\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: \"a@b\"\ncomment: \"say \\\"hi\\\"\"",
+    "workspace: '/ws/a'\nexpiration: 1600000000\nextensions: 3\nacctcode: 'it''s'\nreminder: 0\nmailaddress: ''\ncomment: ''",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b # note\ncomment: \"\"",
+    "workspace: /ws/a\nexpiration:  1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"",
+    "workspace: /ws/a\r\nexpiration: 1600000000\r\nextensions: 3\r\nacctcode: acct\r\nreminder: 0\r\nmailaddress: a@b\r\ncomment: \"\"\r\n",
+    "comment: x\nmailaddress: a@b\nreminder: 0\nacctcode: acct\nextensions: 3\nexpiration: 1600000000\nworkspace: /ws/a\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\nunknown: 1\n",
+    "workspace: /ws/a\nexpiration: +1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\n",
+    "workspace: /ws/a\nexpiration: 0x10\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 1.5\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\n",
+    "workspace: /ws/a\nexpiration: 99999999999999999999\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: |\n  two\n  lines\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: first\n  continued\n",
+    "---\nworkspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\ncomment: \"\"\n",
+    "{workspace: /ws/a, expiration: 1600000000, extensions: 3, acctcode: acct, reminder: 0, mailaddress: a@b}\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\n",
+    "workspace: /ws/a\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\n",
+    "workspace: ~\nexpiration: 1600000000\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: a@b\n",
+    "",
+};
+
+static void testhandwritten(const string dir) {
+    string filename = dir + "/user-handwritten";
+    for (const string &content: handwritten) {
+        string entryfile = writefile(filename, content);
+        string fast = readentry(entryfile, true);
+        string yaml = readentry(entryfile, false);
+        if (fast != yaml) {
+            cerr << "different for entry:\n" << content << endl;
+        }
+        CHECK_EQUAL(fast, yaml);
+    }
+}
+
+// entries of the python version
+static void testlegacy(const string dir) {
+    string filename = dir + "/user-legacy";
+    string entryfile = writefile(filename, "1600000000\n/ws/user-legacy\nacctcode:project\nextensions:2\n");
+    string fast = readentry(entryfile, true);
+    CHECK_EQUAL(fast, readentry(entryfile, false));
+    CHECK_EQUAL(fast, "workspace=/ws/user-legacy|expiration=1600000000|extensions=2|acctcode=project"
+                      "|reminder=0|mailaddress=|group=|comment=|released=0");
+}
+
+// every prefix of an entry, as left by a writer that did not write atomically
+static void testtruncated(const string dir) {
+    string filename = dir + "/user-truncated";
+    vector<string> entries = {
+        emitentry("/ws/user-truncated", "acct", "user@example.com", "group", "needs quoting: yes", 1600000001L),
+        "1600000000\n/ws/user-legacy\nacctcode:project\nextensions:2\n",
+    };
+    for (const string &content: entries) {
+        for (size_t len = 0; len <= content.size(); len++) {
+            string entryfile = writefile(filename, content.substr(0, len));
+            string fast = readentry(entryfile, true);
+            string yaml = readentry(entryfile, false);
+            if (fast != yaml) {
+                cerr << "different for entry truncated to " << len << " bytes:\n" << content.substr(0, len) << endl;
+            }
+            CHECK_EQUAL(fast, yaml);
+        }
+    }
+}
+
+static bool created(const string filename, const string wsdir) {
+    try {
+        WsDB entry(filename, wsdir, 1600000000L, 3, "acct", getuid(), getgid(), 0, "", "", "");
+        return true;
+    } catch (const WsError &e) {
+        return false;
+    }
+}
+
+// a new entry never replaces an existing one, in its shard or still flat
+static void testcreate(const string dir) {
+    string filename = dir + "/user-create";
+    CHECK(created(filename, "/ws/first"));
+    CHECK(!created(filename, "/ws/second"));
+    CHECK_EQUAL(WsDB(filename, 0, 0).getwsdir(), "/ws/first");
+
+    // rewriting an entry that was read replaces it
+    WsDB entry(filename, 0, 0);
+    entry.setexpiration(1700000000L);
+    entry.write_dbfile();
+    CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), 1700000000L);
+
+    string sharded = dir + "/sharded";
+    mkdir(sharded.c_str(), 0755);
+    // the layout migrate() leaves, without waiting for other processes
+    for (const string shard: {"/00", "/01", "/02", "/03"}) {
+        mkdir((sharded + shard).c_str(), 0755);
+    }
+    CHECK(rename(writefile(sharded + "/.ws_shards", "4\n").c_str(), (sharded + "/.ws_shards").c_str()) == 0);
+    CHECK_EQUAL(WsShards::fanout(sharded), 4);
+    string flat = sharded + "/user-flat";
+    CHECK(rename(writefile(flat, emitentry("/ws/flat", "acct", "", "", "", 0)).c_str(), flat.c_str()) == 0);
+    CHECK(!created(flat, "/ws/shard"));
+    CHECK(!WsDirs::exists(WsShards::canonical(flat)));
+    CHECK(created(sharded + "/user-new", "/ws/new"));
+    CHECK(WsDirs::exists(WsShards::canonical(sharded + "/user-new")));
+}
+
+static bool exists(const string path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+// temporary files of write_dbfile for entry name left in dir
+static int tmpfiles(const string dir, const string name) {
+    int n = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        if (string(de->d_name).compare(0, name.size() + 2, "." + name + ".") == 0) n++;
+    }
+    if (d) closedir(d);
+    return n;
+}
+
+// temporary files of a crashed writer, even one with the same pid, do not block writes
+static void testleftover(const string dir) {
+    string filename = dir + "/user-leftover";
+    for (int i = 0; i < 50; i++) {
+        string tmp = dir + "/.user-leftover." + to_string(getpid()) + "." + to_string(i);
+        CHECK(rename(writefile(tmp, "workspace: /ws/par").c_str(), tmp.c_str()) == 0);
+    }
+    string other = dir + "/.user-leftover.1.0";
+    CHECK(rename(writefile(other, "workspace: /ws/par").c_str(), other.c_str()) == 0);
+
+    CHECK(created(filename, "/ws/leftover"));
+    CHECK_EQUAL(WsDB(filename, 0, 0).getwsdir(), "/ws/leftover");
+    CHECK_EQUAL(tmpfiles(dir, "user-leftover"), 51);
+}
+
+/*
+ * a writer rewriting an entry as fast as it can, killed at some point, readers
+ * see the old or the new entry, but never a partial one
+ */
+static void testkilledwriter(const string dir) {
+    string filename = dir + "/user-killed";
+    string comment(5000, 'c');
+    WsDB(filename, "/ws/killed", 1600000000L, 3, "acct", getuid(), getgid(), 0, "", "", comment);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        WsDB entry(filename, 0, 0);
+        for (long i = 0; ; i++) {
+            entry.setexpiration(1600000000L + i % 2);
+            entry.write_dbfile();
+        }
+    }
+    int reads = 0, partial = 0;
+    time_t end = time(NULL) + 1;
+    while (time(NULL) < end || reads < 100) {
+        try {
+            WsDB entry(filename, 0, 0);
+            if (entry.getwsdir() != "/ws/killed" || entry.getcomment() != comment ||
+                    (entry.getexpiration() != 1600000000L && entry.getexpiration() != 1600000001L)) {
+                partial++;
+            }
+        } catch (...) {
+            partial++;
+        }
+        reads++;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    CHECK_EQUAL(partial, 0);
+    CHECK_EQUAL(WsDB(filename, 0, 0).getcomment(), comment);
+}
+
+static void setexpiration(const string filename, const long expiration) {
+    WsDB entry(filename, 0, 0);
+    entry.setexpiration(expiration);
+    entry.write_dbfile();
+}
+
+// a batch that was never committed changes nothing
+static void testuncommitted(const string dir) {
+    string filename = dir + "/user-uncommitted";
+    CHECK(created(filename, "/ws/uncommitted"));
+    setexpiration(filename, 1600000000L);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        WsDB::begin_batch();
+        setexpiration(filename, 1700000000L);
+        created(dir + "/user-uncommitted-new", "/ws/new");
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+    CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), 1600000000L);
+    CHECK(!exists(dir + "/user-uncommitted-new"));
+}
+
+/*
+ * entries of a batch become visible with commit_batch, a new entry created by
+ * another process meanwhile is not replaced and reported as failed
+ */
+static void testbatch(const string dir) {
+    string filename = dir + "/user-batch";
+    CHECK(created(filename, "/ws/batch"));
+    setexpiration(filename, 1600000000L);
+
+    WsDB::begin_batch();
+    setexpiration(filename, 1700000000L);
+    CHECK(created(dir + "/user-batch-new", "/ws/new"));
+    CHECK(created(dir + "/user-batch-race", "/ws/race"));
+    CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), 1600000000L);
+    CHECK(!exists(dir + "/user-batch-new"));
+
+    string race = dir + "/user-batch-race";
+    CHECK(rename(writefile(race, emitentry("/ws/other", "acct", "", "", "", 0)).c_str(), race.c_str()) == 0);
+
+    vector<string> failed;
+    CHECK(!WsDB::commit_batch(&failed));
+    CHECK_EQUAL(failed.size(), 1u);
+    CHECK(failed.size() == 1 && failed[0] == race);
+    CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), 1700000000L);
+    CHECK_EQUAL(WsDB(dir + "/user-batch-new", 0, 0).getwsdir(), "/ws/new");
+    CHECK_EQUAL(WsDB(race, 0, 0).getwsdir(), "/ws/other");
+    CHECK_EQUAL(tmpfiles(dir, "user-batch") + tmpfiles(dir, "user-batch-new") + tmpfiles(dir, "user-batch-race"), 0);
+
+    // entries written after the commit are written at once again
+    setexpiration(filename, 1800000000L);
+    CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), 1800000000L);
+}
+
+int main() {
+    string dir = maketempdir("test_wsdb");
+
+    testroundtrip(dir);
+    testhandwritten(dir);
+    testlegacy(dir);
+    testtruncated(dir);
+
+    // writing entries raises and lowers privileges like the setuid tools do
+    if (geteuid() == 0) {
+        testleftover(dir);
+        testcreate(dir);
+        testkilledwriter(dir);
+        testuncommitted(dir);
+        testbatch(dir);
+    } else {
+        cerr << "test_wsdb: not root, writing of entries not tested" << endl;
+    }
+
+    system(("rm -rf " + dir).c_str());
+    return result("test_wsdb");
+}
@@ -0,0 +1,173 @@
+/*
+ *  workspace++
+ *
+ *  test_wsdelete
+ *
+ *  unit test of deletetree: symlinks are removed, never followed, and trees
+ *  nested deeper than PATH_MAX and the fd limit are removed completely
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "wsdelete.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+static bool exists(const string path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+static void touch(const string path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0) {
+        CHECK(write(fd, "data", 4) == 4);
+        close(fd);
+    }
+}
+
+// data outside of the tree the symlinks point to, has to survive
+static void makeoutside(const string outside) {
+    mkdir(outside.c_str(), 0755);
+    mkdir((outside + "/dir").c_str(), 0755);
+    touch(outside + "/dir/file");
+    touch(outside + "/file");
+}
+
+static bool outsideintact(const string outside) {
+    return exists(outside + "/dir") && exists(outside + "/dir/file") && exists(outside + "/file");
+}
+
+// symlinks of all kinds in dir, returns how many
+static int makesymlinks(const string dir, const string outside) {
+    int n = 0;
+    n += symlink((outside + "/dir").c_str(), (dir + "/todir").c_str()) == 0;
+    n += symlink((outside + "/file").c_str(), (dir + "/tofile").c_str()) == 0;
+    n += symlink("..", (dir + "/toparent").c_str()) == 0;
+    n += symlink("/", (dir + "/toroot").c_str()) == 0;
+    n += symlink("loop", (dir + "/loop").c_str()) == 0;
+    n += symlink("nowhere", (dir + "/dangling").c_str()) == 0;
+    return n;
+}
+
+static void testsymlinks(const string base, const int threads) {
+    string outside = base + "/outside";
+    string tree = base + "/tree";
+    makeoutside(outside);
+    mkdir(tree.c_str(), 0755);
+
+    // symlinks at the top, in a wide part and in subdirectories, files and dirs around them
+    long expectfiles = makesymlinks(tree, outside), expectdirs = 1;
+    for (int i = 0; i < 20; i++) {
+        string sub = tree + "/sub" + to_string(i);
+        mkdir(sub.c_str(), 0755);
+        expectdirs++;
+        expectfiles += makesymlinks(sub, outside);
+        for (int f = 0; f < 100; f++) {
+            touch(sub + "/f" + to_string(f));
+            expectfiles++;
+        }
+    }
+
+    DeleteStats stats;
+    string error;
+    CHECK(deletetree(tree, threads, stats, error));
+    CHECK_EQUAL(error, "");
+    CHECK(!exists(tree));
+    CHECK(outsideintact(outside));
+    CHECK_EQUAL(stats.files, (uint64_t)expectfiles);
+    CHECK_EQUAL(stats.dirs, (uint64_t)expectdirs);
+    CHECK_EQUAL(stats.errors, 0u);
+
+    // a symlink given as the tree is removed, not what it points to
+    string link = base + "/link";
+    CHECK(symlink((outside + "/dir").c_str(), link.c_str()) == 0);
+    DeleteStats lstats;
+    CHECK(deletetree(link, threads, lstats, error));
+    CHECK(!exists(link));
+    CHECK(outsideintact(outside));
+}
+
+// a chain of directories with a symlink and a file in each level
+static void testdeep(const string base, const int threads, const int depth) {
+    string outside = base + "/outside";
+    string tree = base + "/deep";
+    makeoutside(outside);
+
+    // built with openat(), the path is far longer than PATH_MAX
+    string name(40, 'd');
+    mkdir(tree.c_str(), 0755);
+    int fd = open(tree.c_str(), O_RDONLY | O_DIRECTORY);
+    for (int i = 0; i < depth && fd >= 0; i++) {
+        CHECK(symlinkat((outside + "/dir").c_str(), fd, "todir") == 0);
+        CHECK(symlinkat("..", fd, "toparent") == 0);
+        int ffd = openat(fd, "file", O_WRONLY | O_CREAT | O_EXCL, 0644);
+        CHECK(ffd >= 0);
+        if (ffd >= 0) close(ffd);
+        CHECK(mkdirat(fd, name.c_str(), 0755) == 0);
+        int next = openat(fd, name.c_str(), O_RDONLY | O_DIRECTORY);
+        close(fd);
+        fd = next;
+    }
+    CHECK(fd >= 0);
+    if (fd >= 0) close(fd);
+
+    DeleteStats stats;
+    string error;
+    CHECK(deletetree(tree, threads, stats, error));
+    CHECK_EQUAL(error, "");
+    CHECK(!exists(tree));
+    CHECK(outsideintact(outside));
+    CHECK_EQUAL(stats.files, (uint64_t)depth * 3);
+    CHECK_EQUAL(stats.dirs, (uint64_t)depth + 1);
+}
+
+int main() {
+    string base = maketempdir("test_wsdelete");
+
+    testsymlinks(base, 1);
+    testsymlinks(base, 8);
+
+    // deeper than the fds the deleter may use
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = 64;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    testdeep(base, 1, 300);
+    testdeep(base, 8, 300);
+
+    // deeper than PATH_MAX with the usual limit
+    rl.rlim_cur = 1024;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    testdeep(base, 4, 2000);
+
+    system(("rm -rf " + base).c_str());
+    return result("test_wsdelete");
+}
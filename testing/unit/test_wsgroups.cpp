@@ -0,0 +1,113 @@
+/*
+ *  workspace++
+ *
+ *  test_wsgroups
+ *
+ *  unit test of the group cache: tools without privileges, like ws_list,
+ *  read the cache but never fail trying to write it
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+
+#include "wsconfig.h"
+#include "wsgroups.h"
+#include "wserror.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+static bool exists(const string path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+// root writes the cache, the names come back from it
+static void testroot() {
+    vector<string> names = WsGroups::getgroupnames("root", 0);
+    CHECK(!names.empty());
+    CHECK(exists(string(WS_GROUPCACHE) + "/root"));
+
+    WsGroups::clear();
+    CHECK(WsGroups::getgroupnames("root", 0) == names);
+}
+
+// a process which can not raise its privileges, like ws_list as nobody,
+// reads the cache of root and resolves its own groups without writing
+static void testunprivileged(const struct passwd *pw) {
+    vector<string> rootnames = WsGroups::getgroupnames("root", 0);
+    WsGroups::clear();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (setgroups(0, NULL) != 0 || setgid(pw->pw_gid) != 0 || setuid(pw->pw_uid) != 0) {
+            cerr << "can not become " << pw->pw_name << endl;
+            _exit(2);
+        }
+        try {
+            CHECK(!WsGroups::getgroupnames(pw->pw_name, pw->pw_gid).empty());
+            CHECK(WsGroups::getgroupnames("root", 0) == rootnames);
+        } catch (const WsError &e) {
+            cerr << "getgroupnames failed: " << e.what() << endl;
+            failures++;
+        }
+        _exit(failures ? 1 : 0);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(!exists(string(WS_GROUPCACHE) + "/" + pw->pw_name));
+}
+
+
+int main() {
+    if (geteuid() != 0) {
+        cerr << "test_wsgroups: needs root to own the cache and to change uid, skipped" << endl;
+        return TEST_SKIPPED;
+    }
+    struct passwd *pw = getpwnam("nobody");
+    if (pw == NULL) {
+        cerr << "test_wsgroups: no user nobody, skipped" << endl;
+        return TEST_SKIPPED;
+    }
+    if (WsConfig::get().groupcachettl <= 0) {
+        cerr << "test_wsgroups: groupcachettl not set in " << WS_CONFIGFILE << endl;
+        return 1;
+    }
+
+    system("rm -rf " WS_GROUPCACHE);
+    CHECK(mkdir(WS_GROUPCACHE, 0755) == 0);
+
+    testroot();
+    testunprivileged(pw);
+
+    system("rm -rf " WS_GROUPCACHE);
+    return result("test_wsgroups");
+}
@@ -0,0 +1,328 @@
+/*
+ *  workspace++
+ *
+ *  test_wsmove
+ *
+ *  unit test of movetree: a move interrupted during the copy or during the
+ *  removal of the source continues from its journal, trees deeper than the
+ *  fd limit are copied, hard links stay links
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "wsmove.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+static bool exists(const string path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+static void put(const string path, const string content) {
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out << content;
+}
+
+static string get(const string path) {
+    ifstream in(path.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static string journalof(const string source) {
+    size_t pos = source.rfind('/');
+    return source.substr(0, pos) + "/." + source.substr(pos + 1) + ".wsmove";
+}
+
+// source tree: files in subdirectories, a symlink and an empty directory
+static void makesource(const string src) {
+    mkdir(src.c_str(), 0755);
+    for (const string d: {"/a", "/b", "/c", "/c/deep", "/empty"}) {
+        mkdir((src + d).c_str(), 0755);
+    }
+    for (int i = 0; i < 5; i++) put(src + "/a/f" + to_string(i), "a" + to_string(i));
+    for (int i = 0; i < 3; i++) put(src + "/b/g" + to_string(i), "b" + to_string(i));
+    put(src + "/c/deep/x", "x");
+    put(src + "/top", "top");
+    CHECK(symlink("a/f0", (src + "/link").c_str()) == 0);
+}
+
+// everything of the source tree arrived in dest
+static void checkdest(const string dest, const string a0, const string b0) {
+    CHECK_EQUAL(get(dest + "/a/f0"), a0);
+    for (int i = 1; i < 5; i++) CHECK_EQUAL(get(dest + "/a/f" + to_string(i)), "a" + to_string(i));
+    CHECK_EQUAL(get(dest + "/b/g0"), b0);
+    for (int i = 1; i < 3; i++) CHECK_EQUAL(get(dest + "/b/g" + to_string(i)), "b" + to_string(i));
+    CHECK_EQUAL(get(dest + "/c/deep/x"), "x");
+    CHECK_EQUAL(get(dest + "/top"), "top");
+    char target[64] = {0};
+    CHECK(readlink((dest + "/link").c_str(), target, sizeof(target) - 1) > 0);
+    CHECK_EQUAL(string(target), "a/f0");
+    struct stat st;
+    CHECK(lstat((dest + "/empty").c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+/*
+ * a copy interrupted after a/f0 and all of b were checkpointed, with a torn
+ * last line and a partial copy of a/f1. The finished entries are marked in
+ * dest, so the test sees they are not copied again
+ */
+static void testresumecopy(const string base) {
+    string src = base + "/resume/src";
+    string dest = base + "/resume/dest";
+    mkdir((base + "/resume").c_str(), 0755);
+    makesource(src);
+
+    mkdir(dest.c_str(), 0700);
+    mkdir((dest + "/a").c_str(), 0700);
+    mkdir((dest + "/b").c_str(), 0700);
+    put(dest + "/a/f0", "journaled");
+    put(dest + "/a/f1", "partial");
+    put(dest + "/b/g0", "journaled");
+    put(dest + "/b/g1", "b1");
+    put(dest + "/b/g2", "b2");
+    put(journalof(src), "wsmove 1\n" + src + "\n" + dest + "\nF a/f0\nD b\nF a/f");
+
+    CHECK_EQUAL(movetarget(src), dest);
+
+    // another target than the pending one is refused, nothing changes
+    MoveStats other;
+    string error;
+    CHECK(!movetree(src, base + "/resume/other", 2, other, error));
+    CHECK(error.find("pending") != string::npos);
+    CHECK(exists(src + "/top") && exists(journalof(src)));
+
+    // the pending target continues the move
+    MoveStats stats;
+    error.clear();
+    CHECK(movetree(src, dest, 2, stats, error));
+    CHECK_EQUAL(error, "");
+    CHECK(!stats.renamed);
+    checkdest(dest, "journaled", "journaled");
+    CHECK(!exists(src));
+    CHECK(!exists(journalof(src)));
+    CHECK_EQUAL(movetarget(src), "");
+}
+
+// everything was copied, the removal of the source was interrupted
+static void testresumeremove(const string base) {
+    string src = base + "/remove/src";
+    string dest = base + "/remove/dest";
+    mkdir((base + "/remove").c_str(), 0755);
+    makesource(src);
+    makesource(dest);
+    put(dest + "/a/f0", "copied");
+    unlink((src + "/top").c_str());
+    system(("rm -rf " + src + "/a").c_str());
+    put(journalof(src), "wsmove 1\n" + src + "\n" + dest + "\nD a\nD b\nD c\nD empty\nF top\nF link\nC\n");
+
+    MoveStats stats;
+    string error;
+    CHECK(movetree(src, dest, 2, stats, error));
+    CHECK_EQUAL(error, "");
+    checkdest(dest, "copied", "b0");
+    CHECK(!exists(src));
+    CHECK(!exists(journalof(src)));
+}
+
+/*
+ * a real move between two filesystems, killed while copying, and started again.
+ * Needs a second filesystem, /dev/shm or WS_TEST_OTHERFS
+ */
+static bool testkilled(const string base) {
+    const char *env = getenv("WS_TEST_OTHERFS");
+    string other = env ? env : "/dev/shm";
+    struct stat bst, ost;
+    if (stat(base.c_str(), &bst) != 0 || stat(other.c_str(), &ost) != 0 || bst.st_dev == ost.st_dev) {
+        cerr << "test_wsmove: no second filesystem, set WS_TEST_OTHERFS to test an interrupted copy" << endl;
+        return false;
+    }
+    string otherbase = other + "/test_wsmove.XXXXXX";
+    if (mkdtemp(&otherbase[0]) == NULL) return false;
+
+    string src = base + "/killed";
+    string dest = otherbase + "/killed";
+    mkdir(src.c_str(), 0755);
+    const int dirs = 20, files = 200;
+    string data(16384, 'x');
+    for (int d = 0; d < dirs; d++) {
+        string dir = src + "/d" + to_string(d);
+        mkdir(dir.c_str(), 0755);
+        for (int f = 0; f < files; f++) put(dir + "/f" + to_string(f), data + to_string(d * files + f));
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        MoveStats stats;
+        string error;
+        _exit(movetree(src, otherbase, 1, stats, error) ? 0 : 1);
+    }
+    // kill it when part of the tree arrived
+    for (int i = 0; i < 10000 && !exists(dest + "/d1/f10"); i++) usleep(1000);
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status)) {
+        cerr << "test_wsmove: the move finished before it could be interrupted" << endl;
+    } else {
+        CHECK_EQUAL(movetarget(src), dest);
+        MoveStats stats;
+        string error;
+        CHECK(movetree(src, otherbase, 4, stats, error));
+        CHECK_EQUAL(error, "");
+    }
+    CHECK(!exists(src));
+    CHECK(!exists(journalof(src)));
+    bool complete = true;
+    for (int d = 0; d < dirs; d++) {
+        for (int f = 0; f < files; f++) {
+            string path = dest + "/d" + to_string(d) + "/f" + to_string(f);
+            if (get(path) != data + to_string(d * files + f)) complete = false;
+        }
+    }
+    CHECK(complete);
+    system(("rm -rf " + otherbase).c_str());
+    return true;
+}
+
+// copy src to dest in the same filesystem, a journal without entries makes
+// movetree copy instead of renaming
+static bool copytree(const string src, const string dest, const int threads, MoveStats &stats, string &error) {
+    put(journalof(src), "wsmove 1\n" + src + "\n" + dest + "\n");
+    return movetree(src, dest, threads, stats, error);
+}
+
+// a chain of directories with a file in each level
+static void testdeep(const string base, const int threads, const int depth) {
+    string src = base + "/deep";
+    string dest = base + "/deepdest";
+
+    // built with openat(), the path is far longer than PATH_MAX
+    string name(40, 'd');
+    mkdir(src.c_str(), 0755);
+    int fd = open(src.c_str(), O_RDONLY | O_DIRECTORY);
+    for (int i = 0; i < depth && fd >= 0; i++) {
+        int ffd = openat(fd, "file", O_WRONLY | O_CREAT | O_EXCL, 0644);
+        CHECK(ffd >= 0);
+        if (ffd >= 0) close(ffd);
+        CHECK(mkdirat(fd, name.c_str(), 0750) == 0);
+        int next = openat(fd, name.c_str(), O_RDONLY | O_DIRECTORY);
+        close(fd);
+        fd = next;
+    }
+    CHECK(fd >= 0);
+    if (fd >= 0) close(fd);
+
+    MoveStats stats;
+    string error;
+    CHECK(copytree(src, dest, threads, stats, error));
+    CHECK_EQUAL(error, "");
+    CHECK(!exists(src));
+    CHECK_EQUAL(stats.files, (uint64_t)depth);
+    CHECK_EQUAL(stats.dirs, (uint64_t)depth + 1);
+
+    // every level arrived with its mode
+    fd = open(dest.c_str(), O_RDONLY | O_DIRECTORY);
+    int levels = 0;
+    struct stat st;
+    while (fd >= 0 && fstatat(fd, "file", &st, 0) == 0) {
+        levels++;
+        int next = openat(fd, name.c_str(), O_RDONLY | O_DIRECTORY);
+        if (next >= 0 && (fstat(next, &st) != 0 || (st.st_mode & 07777) != 0750)) levels = -depth;
+        close(fd);
+        fd = next;
+    }
+    if (fd >= 0) close(fd);
+    CHECK_EQUAL(levels, depth);
+    system(("rm -rf " + dest).c_str());
+}
+
+// files with several links in the tree are linked in dest, links to outside are copies
+static void testhardlinks(const string base, const int threads) {
+    string src = base + "/links";
+    string dest = base + "/linksdest";
+    mkdir(src.c_str(), 0755);
+    for (const string d: {"/a", "/b", "/c"}) mkdir((src + d).c_str(), 0755);
+    put(src + "/a/h", "linked");
+    CHECK(link((src + "/a/h").c_str(), (src + "/b/h").c_str()) == 0);
+    CHECK(link((src + "/a/h").c_str(), (src + "/c/h").c_str()) == 0);
+    put(src + "/a/o", "outside");
+    CHECK(link((src + "/a/o").c_str(), (base + "/outside").c_str()) == 0);
+
+    MoveStats stats;
+    string error;
+    CHECK(copytree(src, dest, threads, stats, error));
+    CHECK_EQUAL(error, "");
+
+    struct stat a, b, c, o;
+    CHECK(stat((dest + "/a/h").c_str(), &a) == 0);
+    CHECK(stat((dest + "/b/h").c_str(), &b) == 0);
+    CHECK(stat((dest + "/c/h").c_str(), &c) == 0);
+    CHECK_EQUAL(a.st_nlink, (nlink_t)3);
+    CHECK(a.st_ino == b.st_ino && a.st_ino == c.st_ino);
+    CHECK_EQUAL(get(dest + "/c/h"), "linked");
+    CHECK(stat((dest + "/a/o").c_str(), &o) == 0);
+    CHECK_EQUAL(o.st_nlink, (nlink_t)1);
+    CHECK_EQUAL(get(base + "/outside"), "outside");
+
+    unlink((base + "/outside").c_str());
+    system(("rm -rf " + dest).c_str());
+}
+
+int main() {
+    string base = maketempdir("test_wsmove");
+
+    testresumecopy(base);
+    testresumeremove(base);
+    testkilled(base);
+    testhardlinks(base, 1);
+    testhardlinks(base, 4);
+
+    // deeper than the fds the mover may use
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rlim_t limit = rl.rlim_cur;
+    rl.rlim_cur = 64;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    testdeep(base, 1, 100);
+    testdeep(base, 8, 100);
+
+    // deeper than PATH_MAX and half of the usual limit
+    rl.rlim_cur = limit < 1024 ? limit : 1024;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    testdeep(base, 4, 600);
+
+    system(("rm -rf " + base).c_str());
+    return result("test_wsmove");
+}
@@ -0,0 +1,326 @@
+/*
+ *  workspace++
+ *
+ *  test_wsreminders
+ *
+ *  unit test of the reminder spool and its sender: reminders of a recipient are
+ *  coalesced into one mail, failed deliveries are retried with backoff and
+ *  dropped after maxattempts, and queueing a reminder again keeps its backoff.
+ *  The mails go to a SMTP sink on a local socket.
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsconfig.h"
+#include "wsreminders.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+struct Mail {
+    string from, to, data;
+};
+
+/*
+ * minimal SMTP server on 127.0.0.1, keeps the mails it got, refuses recipients
+ * in tempfail with 451 and in permfail with 550
+ */
+class SmtpSink {
+    int lfd;
+    thread server;
+    mutex lock;
+    vector<Mail> mails;
+    int connections;
+
+    static bool readline(const int fd, string &buf, string &line) {
+        size_t eol;
+        while ((eol = buf.find("\r\n")) == string::npos) {
+            char c[1024];
+            ssize_t n = read(fd, c, sizeof(c));
+            if (n <= 0) return false;
+            buf.append(c, n);
+        }
+        line = buf.substr(0, eol);
+        buf.erase(0, eol + 2);
+        return true;
+    }
+
+    static void reply(const int fd, const string text) {
+        string data = text + "\r\n";
+        if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) {}
+    }
+
+    static string address(const string line) {
+        size_t start = line.find('<'), end = line.rfind('>');
+        return start == string::npos || end == string::npos ? "" : line.substr(start + 1, end - start - 1);
+    }
+
+    void serve(const int fd) {
+        string buf, line;
+        Mail mail;
+        reply(fd, "220 sink");
+        while (readline(fd, buf, line)) {
+            string cmd = line.substr(0, 4);
+            if (cmd == "EHLO" || cmd == "HELO" || cmd == "RSET") {
+                reply(fd, "250 ok");
+            } else if (cmd == "MAIL") {
+                mail.from = address(line);
+                reply(fd, "250 ok");
+            } else if (cmd == "RCPT") {
+                mail.to = address(line);
+                lock_guard<mutex> guard(lock);
+                reply(fd, tempfail.count(mail.to) ? "451 try later" : permfail.count(mail.to) ? "550 no such user" : "250 ok");
+            } else if (cmd == "DATA") {
+                reply(fd, "354 go ahead");
+                mail.data.clear();
+                while (readline(fd, buf, line) && line != ".") mail.data += line + "\n";
+                lock_guard<mutex> guard(lock);
+                mails.push_back(mail);
+                reply(fd, "250 queued");
+            } else if (cmd == "QUIT") {
+                reply(fd, "221 bye");
+                return;
+            } else {
+                reply(fd, "500 what");
+            }
+        }
+    }
+
+public:
+    set<string> tempfail, permfail;
+    int port;
+
+    SmtpSink() : connections(0), port(0) {
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, len) != 0 || listen(lfd, 4) != 0 ||
+                getsockname(lfd, (struct sockaddr *)&addr, &len) != 0) {
+            cerr << "test_wsreminders: can not listen on a local socket" << endl;
+            exit(TEST_SKIPPED);
+        }
+        port = ntohs(addr.sin_port);
+        server = thread([this]() {
+            int fd;
+            while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+                {
+                    lock_guard<mutex> guard(lock);
+                    connections++;
+                }
+                serve(fd);
+                close(fd);
+            }
+        });
+    }
+
+    ~SmtpSink() {
+        stop();
+    }
+
+    // no more connections, the port stays bound so nobody else gets it
+    void stop() {
+        if (server.joinable()) {
+            shutdown(lfd, SHUT_RDWR);
+            server.join();
+        }
+    }
+
+    vector<Mail> received() {
+        lock_guard<mutex> guard(lock);
+        return mails;
+    }
+
+    int sessions() {
+        lock_guard<mutex> guard(lock);
+        return connections;
+    }
+};
+
+
+static void entry(const string dbdir, const string name, const long expiration, const int reminder) {
+    string filename = dbdir + "/" + name;
+    ostringstream content;
+    content << "workspace: /ws/" << name << "\nexpiration: " << expiration << "\nextensions: 3\n"
+            << "acctcode: acct\nreminder: " << reminder << "\nmailaddress: \"\"\ncomment: \"\"\n";
+    CHECK(rename(writefile(filename, content.str()).c_str(), filename.c_str()) == 0);
+}
+
+static bool queued(const string dbdir, const string name, WsReminder &r) {
+    return WsReminders::get(dbdir, name, r);
+}
+
+static WsReminder reminder(const string name, const long expiration, const string mailaddress) {
+    WsReminder r = {name, name.substr(name.find('-') + 1), expiration, mailaddress, 0, 0, 0};
+    return r;
+}
+
+static bool contains(const string &s, const string part) {
+    return s.find(part) != string::npos;
+}
+
+// reminders of one recipient go out in one mail, all recipients in one session
+static void testcoalesce(const WsConfig &config, const string dbdir, SmtpSink &sink) {
+    long t = time(NULL);
+    entry(dbdir, "user-a", t + 2*24*3600, 7);
+    entry(dbdir, "user-b", t + 3*24*3600, 7);
+    entry(dbdir, "user-c", t + 2*24*3600, 7);
+    entry(dbdir, "user-extended", t + 30*24*3600, 1);
+    CHECK(WsReminders::queue(dbdir, reminder("user-a", t + 2*24*3600, "a@example.com")));
+    CHECK(WsReminders::queue(dbdir, reminder("user-b", t + 3*24*3600, "a@example.com")));
+    CHECK(WsReminders::queue(dbdir, reminder("user-c", t + 2*24*3600, "c@example.com")));
+    CHECK(WsReminders::queue(dbdir, reminder("user-extended", t + 2*24*3600, "a@example.com")));
+    CHECK(WsReminders::queue(dbdir, reminder("user-released", t + 2*24*3600, "a@example.com")));
+
+    ostringstream out;
+    WsReminders::send(out, config, {"unittest"}, false);
+    vector<Mail> mails = sink.received();
+    CHECK_EQUAL(mails.size(), 2u);
+    CHECK_EQUAL(sink.sessions(), 1);
+    for (const Mail &m: mails) {
+        CHECK_EQUAL(m.from, "wsadmin@example.com");
+        if (m.to == "a@example.com") {
+            CHECK(contains(m.data, "Subject: 2 workspaces on unittest will expire"));
+            CHECK(contains(m.data, "a at ") && contains(m.data, "b at "));
+            CHECK(!contains(m.data, "extended") && !contains(m.data, "released"));
+        } else {
+            CHECK_EQUAL(m.to, "c@example.com");
+            CHECK(contains(m.data, "Subject: Workspace c will expire at"));
+        }
+    }
+    CHECK(contains(out.str(), "DROP_REMINDER extended"));
+    CHECK(contains(out.str(), "DROP_REMINDER released"));
+    CHECK_EQUAL(WsReminders::due(dbdir, t + 365*24*3600).size(), 0u);
+}
+
+/*
+ * a temporary failure is retried later with growing waits, the daily queueing of
+ * the expirer does not reset that, and after maxattempts the reminder is dropped
+ */
+static void testretry(const WsConfig &config, const string dbdir, SmtpSink &sink) {
+    long t = time(NULL);
+    entry(dbdir, "user-t", t + 2*24*3600, 7);
+    sink.tempfail.insert("t@example.com");
+    CHECK(WsReminders::requeue(dbdir, reminder("user-t", t + 2*24*3600, "t@example.com")));
+
+    ostringstream out;
+    WsReminders::send(out, config, {"unittest"}, false);
+    CHECK(contains(out.str(), "RETRY_REMINDER t"));
+    WsReminder r;
+    CHECK(queued(dbdir, "user-t", r));
+    CHECK_EQUAL(r.attempts, 1);
+    CHECK(r.next >= t + 300);
+    long first = r.next;
+
+    // not due yet, nothing is sent
+    size_t sent = sink.received().size();
+    WsReminders::send(out, config, {"unittest"}, false);
+    CHECK(queued(dbdir, "user-t", r));
+    CHECK_EQUAL(r.attempts, 1);
+
+    // queued again by the next expirer run, attempts and next stay
+    CHECK(WsReminders::requeue(dbdir, reminder("user-t", t + 2*24*3600, "t@example.com")));
+    CHECK(queued(dbdir, "user-t", r));
+    CHECK_EQUAL(r.attempts, 1);
+    CHECK_EQUAL(r.next, first);
+
+    // another address starts over
+    CHECK(WsReminders::requeue(dbdir, reminder("user-t", t + 2*24*3600, "t2@example.com")));
+    CHECK(queued(dbdir, "user-t", r));
+    CHECK_EQUAL(r.attempts, 0);
+    r.mailaddress = "t@example.com";
+    r.attempts = 1;
+    r.next = 0;
+    CHECK(WsReminders::queue(dbdir, r));
+
+    // the wait grows with each failure
+    WsReminders::send(out, config, {"unittest"}, false);
+    CHECK(queued(dbdir, "user-t", r));
+    CHECK_EQUAL(r.attempts, 2);
+    CHECK(r.next - time(NULL) > first - t);
+    CHECK_EQUAL(sink.received().size(), sent);
+
+    // the last attempt fails, the reminder is dropped
+    r.attempts = 9;
+    r.next = 0;
+    CHECK(WsReminders::queue(dbdir, r));
+    WsReminders::send(out, config, {"unittest"}, false);
+    CHECK(!queued(dbdir, "user-t", r));
+
+    // a permanent failure is not retried
+    sink.permfail.insert("p@example.com");
+    entry(dbdir, "user-p", t + 2*24*3600, 7);
+    CHECK(WsReminders::queue(dbdir, reminder("user-p", t + 2*24*3600, "p@example.com")));
+    WsReminders::send(out, config, {"unittest"}, false);
+    CHECK(!queued(dbdir, "user-p", r));
+
+    // the server is gone, everything is tried again later
+    sink.stop();
+    CHECK(WsReminders::queue(dbdir, reminder("user-a", t + 2*24*3600, "a@example.com")));
+    CHECK(WsReminders::queue(dbdir, reminder("user-c", t + 2*24*3600, "c@example.com")));
+    ostringstream down;
+    WsReminders::send(down, config, {"unittest"}, false);
+    CHECK(contains(down.str(), "Socket error"));
+    CHECK(queued(dbdir, "user-a", r) && r.attempts == 1);
+    CHECK(queued(dbdir, "user-c", r) && r.attempts == 1);
+    CHECK_EQUAL(sink.received().size(), sent);
+}
+
+int main() {
+    string base = maketempdir("test_wsreminders");
+    string dbdir = base + "/db";
+    mkdir(dbdir.c_str(), 0755);
+    mkdir((dbdir + "/.ws_reminders").c_str(), 0755);
+    mkdir((base + "/space").c_str(), 0755);
+
+    SmtpSink sink;
+    ostringstream conf;
+    conf << "admins: [root]\nclustername: unittest\ndbuid: " << geteuid() << "\ndbgid: " << getegid()
+         << "\nduration: 10\nmaxextensions: 1\nsmtphost: 127.0.0.1:" << sink.port
+         << "\nmail_from: wsadmin@example.com\nworkspaces:\n  unittest:\n    database: " << dbdir
+         << "\n    deleted: .removed\n    keeptime: 7\n    spaces: [" << base << "/space]\n";
+    string conffile = base + "/ws.conf";
+    CHECK(rename(writefile(conffile, conf.str()).c_str(), conffile.c_str()) == 0);
+    WsConfig config;
+    config.load(conffile, "");
+
+    testcoalesce(config, dbdir, sink);
+    testretry(config, dbdir, sink);
+
+    system(("rm -rf " + base).c_str());
+    return result("test_wsreminders");
+}
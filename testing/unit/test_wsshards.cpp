@@ -0,0 +1,302 @@
+/*
+ *  workspace++
+ *
+ *  test_wsshards
+ *
+ *  unit test of sharded DB directories: lookups in a directory which is half
+ *  migrated, and a migration while another process writes entries
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsdb.h"
+#include "wsexpiry.h"
+#include "wsindex.h"
+#include "wsshards.h"
+#include "wsusers.h"
+#include "wserror.h"
+#include "unittest.h"
+
+using namespace std;
+
+
+static bool exists(const string path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+static bool contains(const vector<string> &v, const string s) {
+    return find(v.begin(), v.end(), s) != v.end();
+}
+
+static bool created(const string filename, const string wsdir, const long expiration) {
+    try {
+        WsDB entry(filename, wsdir, expiration, 3, "acct", getuid(), getgid(), 0, "", "", "");
+        return true;
+    } catch (const WsError &e) {
+        return false;
+    }
+}
+
+static void setexpiration(const string filename, const long expiration) {
+    WsDB entry(filename, 0, 0);
+    entry.setexpiration(expiration);
+    entry.write_dbfile();
+}
+
+// entry written by hand, like the python version or an admin would
+static void placeentry(const string filename, const string wsdir, const long expiration) {
+    string content = "workspace: " + wsdir + "\nexpiration: " + to_string(expiration) +
+                     "\nextensions: 3\nacctcode: acct\nreminder: 0\nmailaddress: \"\"\ncomment: \"\"\n";
+    CHECK(rename(writefile(filename, content).c_str(), filename.c_str()) == 0);
+}
+
+// regular files left directly in dir, apart from the dotfiles
+static int flatentries(const string dir) {
+    int n = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        struct stat st;
+        if (de->d_name[0] != '.' && lstat((dir + "/" + de->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) n++;
+    }
+    if (d) closedir(d);
+    return n;
+}
+
+// expiration of entry name in the index of dir, -1 if not there
+static long indexed(const string dir, const string name) {
+    WsIndex index(dir);
+    if (!index.valid()) return -1;
+    const WsIndexRecord *r = index.find(name);
+    return r ? r->expiration : -1;
+}
+
+static bool enable(const string dir) {
+    return WsIndex::rebuild(dir, 0, 0) && WsUsers::rebuild(dir, 0, 0) && WsExpiry::rebuild(dir, 0, 0);
+}
+
+/*
+ * the state migrate() leaves while it moves entries: shards and .ws_shards exist,
+ * some entries are in their shard, some still flat, some in both places
+ */
+static void testhalfmigrated(const string dir) {
+    string half = dir + "/half";
+    CHECK(mkdir(half.c_str(), 0755) == 0);
+    for (const string shard: {"/00", "/01", "/02", "/03"}) {
+        CHECK(mkdir((half + shard).c_str(), 0755) == 0);
+    }
+    CHECK(rename(writefile(half + "/.ws_shards", "4\n").c_str(), (half + "/.ws_shards").c_str()) == 0);
+    CHECK_EQUAL(WsShards::fanout(half), 4);
+
+    string flat = half + "/alice-flat";
+    string sharded = half + "/alice-sharded";
+    string both = half + "/bob-both";
+    string missing = half + "/bob-missing";
+    placeentry(flat, "/ws/alice-flat", 1600000000L);
+    placeentry(WsShards::canonical(sharded), "/ws/alice-sharded", 1600000000L);
+    placeentry(both, "/ws/bob-both-old", 1600000000L);
+    placeentry(WsShards::canonical(both), "/ws/bob-both", 1600000001L);
+    CHECK(enable(half));
+
+    // shard first, flat only if it was not moved yet
+    CHECK(WsShards::canonical(flat) != flat);
+    CHECK_EQUAL(WsShards::locate(flat), flat);
+    CHECK_EQUAL(WsShards::locate(sharded), WsShards::canonical(sharded));
+    CHECK_EQUAL(WsShards::locate(both), WsShards::canonical(both));
+    CHECK_EQUAL(WsShards::locate(missing), WsShards::canonical(missing));
+    CHECK(WsShards::exists(flat));
+    CHECK(WsShards::exists(sharded));
+    CHECK(WsShards::exists(both));
+    CHECK(!WsShards::exists(missing));
+    CHECK_EQUAL(WsDB(flat, 0, 0).getwsdir(), "/ws/alice-flat");
+    CHECK_EQUAL(WsDB(both, 0, 0).getwsdir(), "/ws/bob-both");
+
+    // listing covers the directory and the shards, a user only its own shard
+    vector<string> all = WsShards::dirs(half);
+    CHECK_EQUAL(all.size(), 5u);
+    CHECK(contains(all, half));
+    CHECK(contains(all, half + "/00") && contains(all, half + "/03"));
+    vector<string> alice = WsShards::dirs(half + "/", "alice");
+    CHECK_EQUAL(alice.size(), 2u);
+    CHECK(contains(alice, half));
+    string shard = WsShards::canonical(flat);
+    CHECK(contains(alice, shard.substr(0, shard.rfind('/'))));
+
+    // rebuilds found the entries in both places, the shard wins
+    CHECK_EQUAL(indexed(half, "alice-flat"), 1600000000L);
+    CHECK_EQUAL(indexed(half, "alice-sharded"), 1600000000L);
+    CHECK_EQUAL(indexed(half, "bob-both"), 1600000001L);
+    vector<string> entries = WsUsers::entries(half, "alice");
+    CHECK_EQUAL(entries.size(), 2u);
+    CHECK(contains(entries, "alice-flat") && contains(entries, "alice-sharded"));
+    CHECK(contains(WsUsers::entries(half, "bob"), "bob-both"));
+
+    // writing an entry which is still flat moves it into its shard
+    setexpiration(flat, 1700000000L);
+    CHECK(!exists(flat));
+    CHECK(exists(WsShards::canonical(flat)));
+    CHECK_EQUAL(WsShards::locate(flat), WsShards::canonical(flat));
+    CHECK_EQUAL(WsDB(flat, 0, 0).getexpiration(), 1700000000L);
+    CHECK_EQUAL(indexed(half, "alice-flat"), 1700000000L);
+    CHECK(contains(WsUsers::entries(half, "alice"), "alice-flat"));
+    vector<string> buckets;
+    CHECK(contains(WsExpiry::due(half, time(NULL) + 86400, buckets), "alice-flat"));
+
+    // a new entry never replaces an existing one
+    CHECK(!created(both, "/ws/bob-new", 1600000000L));
+    CHECK(created(missing, "/ws/bob-missing", 1600000000L));
+    CHECK_EQUAL(WsShards::locate(missing), WsShards::canonical(missing));
+    CHECK(contains(WsUsers::entries(half, "bob"), "bob-missing"));
+    CHECK_EQUAL(indexed(half, "bob-missing"), 1600000000L);
+}
+
+static const int users = 10;
+static const long base = 1700000000L;
+
+/*
+ * a process which saw the directory flat keeps rewriting and creating entries
+ * while it is migrated, until stop exists, and reports what it did on fd
+ */
+static void writer(const string dir, const string stop, const int fd) {
+    long iterations = 0, creations = 0, errors = 0;
+    while (!exists(stop)) {
+        try {
+            setexpiration(dir + "/user" + to_string(iterations % users) + "-ws", base + iterations);
+        } catch (...) {
+            errors++;
+        }
+        iterations++;
+        if (iterations % 10 == 0) {
+            if (created(dir + "/writer-" + to_string(creations), "/ws/writer", base)) {
+                creations++;
+            } else {
+                errors++;
+            }
+        }
+        usleep(10000);
+    }
+    long report[3] = { iterations, creations, errors };
+    if (write(fd, report, sizeof(report)) != sizeof(report)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/*
+ * migration with a concurrent writer: no entry is lost or left flat, no update
+ * is lost, and the index, expiration queue and manifests find every entry
+ */
+static void testconcurrent(const string dir) {
+    string db = dir + "/migrate";
+    string stop = dir + "/stop";
+    CHECK(mkdir(db.c_str(), 0755) == 0);
+    CHECK(enable(db));
+    for (int i = 0; i < users; i++) {
+        CHECK(created(db + "/user" + to_string(i) + "-ws", "/ws/user", base));
+    }
+    CHECK_EQUAL(WsShards::fanout(db), 0);
+
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        writer(db, stop, fds[1]);
+    }
+    close(fds[1]);
+
+    CHECK(WsShards::migrate(db, 4, 0, 0));
+    // the writer keeps going with the shards for a while
+    usleep(500000);
+    CHECK(rename(writefile(stop, "").c_str(), stop.c_str()) == 0);
+    long report[3] = { 0, 0, 0 };
+    CHECK(read(fds[0], report, sizeof(report)) == sizeof(report));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    long iterations = report[0], creations = report[1];
+    CHECK_EQUAL(report[2], 0L);
+    // the writer wrote before, during and after the migration window
+    CHECK(iterations > 20 && creations > 0);
+
+    CHECK_EQUAL(WsShards::fanout(db), 4);
+    CHECK_EQUAL(flatentries(db), 0);
+    vector<string> names;
+    for (int i = 0; i < users; i++) {
+        names.push_back("user" + to_string(i) + "-ws");
+    }
+    for (long i = 0; i < creations; i++) {
+        names.push_back("writer-" + to_string(i));
+    }
+    vector<string> buckets;
+    vector<string> due = WsExpiry::due(db, time(NULL) + 86400, buckets);
+    for (size_t i = 0; i < names.size(); i++) {
+        string filename = db + "/" + names[i];
+        // last expiration the writer set, or the one it was created with
+        long expiration = base;
+        if ((long)i < users && iterations > (long)i) {
+            expiration = base + i + (iterations - 1 - i) / users * users;
+        }
+        CHECK(exists(WsShards::canonical(filename)));
+        CHECK_EQUAL(WsShards::locate(filename), WsShards::canonical(filename));
+        CHECK_EQUAL(WsDB(filename, 0, 0).getexpiration(), expiration);
+        CHECK_EQUAL(indexed(db, names[i]), expiration);
+        CHECK(contains(due, names[i]));
+    }
+    CHECK_EQUAL(WsUsers::entries(db, "writer").size(), (size_t)creations);
+    CHECK(contains(WsUsers::entries(db, "user3"), "user3-ws"));
+
+    // rebuilding from the shards gives the same
+    CHECK(WsIndex::rebuild(db, 0, 0));
+    CHECK_EQUAL(WsIndex(db).entries().size(), names.size());
+    CHECK_EQUAL(indexed(db, "user0-ws"), WsDB(db + "/user0-ws", 0, 0).getexpiration());
+
+    // migrating again moves nothing and does not wait
+    CHECK(WsShards::migrate(db, 4, 0, 0));
+    CHECK(!WsShards::migrate(db, 8, 0, 0));
+}
+
+int main() {
+    // writing entries raises and lowers privileges like the setuid tools do
+    if (geteuid() != 0) {
+        cerr << "test_wsshards: needs root to write entries, skipped" << endl;
+        return TEST_SKIPPED;
+    }
+    string dir = maketempdir("test_wsshards");
+
+    testhalfmigrated(dir);
+    testconcurrent(dir);
+
+    system(("rm -rf " + dir).c_str());
+    return result("test_wsshards");
+}
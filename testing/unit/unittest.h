@@ -0,0 +1,91 @@
+#ifndef UNITTEST_H
+#define UNITTEST_H
+
+/*
+ *  workspace++
+ *
+ *  unittest
+ *
+ *  minimal helpers for the unit tests run by ctest, each test is a program
+ *  that exits with 0 on success, 1 on failure and 77 if it can not run here
+ *
+ *  (c) Holger Berger 2013, 2014, 2015, 2016, 2017, 2018, 2019, 2020, 2021
+ *
+ *  workspace++ is based on workspace by Holger Berger, Thomas Beisel and Martin Hecht
+ *
+ *  workspace++ is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  workspace++ is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with workspace++.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const int TEST_SKIPPED = 77;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << endl; \
+            failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(a, b) \
+    do { \
+        if (!((a) == (b))) { \
+            cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #a " == " #b \
+                 << " (" << (a) << " != " << (b) << ")" << endl; \
+            failures++; \
+        } \
+    } while (0)
+
+// fresh directory for one test, below TMPDIR
+static inline string maketempdir(const string name) {
+    const char *tmp = getenv("TMPDIR");
+    string path = string(tmp ? tmp : "/tmp") + "/" + name + ".XXXXXX";
+    if (mkdtemp(&path[0]) == NULL) {
+        cerr << "can not create temporary directory " << path << endl;
+        exit(1);
+    }
+    return path;
+}
+
+// write a new file with content, filename gets a number so no file is overwritten
+// (freeing the blocks of a truncated file is slow on filesystems with discard)
+static inline string writefile(const string filename, const string content) {
+    static int counter = 0;
+    string name = filename + "." + to_string(counter++);
+    ofstream out(name.c_str(), ios::binary | ios::trunc);
+    out << content;
+    return name;
+}
+
+// exit code of the test program
+static inline int result(const string name) {
+    if (failures) {
+        cerr << name << ": " << failures << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif